@@ -0,0 +1,111 @@
+#pragma once
+#include "common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Frame time benchmark: CPU time (recording + submitting, without waiting for the GPU) and GPU time (timestamp queries)
+// are collected for every frame and reported as min / avg / p99 at the end of the run.
+
+struct FrameTimeSamples
+{
+  std::vector<double> cpu; // Milliseconds per frame
+  std::vector<double> gpu; // Milliseconds per frame (stays empty if the graphics queue can't write timestamps)
+};
+
+FrameTimeSamples g_frameTimes;
+VkQueryPool g_benchQueryPool = VK_NULL_HANDLE;
+uint64_t g_timestampMask = 0; // Only timestampValidBits of the results are meaningful
+std::vector<bool> g_benchQueryWritten; // Slot has been submitted at least once, so results can be read back
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double millisecondsBetween(BenchClock::time_point start, BenchClock::time_point end)
+{
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// One slot (begin + end timestamp) per frame that can be in flight at the same time.
+void createBenchmarkQueries(uint32_t slotCount)
+{
+  const DeviceInfo& info = getDeviceInfo(g_physicalDevice);
+  uint32_t validBits = info.queueFamilies[info.indices.graphicsFamily.value()].timestampValidBits;
+  if(validBits == 0)
+  {
+    std::cout << "Benchmark: graphics queue does not support timestamps, GPU times not measured." << std::endl;
+    return;
+  }
+  g_timestampMask = (validBits >= 64) ? ~0ULL : ((1ULL << validBits) - 1);
+
+  VkQueryPoolCreateInfo queryPoolCreateInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+  queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolCreateInfo.queryCount = slotCount * 2; // Begin and end of the frame
+  CHECK_VULKAN_ERRORS( vkCreateQueryPool(g_device, &queryPoolCreateInfo, g_allocator, &g_benchQueryPool) );
+  g_benchQueryWritten.assign(slotCount, false);
+}
+
+void destroyBenchmarkQueries()
+{
+  if(g_benchQueryPool != VK_NULL_HANDLE) vkDestroyQueryPool(g_device, g_benchQueryPool, g_allocator);
+  g_benchQueryPool = VK_NULL_HANDLE;
+  g_benchQueryWritten.clear();
+}
+
+// Record at the very beginning of the frame's command buffer (outside of any render pass).
+void writeFrameBeginTimestamp(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+  if(g_benchQueryPool == VK_NULL_HANDLE) return;
+  vkCmdResetQueryPool(commandBuffer, g_benchQueryPool, slot * 2, 2);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, g_benchQueryPool, slot * 2);
+}
+
+// Record at the very end of the frame's command buffer.
+void writeFrameEndTimestamp(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+  if(g_benchQueryPool == VK_NULL_HANDLE) return;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_benchQueryPool, slot * 2 + 1);
+  g_benchQueryWritten[slot] = true;
+}
+
+// Call only after the slot's frame fence has signaled: the results are then available without waiting.
+void collectGpuFrameTime(uint32_t slot)
+{
+  if(g_benchQueryPool == VK_NULL_HANDLE || !g_benchQueryWritten[slot]) return;
+
+  uint64_t timestamps[2];
+  VkResult result = vkGetQueryPoolResults(g_device, g_benchQueryPool, slot * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if(result != VK_SUCCESS) return; // VK_NOT_READY: skip the sample rather than stall
+
+  uint64_t ticks = (timestamps[1] - timestamps[0]) & g_timestampMask;
+  g_frameTimes.gpu.push_back(static_cast<double>(ticks) * g_properties.limits.timestampPeriod / 1000000.0); // ns -> ms
+  g_benchQueryWritten[slot] = false;
+}
+
+void addCpuFrameTime(double milliseconds)
+{
+  g_frameTimes.cpu.push_back(milliseconds);
+}
+
+static void reportSamples(const char* name, std::vector<double> samples)
+{
+  if(samples.empty())
+  {
+    std::cout << name << ": no samples" << std::endl;
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+
+  double sum = 0.0;
+  for(double sample : samples) sum += sample;
+  size_t p99Index = static_cast<size_t>(std::ceil(0.99 * samples.size())) - 1; // Nearest-rank percentile
+
+  std::cout << name << " frame time (ms): min " << samples.front() << " | avg " << sum / samples.size() << " | p99 " << samples[p99Index] << " | samples " << samples.size() << std::endl;
+}
+
+void reportFrameTimes()
+{
+  std::cout << "Benchmark results on " << g_properties.deviceName << " (" << g_swapChainExtent.width << "x" << g_swapChainExtent.height << "):" << std::endl;
+  reportSamples("CPU", g_frameTimes.cpu);
+  reportSamples("GPU", g_frameTimes.gpu);
+}
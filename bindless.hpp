@@ -0,0 +1,290 @@
+#pragma once
+#include "common.hpp"
+#include "threads.hpp"
+
+// Shader resources (textures, storage buffers) are registered once and addressed by index. With descriptor indexing
+// (TEMPLATE_VULKAN_1_2=1 on a device supporting it) the indices point into one global descriptor set, the heap, which is
+// bound once per command buffer: registering writes the descriptor (update-after-bind), draws only push their indices.
+// Otherwise every draw gets its own small descriptor set written from the registered resources, allocated from pools of
+// the frame slot and the recording thread, which are reset as a whole when the slot comes around again.
+// Shader interface, both ways: set 0, binding 0 sampler2D textures[], binding 1 storage buffers[], push constants
+// { uint texture; uint buffer; } (DrawResourceIndices). Without descriptor indexing the arrays have a single element,
+// the one the indices selected, so the shaders index with 0 there.
+
+const uint32_t BINDLESS_MAX_TEXTURES = 16384; // Clamped to the device limits
+const uint32_t BINDLESS_MAX_BUFFERS = 16384;
+const uint32_t DRAW_DESCRIPTOR_SETS_PER_POOL = 256; // Fallback: sets per pool, pools are added when a thread runs out
+const uint32_t RESOURCE_NONE = UINT32_MAX; // Draw uses no resource of the kind
+
+enum ResourceKind { RESOURCE_TEXTURE = 0, RESOURCE_BUFFER = 1, RESOURCE_KIND_COUNT };
+
+struct DrawResourceIndices // Push constants at offset 0
+{
+  uint32_t texture = RESOURCE_NONE;
+  uint32_t buffer = RESOURCE_NONE;
+};
+
+struct ResourceIndices
+{
+  uint32_t capacity = 0;
+  uint32_t next = 0; // Never used above this
+  std::vector<uint32_t> freeIndices;
+};
+
+struct RetiredResourceIndex
+{
+  ResourceKind kind;
+  uint32_t index;
+  uint64_t usedUntilFrame; // Frames numbered below this may still read the descriptor
+};
+
+struct DrawDescriptorPools
+{
+  std::vector<VkDescriptorPool> pools;
+  uint32_t current = 0; // Pool being allocated from
+  uint32_t allocated = 0; // Sets allocated from the current pool
+};
+
+VkDescriptorSetLayout g_resourceSetLayout = VK_NULL_HANDLE;
+VkPipelineLayout g_resourcePipelineLayout = VK_NULL_HANDLE; // Set 0 + push constants: pipelines reading resources use this
+VkDescriptorPool g_descriptorHeapPool = VK_NULL_HANDLE;
+VkDescriptorSet g_descriptorHeap = VK_NULL_HANDLE; // Bindless only
+ResourceIndices g_resourceIndices[RESOURCE_KIND_COUNT];
+std::vector<VkDescriptorImageInfo> g_textureDescriptors; // By index, for the per-draw sets
+std::vector<VkDescriptorBufferInfo> g_bufferDescriptors;
+std::vector<RetiredResourceIndex> g_retiredResourceIndices;
+std::vector<std::vector<DrawDescriptorPools>> g_drawDescriptorPools; // [frame slot][thread], per-draw model only
+
+// After the logical device, before the pipelines using g_resourcePipelineLayout.
+void createResourceHeap()
+{
+  uint32_t textureCount = 1;
+  uint32_t bufferCount = 1;
+  VkDescriptorBindingFlags bindingFlags[2] = {};
+  if(g_descriptorIndexing)
+  {
+    const VkPhysicalDeviceVulkan12Properties& limits = getDeviceInfo(g_physicalDevice).properties12;
+    textureCount = std::min({ BINDLESS_MAX_TEXTURES, limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages });
+    bufferCount = std::min({ BINDLESS_MAX_BUFFERS, limits.maxDescriptorSetUpdateAfterBindStorageBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+    // Slots no in-flight frame reads can be written while the set is bound, and unwritten slots are never read:
+    bindingFlags[0] = bindingFlags[1] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+  }
+  g_resourceIndices[RESOURCE_TEXTURE].capacity = g_descriptorIndexing ? textureCount : BINDLESS_MAX_TEXTURES; // Per draw: only the table limits
+  g_resourceIndices[RESOURCE_BUFFER].capacity = g_descriptorIndexing ? bufferCount : BINDLESS_MAX_BUFFERS;
+
+  VkDescriptorSetLayoutBinding bindings[2] = {};
+  bindings[0].binding = RESOURCE_TEXTURE;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = textureCount;
+  bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+  bindings[1].binding = RESOURCE_BUFFER;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[1].descriptorCount = bufferCount;
+  bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+  bindingFlagsCreateInfo.bindingCount = 2;
+  bindingFlagsCreateInfo.pBindingFlags = bindingFlags;
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+  setLayoutCreateInfo.bindingCount = 2;
+  setLayoutCreateInfo.pBindings = bindings;
+  if(g_descriptorIndexing)
+  {
+    setLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+    setLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  }
+  CHECK_VULKAN_ERRORS( vkCreateDescriptorSetLayout(g_device, &setLayoutCreateInfo, g_allocator, &g_resourceSetLayout) );
+
+  VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_ALL, 0, sizeof(DrawResourceIndices) };
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+  pipelineLayoutCreateInfo.setLayoutCount = 1;
+  pipelineLayoutCreateInfo.pSetLayouts = &g_resourceSetLayout;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+  CHECK_VULKAN_ERRORS( vkCreatePipelineLayout(g_device, &pipelineLayoutCreateInfo, g_allocator, &g_resourcePipelineLayout) );
+
+  if(!g_descriptorIndexing) return; // Per-draw sets come from the frame slots' pools (createDrawDescriptorPools)
+
+  VkDescriptorPoolSize poolSizes[2] = { { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureCount }, { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, bufferCount } };
+  VkDescriptorPoolCreateInfo poolCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+  poolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolCreateInfo.maxSets = 1;
+  poolCreateInfo.poolSizeCount = 2;
+  poolCreateInfo.pPoolSizes = poolSizes;
+  CHECK_VULKAN_ERRORS( vkCreateDescriptorPool(g_device, &poolCreateInfo, g_allocator, &g_descriptorHeapPool) );
+
+  VkDescriptorSetAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+  allocateInfo.descriptorPool = g_descriptorHeapPool;
+  allocateInfo.descriptorSetCount = 1;
+  allocateInfo.pSetLayouts = &g_resourceSetLayout;
+  CHECK_VULKAN_ERRORS( vkAllocateDescriptorSets(g_device, &allocateInfo, &g_descriptorHeap) );
+  std::cout << "Descriptor heap: " << textureCount << " textures, " << bufferCount << " storage buffers" << std::endl;
+}
+
+void destroyResourceHeap()
+{
+  if(g_descriptorHeapPool != VK_NULL_HANDLE) vkDestroyDescriptorPool(g_device, g_descriptorHeapPool, g_allocator); // Frees the heap set
+  vkDestroyPipelineLayout(g_device, g_resourcePipelineLayout, g_allocator);
+  vkDestroyDescriptorSetLayout(g_device, g_resourceSetLayout, g_allocator);
+  g_descriptorHeapPool = VK_NULL_HANDLE;
+  g_descriptorHeap = VK_NULL_HANDLE;
+  g_resourcePipelineLayout = VK_NULL_HANDLE;
+  g_resourceSetLayout = VK_NULL_HANDLE;
+  for(ResourceIndices& indices : g_resourceIndices) indices = ResourceIndices();
+  g_textureDescriptors.clear();
+  g_bufferDescriptors.clear();
+  g_retiredResourceIndices.clear();
+}
+
+static uint32_t allocateResourceIndex(ResourceKind kind)
+{
+  ResourceIndices& indices = g_resourceIndices[kind];
+  if(!indices.freeIndices.empty())
+  {
+    uint32_t index = indices.freeIndices.back();
+    indices.freeIndices.pop_back();
+    return index;
+  }
+  if(indices.next == indices.capacity) throw std::runtime_error("Descriptor heap is full!");
+  return indices.next++;
+}
+
+static void writeResourceDescriptor(VkDescriptorSet set, ResourceKind kind, uint32_t arrayElement, uint32_t index)
+{
+  VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+  write.dstSet = set;
+  write.dstBinding = kind;
+  write.dstArrayElement = arrayElement;
+  write.descriptorCount = 1;
+  if(kind == RESOURCE_TEXTURE)
+  {
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &g_textureDescriptors[index];
+  } else
+  {
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &g_bufferDescriptors[index];
+  }
+  vkUpdateDescriptorSets(g_device, 1, &write, 0, nullptr);
+}
+
+// Register and release on the thread recording the frames, not between startDrawWork() and executeDrawWork(). The image must be in SHADER_READ_ONLY_OPTIMAL when drawn.
+uint32_t registerTexture(VkImageView imageView, VkSampler sampler)
+{
+  uint32_t index = allocateResourceIndex(RESOURCE_TEXTURE);
+  if(index >= g_textureDescriptors.size()) g_textureDescriptors.resize(index + 1);
+  g_textureDescriptors[index] = { sampler, imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+  if(g_descriptorIndexing) writeResourceDescriptor(g_descriptorHeap, RESOURCE_TEXTURE, index, index);
+  return index;
+}
+
+uint32_t registerStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+  uint32_t index = allocateResourceIndex(RESOURCE_BUFFER);
+  if(index >= g_bufferDescriptors.size()) g_bufferDescriptors.resize(index + 1);
+  g_bufferDescriptors[index] = { buffer, offset, range };
+  if(g_descriptorIndexing) writeResourceDescriptor(g_descriptorHeap, RESOURCE_BUFFER, index, index);
+  return index;
+}
+
+// The index is reused only after the frames submitted so far have finished: they may still read the old descriptor.
+void releaseResource(ResourceKind kind, uint32_t index, uint64_t submittedFrames)
+{
+  g_retiredResourceIndices.push_back({ kind, index, submittedFrames });
+}
+
+// completedFrames: every frame numbered below it has finished on the GPU.
+void recycleRetiredResourceIndices(uint64_t completedFrames)
+{
+  for(size_t i = 0; i < g_retiredResourceIndices.size();)
+  {
+    if(g_retiredResourceIndices[i].usedUntilFrame <= completedFrames)
+    {
+      g_resourceIndices[g_retiredResourceIndices[i].kind].freeIndices.push_back(g_retiredResourceIndices[i].index);
+      g_retiredResourceIndices[i] = g_retiredResourceIndices.back();
+      g_retiredResourceIndices.pop_back();
+    } else i++;
+  }
+}
+
+void createDrawDescriptorPools(uint32_t frameSlots, uint32_t threads)
+{
+  if(g_descriptorIndexing) return;
+  g_drawDescriptorPools.assign(frameSlots, std::vector<DrawDescriptorPools>(threads));
+}
+
+void destroyDrawDescriptorPools()
+{
+  for(std::vector<DrawDescriptorPools>& slotPools : g_drawDescriptorPools)
+  {
+    for(DrawDescriptorPools& threadPools : slotPools)
+    {
+      for(VkDescriptorPool pool : threadPools.pools) vkDestroyDescriptorPool(g_device, pool, g_allocator);
+    }
+  }
+  g_drawDescriptorPools.clear();
+}
+
+// Only after the slot's fence has been waited on: its descriptor sets are not in use by the GPU anymore.
+void resetDrawDescriptorPools(uint32_t slot)
+{
+  if(g_drawDescriptorPools.empty()) return;
+  for(DrawDescriptorPools& threadPools : g_drawDescriptorPools[slot])
+  {
+    if(threadPools.current == 0 && threadPools.allocated == 0) continue; // Nothing allocated since the last reset
+    for(uint32_t i = 0; i <= threadPools.current && i < threadPools.pools.size(); i++) CHECK_VULKAN_ERRORS( vkResetDescriptorPool(g_device, threadPools.pools[i], 0) );
+    threadPools.current = 0;
+    threadPools.allocated = 0;
+  }
+}
+
+static VkDescriptorSet allocateDrawDescriptorSet(uint32_t slot)
+{
+  DrawDescriptorPools& threadPools = g_drawDescriptorPools[slot][t_threadIndex];
+  if(threadPools.allocated == DRAW_DESCRIPTOR_SETS_PER_POOL)
+  {
+    threadPools.current++;
+    threadPools.allocated = 0;
+  }
+  if(threadPools.current == threadPools.pools.size())
+  {
+    VkDescriptorPoolSize poolSizes[2] = { { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, DRAW_DESCRIPTOR_SETS_PER_POOL }, { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, DRAW_DESCRIPTOR_SETS_PER_POOL } };
+    VkDescriptorPoolCreateInfo poolCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    poolCreateInfo.maxSets = DRAW_DESCRIPTOR_SETS_PER_POOL;
+    poolCreateInfo.poolSizeCount = 2;
+    poolCreateInfo.pPoolSizes = poolSizes;
+    VkDescriptorPool pool;
+    CHECK_VULKAN_ERRORS( vkCreateDescriptorPool(g_device, &poolCreateInfo, g_allocator, &pool) );
+    threadPools.pools.push_back(pool);
+  }
+
+  VkDescriptorSetAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+  allocateInfo.descriptorPool = threadPools.pools[threadPools.current];
+  allocateInfo.descriptorSetCount = 1;
+  allocateInfo.pSetLayouts = &g_resourceSetLayout;
+  VkDescriptorSet set;
+  CHECK_VULKAN_ERRORS( vkAllocateDescriptorSets(g_device, &allocateInfo, &set) );
+  threadPools.allocated++;
+  return set;
+}
+
+// Once per command buffer, before the draws (startDrawWork() does it for every chunk). Nothing to do per draw.
+void bindResourceHeap(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint)
+{
+  if(g_descriptorHeap == VK_NULL_HANDLE) return;
+  vkCmdBindDescriptorSets(commandBuffer, bindPoint, g_resourcePipelineLayout, 0, 1, &g_descriptorHeap, 0, nullptr);
+}
+
+// Per draw, with a pipeline created with g_resourcePipelineLayout (or a compatible layout) bound. Thread-safe while recording.
+void bindDrawResources(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, uint32_t slot, DrawResourceIndices resources)
+{
+  if(!g_descriptorIndexing)
+  {
+    VkDescriptorSet set = allocateDrawDescriptorSet(slot);
+    if(resources.texture != RESOURCE_NONE) writeResourceDescriptor(set, RESOURCE_TEXTURE, 0, resources.texture);
+    if(resources.buffer != RESOURCE_NONE) writeResourceDescriptor(set, RESOURCE_BUFFER, 0, resources.buffer);
+    vkCmdBindDescriptorSets(commandBuffer, bindPoint, g_resourcePipelineLayout, 0, 1, &set, 0, nullptr);
+    resources = DrawResourceIndices{ 0, 0 }; // The single element of each binding
+  }
+  vkCmdPushConstants(commandBuffer, g_resourcePipelineLayout, VK_SHADER_STAGE_ALL, 0, sizeof(DrawResourceIndices), &resources);
+}
@@ -0,0 +1,446 @@
+#pragma once
+#include "common.hpp"
+#include "bench.hpp"
+#include "memory.hpp"
+#include "rendergraph.hpp"
+#include "gpuprofiler.hpp"
+#include "profiler.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+// Frame capture (TEMPLATE_CAPTURE): a "capture" pass after the main pass copies the backbuffer into a host-visible readback
+// buffer. The buffers form a ring bigger than the frames in flight: a frame's copy is picked up when its slot's fence has
+// been waited on anyway (collectCapture(), a few frames later, no stall), and handed to a writer thread which encodes it
+// to disk (PNG, or raw bytes) straight from the mapped memory, then frees the buffer. A frame finding no free buffer
+// (writer behind) is not captured, and counted.
+// Golden mode (TEMPLATE_CAPTURE_GOLDEN=1) compares the captured frames with golden/frame_<number>.png instead: the ones
+// differing (any channel off by more than the tolerance) are written to capture/ and fail the run, as do missing golden
+// frames and frames not captured (writer behind). Golden frames are only written when seeding (TEMPLATE_CAPTURE_GOLDEN_SEED=1,
+// "make golden-seed"): the captured frames replace them. The rendering depends on the frame number only, so headless runs
+// are repeatable. The committed golden frames come from a CPU rasterization of the default scene (tests/golden_reference.cpp,
+// "make golden-reference") until seeded on a reference GPU.
+// PNGs are written uncompressed (stored deflate blocks): no zlib needed and no CPU spent compressing, and the golden
+// frames are read back with the same limitation.
+
+enum CaptureMode { CAPTURE_OFF = 0, CAPTURE_PNG = 1, CAPTURE_RAW = 2 };
+
+const uint32_t CAPTURE_EXTRA_BUFFERS = 2; // Beyond one per frame in flight: frames the writer may lag behind
+
+enum CaptureBufferState { CAPTURE_FREE, CAPTURE_RECORDED, CAPTURE_WRITING };
+
+struct CaptureBuffer
+{
+  AllocatedBuffer buffer;
+  VkDeviceSize size = 0;
+  CaptureBufferState state = CAPTURE_FREE;
+  VkExtent2D extent = {};
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint64_t frameNumber = 0;
+};
+
+struct CaptureStats
+{
+  uint64_t captured = 0; // Copies recorded
+  uint64_t skipped = 0; // No free buffer
+  uint64_t written = 0;
+  uint64_t bytes = 0;
+  double writeMilliseconds = 0.0; // Writer thread, encoding and I/O
+  double frameMilliseconds = 0.0; // Render thread, picking buffers and recording the copies
+  uint64_t goldenMatched = 0;
+  uint64_t goldenCreated = 0;
+  uint64_t goldenFailed = 0; // Differing or missing
+};
+
+CaptureMode g_captureMode = CAPTURE_OFF;
+uint32_t g_captureEvery = 1; // Every Nth frame
+bool g_captureGolden = false;
+bool g_captureGoldenSeed = false; // Golden mode writes the golden frames instead of comparing
+uint32_t g_captureTolerance = 2;
+std::vector<CaptureBuffer> g_captureBuffers;
+std::vector<int32_t> g_captureSlots; // [frame slot] buffer the slot's frame copies into, -1: none
+std::deque<uint32_t> g_captureQueue; // Buffers for the writer
+std::mutex g_captureMutex; // Buffer states, queue and stats
+std::condition_variable g_captureCondition;
+std::thread g_captureThread;
+bool g_stopCapture = false;
+CaptureStats g_captureStats;
+
+static bool captureFormatSupported(VkFormat format)
+{
+  return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+static bool captureFormatIsBgra(VkFormat format)
+{
+  return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+  static uint32_t table[256];
+  static bool tableReady = false;
+  if(!tableReady) // Writer thread only
+  {
+    for(uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t value = i;
+      for(int bit = 0; bit < 8; bit++) value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+      table[i] = value;
+    }
+    tableReady = true;
+  }
+  crc = ~crc;
+  for(size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+  for(int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+static uint32_t readBigEndian(const uint8_t* data)
+{
+  return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) | (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+static void appendPngChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data)
+{
+  appendBigEndian(png, static_cast<uint32_t>(data.size()));
+  size_t typeStart = png.size();
+  png.insert(png.end(), type, type + 4);
+  png.insert(png.end(), data.begin(), data.end());
+  appendBigEndian(png, crc32(png.data() + typeStart, png.size() - typeStart));
+}
+
+// pixels: RGBA8 rows, tightly packed.
+static std::vector<uint8_t> encodePng(const uint8_t* pixels, uint32_t width, uint32_t height)
+{
+  std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  std::vector<uint8_t> header;
+  appendBigEndian(header, width);
+  appendBigEndian(header, height);
+  header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bits per channel, RGBA, deflate, no filter method, no interlace
+  appendPngChunk(png, "IHDR", header);
+
+  size_t rowBytes = static_cast<size_t>(width) * 4;
+  std::vector<uint8_t> raw; // Filter type 0 (none) before every row
+  raw.reserve((rowBytes + 1) * height);
+  for(uint32_t y = 0; y < height; y++)
+  {
+    raw.push_back(0);
+    raw.insert(raw.end(), pixels + y * rowBytes, pixels + (y + 1) * rowBytes);
+  }
+  std::vector<uint8_t> zlib = { 0x78, 0x01 };
+  zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+  for(size_t offset = 0; offset < raw.size(); offset += 65535) // Stored blocks of at most 65535 bytes
+  {
+    uint16_t length = static_cast<uint16_t>(std::min<size_t>(65535, raw.size() - offset));
+    zlib.push_back(offset + length >= raw.size() ? 1 : 0); // BFINAL, BTYPE 00
+    zlib.insert(zlib.end(), { static_cast<uint8_t>(length), static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(~length), static_cast<uint8_t>(~length >> 8) });
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+  }
+  uint32_t a = 1, b = 0; // Adler-32
+  for(uint8_t byte : raw)
+  {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  appendBigEndian(zlib, (b << 16) | a);
+  appendPngChunk(png, "IDAT", zlib);
+  appendPngChunk(png, "IEND", {});
+  return png;
+}
+
+// Reads PNGs as encodePng() writes them (RGBA8, stored deflate blocks, no row filters). Returns false for anything else.
+static bool decodeStoredPng(const std::vector<uint8_t>& png, uint32_t& width, uint32_t& height, std::vector<uint8_t>& pixels)
+{
+  if(png.size() < 8 + 25 || memcmp(png.data() + 1, "PNG", 3) != 0) return false;
+  std::vector<uint8_t> zlib;
+  width = height = 0;
+  for(size_t offset = 8; offset + 12 <= png.size();)
+  {
+    uint32_t length = readBigEndian(png.data() + offset);
+    const uint8_t* type = png.data() + offset + 4;
+    const uint8_t* data = type + 4;
+    if(offset + 12 + static_cast<size_t>(length) > png.size()) return false;
+    if(memcmp(type, "IHDR", 4) == 0)
+    {
+      if(length < 13 || data[8] != 8 || data[9] != 6 || data[12] != 0) return false; // RGBA8, not interlaced
+      width = readBigEndian(data);
+      height = readBigEndian(data + 4);
+    }
+    else if(memcmp(type, "IDAT", 4) == 0) zlib.insert(zlib.end(), data, data + length);
+    offset += 12 + static_cast<size_t>(length);
+  }
+  size_t rowBytes = static_cast<size_t>(width) * 4;
+  std::vector<uint8_t> raw;
+  size_t position = 2; // zlib header
+  while(true)
+  {
+    if(position + 5 > zlib.size() || (zlib[position] & 0x06) != 0) return false; // Compressed block
+    bool last = (zlib[position] & 1) != 0;
+    uint16_t length = static_cast<uint16_t>(zlib[position + 1] | (zlib[position + 2] << 8));
+    position += 5;
+    if(position + length > zlib.size()) return false;
+    raw.insert(raw.end(), zlib.begin() + position, zlib.begin() + position + length);
+    position += length;
+    if(last) break;
+  }
+  if(width == 0 || raw.size() != (rowBytes + 1) * height) return false;
+  pixels.resize(rowBytes * height);
+  for(uint32_t y = 0; y < height; y++)
+  {
+    if(raw[y * (rowBytes + 1)] != 0) return false; // Filtered row
+    memcpy(pixels.data() + y * rowBytes, raw.data() + y * (rowBytes + 1) + 1, rowBytes);
+  }
+  return true;
+}
+
+static std::string captureFileName(const char* directory, uint64_t frameNumber, const char* extension)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/frame_%06llu%s", static_cast<unsigned long long>(frameNumber), extension);
+  return directory + std::string(name);
+}
+
+static void writeCaptureFile(const std::string& path, const uint8_t* data, size_t size)
+{
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(data), size);
+  if(!file) std::cerr << "Capture: can't write " << path << std::endl;
+}
+
+// Returns true when the frame matched (or became, seeding) the golden one.
+static bool compareWithGolden(uint64_t frameNumber, const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, CaptureStats& stats)
+{
+  std::string goldenPath = captureFileName("golden", frameNumber, ".png");
+  if(g_captureGoldenSeed)
+  {
+    std::filesystem::create_directories("golden");
+    std::vector<uint8_t> png = encodePng(pixels.data(), width, height);
+    writeCaptureFile(goldenPath, png.data(), png.size());
+    stats.goldenCreated++;
+    return true;
+  }
+  std::ifstream file(goldenPath, std::ios::binary | std::ios::ate);
+  if(file.is_open())
+  {
+    std::vector<uint8_t> golden(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(golden.data()), golden.size());
+    uint32_t goldenWidth, goldenHeight;
+    std::vector<uint8_t> goldenPixels;
+    if(!decodeStoredPng(golden, goldenWidth, goldenHeight, goldenPixels))
+    {
+      std::cerr << "Golden " << goldenPath << ": not an uncompressed RGBA8 PNG" << std::endl;
+      return false;
+    }
+    if(goldenWidth != width || goldenHeight != height)
+    {
+      std::cerr << "Golden " << goldenPath << ": " << goldenWidth << "x" << goldenHeight << ", frame is " << width << "x" << height << std::endl;
+      return false;
+    }
+    uint64_t differing = 0;
+    uint32_t maxDifference = 0;
+    for(size_t pixel = 0; pixel < pixels.size(); pixel += 4)
+    {
+      uint32_t difference = 0;
+      for(size_t channel = 0; channel < 4; channel++) difference = std::max(difference, static_cast<uint32_t>(std::abs(pixels[pixel + channel] - goldenPixels[pixel + channel])));
+      if(difference > g_captureTolerance) differing++;
+      maxDifference = std::max(maxDifference, difference);
+    }
+    if(differing == 0)
+    {
+      stats.goldenMatched++;
+      return true;
+    }
+    std::cerr << "Golden " << goldenPath << ": " << differing << " pixels differ (max difference " << maxDifference << ")" << std::endl;
+    return false;
+  }
+  std::cerr << "Golden " << goldenPath << ": missing (make golden-seed writes the golden frames)" << std::endl;
+  return false;
+}
+
+static void writeCapture(const CaptureBuffer& capture, CaptureStats& stats)
+{
+  const uint8_t* data = static_cast<const uint8_t*>(capture.buffer.allocation.mapped);
+  size_t size = static_cast<size_t>(capture.extent.width) * capture.extent.height * 4;
+  if(g_captureMode == CAPTURE_RAW && !g_captureGolden)
+  {
+    char extension[48];
+    snprintf(extension, sizeof(extension), "_%ux%u.%s", capture.extent.width, capture.extent.height, captureFormatIsBgra(capture.format) ? "bgra" : "rgba");
+    writeCaptureFile(captureFileName("capture", capture.frameNumber, extension), data, size);
+    stats.bytes += size;
+    return;
+  }
+  std::vector<uint8_t> pixels(data, data + size);
+  if(captureFormatIsBgra(capture.format)) for(size_t i = 0; i < size; i += 4) std::swap(pixels[i], pixels[i + 2]);
+  if(g_captureGolden && compareWithGolden(capture.frameNumber, pixels, capture.extent.width, capture.extent.height, stats)) return;
+  if(g_captureGolden) stats.goldenFailed++; // Written to capture/ for a look
+  std::vector<uint8_t> png = encodePng(pixels.data(), capture.extent.width, capture.extent.height);
+  writeCaptureFile(captureFileName("capture", capture.frameNumber, ".png"), png.data(), png.size());
+  stats.bytes += png.size();
+}
+
+static void captureWriterLoop()
+{
+  while(true)
+  {
+    uint32_t index;
+    {
+      std::unique_lock<std::mutex> lock(g_captureMutex);
+      g_captureCondition.wait(lock, []{ return g_stopCapture || !g_captureQueue.empty(); });
+      if(g_captureQueue.empty()) return; // Stopping, everything written
+      index = g_captureQueue.front();
+      g_captureQueue.pop_front();
+    }
+    PROFILE_ZONE("write capture");
+    BenchClock::time_point start = BenchClock::now();
+    CaptureStats stats = {};
+    writeCapture(g_captureBuffers[index], stats); // CAPTURE_WRITING: nobody else touches the buffer
+    std::lock_guard<std::mutex> lock(g_captureMutex);
+    g_captureBuffers[index].state = CAPTURE_FREE;
+    g_captureStats.written++;
+    g_captureStats.bytes += stats.bytes;
+    g_captureStats.writeMilliseconds += millisecondsBetween(start, BenchClock::now());
+    g_captureStats.goldenMatched += stats.goldenMatched;
+    g_captureStats.goldenCreated += stats.goldenCreated;
+    g_captureStats.goldenFailed += stats.goldenFailed;
+  }
+}
+
+// Pass prepare, render thread: picks a free buffer for this frame (sized for the current extent) if it is captured.
+static void prepareCapture(const RenderGraphContext& context)
+{
+  BenchClock::time_point start = BenchClock::now();
+  g_captureSlots[context.slot] = -1;
+  if(context.frameNumber % g_captureEvery != 0) return;
+  VkDeviceSize size = static_cast<VkDeviceSize>(g_swapChainExtent.width) * g_swapChainExtent.height * 4;
+  std::lock_guard<std::mutex> lock(g_captureMutex);
+  for(uint32_t i = 0; i < g_captureBuffers.size(); i++)
+  {
+    CaptureBuffer& capture = g_captureBuffers[i];
+    if(capture.state != CAPTURE_FREE) continue;
+    if(capture.size < size) // First use, or the swap chain grew
+    {
+      if(capture.buffer.buffer != VK_NULL_HANDLE) destroyBuffer(capture.buffer);
+      capture.buffer = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryUsage::GpuToCpu);
+      capture.size = size;
+    }
+    capture.state = CAPTURE_RECORDED;
+    capture.extent = g_swapChainExtent;
+    capture.format = g_swapChainImageFormat;
+    capture.frameNumber = context.frameNumber;
+    g_captureSlots[context.slot] = static_cast<int32_t>(i);
+    g_captureStats.captured++;
+    g_captureStats.frameMilliseconds += millisecondsBetween(start, BenchClock::now());
+    return;
+  }
+  g_captureStats.skipped++;
+}
+
+static void recordCapture(const RenderGraphContext& context)
+{
+  if(g_captureSlots[context.slot] < 0) return;
+  const CaptureBuffer& capture = g_captureBuffers[g_captureSlots[context.slot]];
+  VkBufferImageCopy region = {};
+  region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+  region.imageExtent = { capture.extent.width, capture.extent.height, 1 }; // Tightly packed rows
+  vkCmdCopyImageToBuffer(context.commandBuffer, g_swapChainImages[context.imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, capture.buffer.buffer, 1, &region);
+}
+
+// backbuffer: the render graph resource of createMainPass(), copied after it. The swap chain (or offscreen targets) was
+// created with TRANSFER_SRC usage.
+void createCapture(uint32_t frameSlots, uint32_t backbuffer)
+{
+  if(g_captureMode == CAPTURE_OFF) return;
+  if(!g_captureRequested) // Swap chain without TRANSFER_SRC, already reported
+  {
+    g_captureMode = CAPTURE_OFF;
+    return;
+  }
+  if(!captureFormatSupported(g_swapChainImageFormat))
+  {
+    std::cout << "Capture: swap chain format " << g_swapChainImageFormat << " is not 8-bit RGBA/BGRA, capture disabled" << std::endl;
+    g_captureMode = CAPTURE_OFF;
+    return;
+  }
+  g_captureBuffers.resize(frameSlots + CAPTURE_EXTRA_BUFFERS); // Allocated at first use, for the extent of then
+  g_captureSlots.assign(frameSlots, -1);
+  std::filesystem::create_directories("capture");
+  g_stopCapture = false;
+  g_captureThread = std::thread(captureWriterLoop);
+
+  uint32_t readback = importRenderGraphBuffer("capture readback", RG_HOST_READ); // The current slot's buffer
+  addRenderGraphPass("capture", RENDER_GRAPH_TRANSFER, recordCapture);
+  setRenderGraphPassPrepare("capture", prepareCapture);
+  addRenderGraphAccess("capture", backbuffer, RG_TRANSFER_READ);
+  addRenderGraphAccess("capture", readback, RG_TRANSFER_WRITE);
+  std::cout << "Capture: every " << g_captureEvery << " frame(s), " << (g_captureGoldenSeed ? "written to golden/" : g_captureGolden ? "compared with golden/" : g_captureMode == CAPTURE_PNG ? "PNG to capture/" : "raw to capture/") << std::endl;
+}
+
+// Call only after the slot's frame fence has signaled: the copy is done, off to the writer.
+void collectCapture(uint32_t slot)
+{
+  if(g_captureSlots.empty() || g_captureSlots[slot] < 0) return;
+  uint32_t index = static_cast<uint32_t>(g_captureSlots[slot]);
+  g_captureSlots[slot] = -1;
+  {
+    std::lock_guard<std::mutex> lock(g_captureMutex);
+    g_captureBuffers[index].state = CAPTURE_WRITING;
+    g_captureQueue.push_back(index);
+  }
+  g_captureCondition.notify_one();
+}
+
+// Capture cost: the GPU copy against the GPU frame time, the render thread's share, and the writer's throughput.
+void reportCaptureStats()
+{
+  if(g_captureMode == CAPTURE_OFF) return;
+  std::lock_guard<std::mutex> lock(g_captureMutex);
+  const CaptureStats& stats = g_captureStats;
+  std::cout << "Capture: " << stats.captured << " frames copied, " << stats.written << " written, " << stats.skipped << " skipped (writer behind)" << std::endl;
+  if(stats.written > 0)
+  {
+    std::cout << "Capture writer: " << stats.writeMilliseconds / stats.written << " ms per frame, " << (stats.bytes >> 20) << " MiB";
+    if(stats.writeMilliseconds > 0.0) std::cout << " (" << stats.bytes / (stats.writeMilliseconds / 1000.0) / (1 << 20) << " MiB/s)";
+    std::cout << std::endl;
+  }
+  double gpuCopy = gpuZoneAverage("capture");
+  double gpuFrame = 0.0;
+  for(double sample : g_frameTimes.gpu) gpuFrame += sample;
+  if(!g_frameTimes.gpu.empty()) gpuFrame /= g_frameTimes.gpu.size();
+  if(gpuCopy > 0.0 && gpuFrame > 0.0) std::cout << "Capture GPU copy: " << gpuCopy << " ms avg, " << 100.0 * gpuCopy / gpuFrame << "% of the GPU frame time" << std::endl;
+  if(stats.captured > 0) std::cout << "Capture render thread: " << stats.frameMilliseconds / stats.captured * 1000.0 << " us per captured frame" << std::endl;
+  if(g_captureGolden) std::cout << "Golden frames: " << stats.goldenMatched << " matched, " << stats.goldenCreated << " written, " << stats.goldenFailed << " differ or missing" << std::endl;
+}
+
+// After vkDeviceWaitIdle, before reportCaptureStats(): the last frames' copies are written, the writer stops.
+// Returns false when a golden run compared nothing, or not every frame: golden frames differed, were missing, or skipped.
+bool finishCapture()
+{
+  if(g_captureMode == CAPTURE_OFF) return !g_captureGolden; // Disabled by createCapture(): nothing was compared
+  for(uint32_t slot = 0; slot < g_captureSlots.size(); slot++) collectCapture(slot);
+  {
+    std::lock_guard<std::mutex> lock(g_captureMutex);
+    g_stopCapture = true;
+  }
+  g_captureCondition.notify_one();
+  g_captureThread.join();
+  if(!g_captureGolden) return true;
+  const CaptureStats& stats = g_captureStats;
+  return stats.goldenFailed == 0 && stats.skipped == 0 && stats.goldenMatched + stats.goldenCreated > 0;
+}
+
+void destroyCapture()
+{
+  for(CaptureBuffer& capture : g_captureBuffers) if(capture.buffer.buffer != VK_NULL_HANDLE) destroyBuffer(capture.buffer);
+  g_captureBuffers.clear();
+  g_captureSlots.clear();
+}
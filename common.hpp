@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -15,10 +18,26 @@
 uint32_t g_width = 1;
 uint32_t g_height = 1;
 
-bool g_quitFlag = false;
+std::atomic<bool> g_quitFlag{false}; // Set by the event and render threads alike (input.hpp)
+bool g_framebufferResized = false; // Window size changed: swap chain is recreated before the next frame
+bool g_windowMinimized = false; // Nothing to present to while minimized
+bool g_headless = false; // No window, surface or swap chain: frames are rendered into offscreen images (CI render nodes, benchmarks)
 bool g_enabledValidationLayers = false;
 bool g_deviceExtensionsSupported = false;
+bool g_vulkan12Requested = false; // TEMPLATE_VULKAN_1_2=1: opt in to a Vulkan 1.2 instance and device
+uint32_t g_instanceApiVersion = VK_API_VERSION_1_0; // Version the instance was created with
+bool g_vulkan12 = false; // The device was created with Vulkan 1.2 features
+bool g_descriptorIndexing = false; // Bindless descriptors enabled (see bindless.hpp)
+bool g_multiDrawIndirect = false; // multiDrawIndirect + drawIndirectFirstInstance: one indirect call for many draws
+bool g_drawIndirectCount = false; // Vulkan 1.2 drawIndirectCount: the draw count comes from a buffer too
+bool g_timelineSemaphores = false; // Vulkan 1.2 timelineSemaphore: queues synchronized through timeline values (sync.hpp)
+bool g_textureCompressionBC = false; // BC block compressed texture formats (streaming.hpp)
+bool g_physicalDeviceProperties2 = false; // VK_KHR_get_physical_device_properties2 enabled (1.0 instance): *2 queries through the KHR entry points
+bool g_memoryBudget = false; // VK_EXT_memory_budget enabled: heap budgets and usage from the driver (memory.hpp)
+bool g_captureRequested = false; // TEMPLATE_CAPTURE: swap chain images get TRANSFER_SRC usage so frames can be copied out
+bool g_blitTargetRequested = false; // TEMPLATE_DYNAMIC_RESOLUTION: swap chain images get TRANSFER_DST usage for the resolution blit
 
+const VkAllocationCallbacks* g_allocator = nullptr; // Host allocation callbacks of every vkCreate*/vkDestroy* (hostallocator.hpp), nullptr: the driver's
 VkInstance g_instance = VK_NULL_HANDLE;
 VkDebugUtilsMessengerEXT g_debugMessenger = VK_NULL_HANDLE;
 VkSurfaceKHR g_surface = VK_NULL_HANDLE;
@@ -26,12 +45,15 @@ VkPhysicalDevice g_physicalDevice = VK_NULL_HANDLE;
 VkDevice g_device = VK_NULL_HANDLE;
 VkQueue g_graphicsQueue = VK_NULL_HANDLE;
 VkQueue g_presentQueue = VK_NULL_HANDLE;
+VkQueue g_transferQueue = VK_NULL_HANDLE; // Transfer-only queue if the device has one, else same as g_graphicsQueue
+VkQueue g_computeQueue = VK_NULL_HANDLE; // Async compute queue if the device has a separate compute family, else same as g_graphicsQueue
 VkCommandPool g_commandPool = VK_NULL_HANDLE;
 
 VkSwapchainKHR g_swapchain = VK_NULL_HANDLE;
 std::vector<VkImage> g_swapChainImages;
 VkFormat g_swapChainImageFormat;
 VkExtent2D g_swapChainExtent;
+VkExtent2D g_renderExtent; // Area the main pass renders to: g_swapChainExtent, or a scaled one with dynamic resolution (resolution.hpp)
 
 VkPhysicalDeviceProperties g_properties;
 
@@ -39,10 +61,39 @@ struct QueueFamilyIndices
 {
   std::optional<uint32_t> graphicsFamily; // Making the graphicsFamily's existence testable.
   std::optional<uint32_t> presentFamily; // Present family may not be in the same as graphics, so need to be checked separately
+  std::optional<uint32_t> transferFamily; // Transfer-only family (no graphics/compute): DMA engine, uploads don't occupy the graphics queue
+  std::optional<uint32_t> computeFamily; // Compute family without graphics: async compute runs next to the graphics queue
 };
 
+// Runtime settings come from the environment, so they work the same with every platform's main() (and from the Makefile).
+static uint32_t getEnvironmentValue(const char* name, uint32_t defaultValue)
+{
+  const char* value = std::getenv(name);
+  if(value == nullptr || *value == '\0') return defaultValue; // Not set
+  return static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+}
+
 #define CHECK_VULKAN_ERRORS(Expression) do { VkResult result = (Expression); if(result < 0) assert(0); } while(0)
 
+// Everything init needs to know about a physical device, queried once per device (see getDeviceInfo()).
+struct DeviceInfo
+{
+  VkPhysicalDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties properties;
+  VkPhysicalDeviceFeatures features;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkPhysicalDeviceVulkan12Features features12 = {}; // Zero unless both the instance and the device are Vulkan 1.2
+  VkPhysicalDeviceVulkan12Properties properties12 = {};
+  std::vector<VkQueueFamilyProperties> queueFamilies;
+  std::vector<VkExtensionProperties> extensions;
+  QueueFamilyIndices indices;
+  std::vector<VkSurfaceFormatKHR> surfaceFormats; // Empty when headless
+  std::vector<VkPresentModeKHR> presentModes; // Empty when headless
+  bool suitable = false;
+  int64_t score = 0;
+};
+
 extern bool swapChainIsAdequate(VkPhysicalDevice device);
 extern QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
+extern const DeviceInfo& getDeviceInfo(VkPhysicalDevice device);
 
@@ -0,0 +1,105 @@
+#pragma once
+#include "common.hpp"
+#include "sync.hpp"
+
+#include <functional>
+
+// Async compute: compute passes (culling, particles, post-processing inputs...) are recorded into their own command buffer and
+// submitted to the compute queue before the frame's graphics work. The graphics submit waits on a semaphore only at the stages
+// which consume the results, so the compute work overlaps with the previous frame's graphics work and with everything before those stages.
+// Without a separate compute family the same submissions go to the graphics queue (the semaphore then just orders them).
+// Compute command buffers need no fence of their own: the frame's fence signals after the graphics submit, which waited on the compute one.
+// With queue timelines (sync.hpp) the graphics submit waits on the compute timeline's value instead of the slot's semaphore.
+
+struct ComputePass
+{
+  std::string name;
+  std::function<void(VkCommandBuffer, uint32_t)> record; // (command buffer, frame slot)
+  VkPipelineStageFlags consumerStages; // Graphics stages reading the results, e.g. DRAW_INDIRECT | VERTEX_SHADER
+};
+
+struct ComputeFrame
+{
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  VkSemaphore computeFinished = VK_NULL_HANDLE; // Signaled when the slot's compute passes are done (without queue timelines)
+};
+
+VkCommandPool g_computeCommandPool = VK_NULL_HANDLE;
+std::vector<ComputeFrame> g_computeFrames;
+std::vector<ComputePass> g_computePasses;
+uint32_t g_computeFamily = 0;
+uint32_t g_graphicsFamily = 0;
+
+void createComputeContext(uint32_t frameSlots)
+{
+  QueueFamilyIndices indices = findQueueFamilies(g_physicalDevice);
+  g_graphicsFamily = indices.graphicsFamily.value();
+  g_computeFamily = indices.computeFamily.value_or(g_graphicsFamily); // Graphics queues always support compute too
+
+  VkCommandPoolCreateInfo commandPoolCreateInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+  commandPoolCreateInfo.queueFamilyIndex = g_computeFamily;
+  commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  CHECK_VULKAN_ERRORS( vkCreateCommandPool(g_device, &commandPoolCreateInfo, g_allocator, &g_computeCommandPool) );
+
+  VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+  allocateInfo.commandPool = g_computeCommandPool;
+  allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocateInfo.commandBufferCount = 1;
+  VkSemaphoreCreateInfo semaphoreCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+
+  g_computeFrames.resize(frameSlots);
+  for(ComputeFrame& frame : g_computeFrames)
+  {
+    CHECK_VULKAN_ERRORS( vkAllocateCommandBuffers(g_device, &allocateInfo, &frame.commandBuffer) );
+    if(!g_timelineSemaphores) CHECK_VULKAN_ERRORS( vkCreateSemaphore(g_device, &semaphoreCreateInfo, g_allocator, &frame.computeFinished) );
+  }
+  std::cout << "Compute: " << (indices.computeFamily.has_value() ? "async compute queue" : "graphics queue") << std::endl;
+}
+
+void destroyComputeContext()
+{
+  for(ComputeFrame& frame : g_computeFrames) vkDestroySemaphore(g_device, frame.computeFinished, g_allocator);
+  g_computeFrames.clear();
+  vkDestroyCommandPool(g_device, g_computeCommandPool, g_allocator); // Frees the command buffers too
+  g_computeCommandPool = VK_NULL_HANDLE;
+}
+
+void addComputePass(const std::string& name, std::function<void(VkCommandBuffer, uint32_t)> record, VkPipelineStageFlags consumerStages)
+{
+  g_computePasses.push_back({ name, record, consumerStages });
+}
+
+// Queue families for resources written by compute and read by graphics: create them with these (concurrent sharing),
+// no ownership transfers needed. Empty when both run on the same family (exclusive is fine).
+std::vector<uint32_t> asyncComputeSharedFamilies()
+{
+  if(g_computeFamily == g_graphicsFamily) return {};
+  return { g_graphicsFamily, g_computeFamily };
+}
+
+// Records and submits the slot's compute passes. Returns false when there are none; otherwise the wait for their results
+// (compute timeline value, or g_computeFrames[slot].computeFinished) has been added to the graphics submit.
+bool submitAsyncCompute(uint32_t slot, SubmitSync& graphicsSync)
+{
+  if(g_computePasses.empty()) return false;
+  ComputeFrame& frame = g_computeFrames[slot];
+
+  CHECK_VULKAN_ERRORS( vkResetCommandBuffer(frame.commandBuffer, 0) );
+  VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  CHECK_VULKAN_ERRORS( vkBeginCommandBuffer(frame.commandBuffer, &beginInfo) );
+  VkPipelineStageFlags waitStages = 0;
+  for(ComputePass& pass : g_computePasses)
+  {
+    pass.record(frame.commandBuffer, slot);
+    waitStages |= pass.consumerStages;
+  }
+  CHECK_VULKAN_ERRORS( vkEndCommandBuffer(frame.commandBuffer) );
+
+  SubmitSync sync;
+  if(!g_timelineSemaphores) addSubmitSignal(sync, frame.computeFinished);
+  uint64_t value = submitToTimeline(TIMELINE_COMPUTE, frame.commandBuffer, sync);
+  if(g_timelineSemaphores) addTimelineWait(graphicsSync, TIMELINE_COMPUTE, value, waitStages);
+  else addSubmitWait(graphicsSync, frame.computeFinished, waitStages);
+  return true;
+}
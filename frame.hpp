@@ -0,0 +1,293 @@
+#pragma once
+#include "common.hpp"
+#include "bench.hpp"
+#include "swap.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+#include "compute.hpp"
+#include "recording.hpp"
+#include "render.hpp"
+#include "rendergraph.hpp"
+#include "gpuprofiler.hpp"
+#include "scene.hpp"
+#include "streaming.hpp"
+#include "input.hpp"
+#include "capture.hpp"
+#include "resolution.hpp"
+
+// Frames in flight: every frame has its own command buffer, fence and semaphores, so the CPU can record frame N+1
+// while the GPU is still working on frame N. The fence is only waited on when the same frame slot comes around again.
+// With queue timelines (sync.hpp) there are no fences: frame N signals N + 1 on the graphics timeline, and the slot waits for that value.
+
+const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+const VkDeviceSize TRANSIENT_RING_SIZE = 8ull << 20; // Per-frame transient data of all frames in flight
+
+struct FrameData
+{
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  VkFence inFlightFence = VK_NULL_HANDLE; // Signaled when the GPU has finished the frame (created signaled for the first round). Without queue timelines
+  uint64_t timelineValue = 0; // Graphics timeline value signaled by the slot's last frame
+  VkSemaphore imageAvailable = VK_NULL_HANDLE; // Signaled when the acquired swap chain image can be rendered to
+  VkSemaphore renderFinished = VK_NULL_HANDLE; // Signaled when rendering is done and the image can be presented
+};
+
+uint32_t g_framesInFlight = 2; // TEMPLATE_FRAMES_IN_FLIGHT: 2 (default) or 3, 1 to measure without CPU/GPU overlap
+std::vector<FrameData> g_frames;
+std::vector<uint64_t> g_imagesInFlight; // Number + 1 of the frame which last rendered to each swap chain image, 0: none
+uint32_t g_currentFrame = 0; // Frame slot: 0..g_framesInFlight-1
+uint64_t g_frameNumber = 0; // Frames submitted so far
+
+void createFrames(uint32_t framesInFlight)
+{
+  g_framesInFlight = std::max(1u, std::min(framesInFlight, MAX_FRAMES_IN_FLIGHT));
+  g_frames.resize(g_framesInFlight);
+
+  VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+  allocateInfo.commandPool = g_commandPool;
+  allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocateInfo.commandBufferCount = 1;
+
+  VkFenceCreateInfo fenceCreateInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+  fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // The first wait of every frame slot must not block
+  VkSemaphoreCreateInfo semaphoreCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+
+  for(FrameData& frame : g_frames)
+  {
+    CHECK_VULKAN_ERRORS( vkAllocateCommandBuffers(g_device, &allocateInfo, &frame.commandBuffer) );
+    if(!g_timelineSemaphores) CHECK_VULKAN_ERRORS( vkCreateFence(g_device, &fenceCreateInfo, g_allocator, &frame.inFlightFence) );
+    frame.timelineValue = 0;
+    CHECK_VULKAN_ERRORS( vkCreateSemaphore(g_device, &semaphoreCreateInfo, g_allocator, &frame.imageAvailable) );
+    CHECK_VULKAN_ERRORS( vkCreateSemaphore(g_device, &semaphoreCreateInfo, g_allocator, &frame.renderFinished) );
+  }
+  g_imagesInFlight.assign(g_swapChainImages.size(), 0);
+  g_currentFrame = 0;
+
+  createBenchmarkQueries(g_framesInFlight); // One timestamp slot per frame in flight
+  createTransientRing(TRANSIENT_RING_SIZE, g_framesInFlight);
+  createComputeContext(g_framesInFlight);
+  createThreadCommandPools(g_framesInFlight, threadCount());
+  createDrawDescriptorPools(g_framesInFlight, threadCount());
+  createGpuProfiler(g_framesInFlight);
+}
+
+void destroyFrames()
+{
+  destroyGpuProfiler();
+  destroyDrawDescriptorPools();
+  destroyThreadCommandPools();
+  destroyComputeContext();
+  destroyTransientRing();
+  destroyBenchmarkQueries();
+  for(FrameData& frame : g_frames)
+  {
+    vkDestroySemaphore(g_device, frame.renderFinished, g_allocator);
+    vkDestroySemaphore(g_device, frame.imageAvailable, g_allocator);
+    vkDestroyFence(g_device, frame.inFlightFence, g_allocator);
+    vkFreeCommandBuffers(g_device, g_commandPool, 1, &frame.commandBuffer);
+  }
+  g_frames.clear();
+  g_imagesInFlight.clear();
+}
+
+uint32_t g_backbuffer = UINT32_MAX; // Render graph resource: the acquired swap chain (or offscreen) image
+DrawWorkRecording g_mainDrawWork; // Secondaries of the main pass, recorded by jobs started in its prepare
+
+// Declares the frame to the render graph: a clear with a color changing every frame, then the draw work (the triangle) in
+// the render pass, into the backbuffer or the dynamic resolution target. Other modules add their passes around it and their
+// reads to it. Before createScene().
+void createMainPass()
+{
+  g_backbuffer = importRenderGraphImage("backbuffer", g_swapChainImageFormat, [](uint32_t imageIndex) { return g_swapChainImages[imageIndex]; },
+    [](uint32_t imageIndex) { return g_framebuffers[imageIndex]; }, RG_ACQUIRED, g_headless ? RG_TRANSFER_READ : RG_PRESENT); // Offscreen: ready to be copied out
+  addRenderGraphPass("main pass", RENDER_GRAPH_RASTER, [](const RenderGraphContext& context)
+  {
+    float phase = static_cast<float>(context.frameNumber % 256) / 255.0f;
+    VkClearValue clearValue = {};
+    clearValue.color = {{ phase, 0.2f, 1.0f - phase, 1.0f }};
+    VkRenderPassBeginInfo renderPassBeginInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+    renderPassBeginInfo.renderPass = context.renderPass;
+    renderPassBeginInfo.framebuffer = context.framebuffer;
+    renderPassBeginInfo.renderArea = { { 0, 0 }, g_renderExtent };
+    renderPassBeginInfo.clearValueCount = 1;
+    renderPassBeginInfo.pClearValues = &clearValue;
+    vkCmdBeginRenderPass(context.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    executeDrawWork(context.commandBuffer, g_mainDrawWork);
+    vkCmdEndRenderPass(context.commandBuffer);
+  });
+  setRenderGraphPassPrepare("main pass", [](const RenderGraphContext& context)
+  {
+    VkCommandBufferInheritanceInfo inheritance = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+    inheritance.renderPass = context.renderPass;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = context.framebuffer;
+    startDrawWork(g_mainDrawWork, context.slot, inheritance); // Secondary command buffers recorded on the worker threads
+  });
+  uint32_t target = createDynamicResolution(g_backbuffer); // Scaled onto the backbuffer by a pass after this one when enabled
+  addRenderGraphAccess("main pass", target, RG_COLOR_CLEAR);
+}
+
+// Frames below the returned number have finished: the fences of every slot have been waited on after they were submitted.
+// With queue timelines the GPU is asked: frames which finished early are reclaimed early.
+static uint64_t completedFrames()
+{
+  if(g_timelineSemaphores) return timelineCompleted(TIMELINE_GRAPHICS); // Frame N signals N + 1
+  return (g_frameNumber + 1 >= g_framesInFlight) ? g_frameNumber + 1 - g_framesInFlight : 0;
+}
+
+// Blocks until the frame has finished on the GPU. Without queue timelines: the fence of its slot, the current slot's being signaled already.
+static void waitForFrame(uint64_t frameNumber)
+{
+  if(frameNumber < completedFrames()) return;
+  if(g_timelineSemaphores) waitTimeline(TIMELINE_GRAPHICS, frameNumber + 1);
+  else CHECK_VULKAN_ERRORS( vkWaitForFences(g_device, 1, &g_frames[frameNumber % g_framesInFlight].inFlightFence, VK_TRUE, UINT64_MAX) );
+}
+
+// No vkDeviceWaitIdle: the new swap chain is built from the old one, which is destroyed once its frames have finished.
+static bool handleSwapChainRecreation()
+{
+  if(!recreateSwapChain(g_frameNumber)) return false; // No surface area (minimized), try again next frame
+  g_imagesInFlight.assign(g_swapChainImages.size(), 0);
+  recreateFramebuffers(g_frameNumber);
+  invalidateRenderGraph(g_frameNumber); // Recompiled for the new extent at the next frame
+  g_framebufferResized = false;
+  g_presentPolicyChanged = false;
+  return true;
+}
+
+// Returns false when there's no image to render to this time (swap chain being recreated, or not possible yet).
+static bool acquireFrameImage(FrameData& frame, uint32_t& imageIndex)
+{
+  if(g_headless)
+  {
+    imageIndex = static_cast<uint32_t>(g_frameNumber % g_swapChainImages.size()); // Offscreen images in turns
+    return true;
+  }
+  PROFILE_ZONE("acquire image");
+  destroyRetiredSwapChains(completedFrames());
+  destroyRetiredFramebuffers(completedFrames());
+  destroyRetiredRenderGraphs(completedFrames());
+  if((g_framebufferResized || g_presentPolicyChanged) && !handleSwapChainRecreation()) return false;
+
+  VkResult acquireResult = vkAcquireNextImageKHR(g_device, g_swapchain, UINT64_MAX, frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+  if(acquireResult == VK_ERROR_OUT_OF_DATE_KHR) // Can't render to this swap chain anymore: fence is still signaled, so the slot can simply be retried
+  {
+    handleSwapChainRecreation();
+    return false;
+  }
+  CHECK_VULKAN_ERRORS( acquireResult ); // VK_SUBOPTIMAL_KHR still presents fine, it's recreated after the present
+  return true;
+}
+
+void drawFrame()
+{
+  FrameData& frame = g_frames[g_currentFrame];
+
+  PROFILE_FUNCTION();
+  {
+    PROFILE_ZONE("wait for frame fence");
+    // Wait only until the GPU is done with the frame that last used this slot (g_framesInFlight frames ago).
+    if(g_timelineSemaphores) waitTimeline(TIMELINE_GRAPHICS, frame.timelineValue);
+    else CHECK_VULKAN_ERRORS( vkWaitForFences(g_device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX) );
+  }
+  // The slot's housekeeping runs as jobs while the render thread goes on to acquire the image (which may block)
+  JobCounter slotJobs;
+  uint32_t slot = g_currentFrame;
+  runJob([slot]
+  {
+    PROFILE_ZONE("collect frame results");
+    collectGpuFrameTime(slot);
+    collectGpuProfilerFrame(slot);
+    collectSceneStats(slot);
+    collectCapture(slot);
+  }, &slotJobs);
+  runJob([slot]
+  {
+    PROFILE_ZONE("reset frame pools");
+    resetThreadCommandPools(slot); // The slot's secondary command buffers are done too
+    resetDrawDescriptorPools(slot); // And its per-draw descriptor sets
+  }, &slotJobs);
+  recycleRetiredResourceIndices(completedFrames());
+  destroyRetiredPipelines(completedFrames());
+  destroyRetiredStreamedTextures(completedFrames());
+  checkHotReload(g_frameNumber);
+  if(g_frameNumber % MEMORY_BUDGET_INTERVAL == 0) updateMemoryBudget(); // Growth over a long session shows up in the peaks
+  beginTransientFrame(g_currentFrame); // The slot's previous transient data is not used by the GPU anymore
+  BenchClock::time_point cpuStart = BenchClock::now();
+
+  uint32_t imageIndex;
+  bool acquired = acquireFrameImage(frame, imageIndex);
+  waitForJobs(slotJobs);
+  if(!acquired) return;
+
+  // The image may still be used by an older frame in flight (images can be acquired out of order).
+  if(g_imagesInFlight[imageIndex] != 0) waitForFrame(g_imagesInFlight[imageIndex] - 1);
+  g_imagesInFlight[imageIndex] = g_frameNumber + 1;
+  updateDynamicResolution(g_framesInFlight); // The GPU frame times collected above pick this frame's resolution
+
+  flushUploads(); // Uploads recorded since the last frame start transferring now, alongside this frame
+  {
+    PROFILE_ZONE("record commands");
+    CHECK_VULKAN_ERRORS( vkResetCommandBuffer(frame.commandBuffer, 0) );
+    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VULKAN_ERRORS( vkBeginCommandBuffer(frame.commandBuffer, &beginInfo) );
+    beginGpuProfilerFrame(frame.commandBuffer, g_currentFrame);
+    recordUploadAcquires(frame.commandBuffer); // Uploads finished on the transfer queue become usable from this frame on
+    updateStreaming(); // Streamed textures acquired just now can be drawn from this frame on
+    writeFrameBeginTimestamp(frame.commandBuffer, g_currentFrame);
+    executeRenderGraph(frame.commandBuffer, g_currentFrame, imageIndex, g_frameNumber); // A GPU zone per pass
+    writeFrameEndTimestamp(frame.commandBuffer, g_currentFrame);
+    CHECK_VULKAN_ERRORS( vkEndCommandBuffer(frame.commandBuffer) );
+  }
+
+  PROFILE_ZONE("submit and present");
+  SubmitSync sync;
+  submitAsyncCompute(g_currentFrame, sync); // Compute goes first, graphics waits for its results only where they're read
+  if(!g_headless)
+  {
+    addSubmitWait(sync, frame.imageAvailable, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT); // The render pass clear is the first write to the image
+    addSubmitSignal(sync, frame.renderFinished);
+  }
+  if(!g_timelineSemaphores) CHECK_VULKAN_ERRORS( vkResetFences(g_device, 1, &frame.inFlightFence) ); // Reset only right before the submit that signals it again
+  frame.timelineValue = submitToTimeline(TIMELINE_GRAPHICS, frame.commandBuffer, sync, frame.inFlightFence);
+
+  if(!g_headless)
+  {
+    VkPresentInfoKHR presentInfo = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &frame.renderFinished;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &g_swapchain;
+    presentInfo.pImageIndices = &imageIndex;
+    VkResult presentResult;
+    {
+      std::lock_guard<std::mutex> lock(queueMutex(g_presentQueue)); // May be the queue uploads are submitted to
+      presentResult = vkQueuePresentKHR(g_presentQueue, &presentInfo);
+    }
+    if(presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) g_framebufferResized = true; // Recreate before the next frame
+    else CHECK_VULKAN_ERRORS( presentResult );
+    recordPresentLatency();
+  }
+  addCpuFrameTime(millisecondsBetween(cpuStart, BenchClock::now()));
+
+  endTransientFrame(g_currentFrame);
+  g_currentFrame = (g_currentFrame + 1) % g_framesInFlight;
+  g_frameNumber++;
+}
+
+// Render thread (the main thread when headless): input handed over by the event pump, then a frame, until quitting.
+// frameCount > 0: quits after that many frames (benchmarks).
+void renderLoop(uint64_t frameCount)
+{
+  while(!g_quitFlag)
+  {
+    processInputEvents();
+    if(g_windowMinimized) // Nothing to present to, don't spin
+    {
+      SDL_Delay(10);
+      continue;
+    }
+    drawFrame();
+    if(frameCount > 0 && g_frameNumber >= frameCount) g_quitFlag = true;
+  }
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include "common.hpp"
+#include "trace.hpp"
+#include "sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+// GPU profiler: named passes get a begin and an end timestamp query in the frame's command buffer (primary, recorded on
+// the render thread, or the main thread when headless). Every frame slot has its own range of queries, read back when the
+// slot comes around again, i.e. after its fence has signaled: the results are ready, the CPU never waits for them.
+// Per-pass statistics are kept over the last GPU_STATS_WINDOW frames. GPU timestamps are mapped to the trace clock with one calibration at startup.
+
+const uint32_t GPU_PROFILER_MAX_ZONES = 32; // Per frame
+const uint32_t GPU_STATS_WINDOW = 240; // Frames the rolling statistics cover
+
+struct GpuZone
+{
+  const char* name; // Static string
+  uint32_t query; // Begin query, end is query + 1
+};
+
+struct GpuProfilerSlot
+{
+  std::vector<GpuZone> zones;
+  bool recorded = false; // Frame with zones submitted, results not read yet
+};
+
+struct GpuZoneStats
+{
+  std::vector<double> samples; // Ring of the last GPU_STATS_WINDOW durations (ms)
+  uint32_t next = 0;
+};
+
+VkQueryPool g_gpuProfilerQueryPool = VK_NULL_HANDLE;
+std::vector<GpuProfilerSlot> g_gpuProfilerSlots;
+std::map<std::string, GpuZoneStats> g_gpuZoneStats;
+uint64_t g_gpuTimestampMask = 0;
+double g_gpuTimestampOffset = 0.0; // Trace microseconds of GPU tick 0
+
+static double gpuTicksToMicroseconds(uint64_t ticks)
+{
+  return static_cast<double>(ticks) * g_properties.limits.timestampPeriod / 1000.0; // timestampPeriod: ns per tick
+}
+
+// A timestamp written by an otherwise empty submit lands between the CPU times before the submit and after the wait.
+// The midpoint is good to the submit latency (tens of microseconds), plenty to line up passes of milliseconds.
+static void calibrateGpuTimestamps()
+{
+  VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+  allocateInfo.commandPool = g_commandPool;
+  allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocateInfo.commandBufferCount = 1;
+  VkCommandBuffer commandBuffer;
+  CHECK_VULKAN_ERRORS( vkAllocateCommandBuffers(g_device, &allocateInfo, &commandBuffer) );
+
+  VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  CHECK_VULKAN_ERRORS( vkBeginCommandBuffer(commandBuffer, &beginInfo) );
+  vkCmdResetQueryPool(commandBuffer, g_gpuProfilerQueryPool, 0, 1);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_gpuProfilerQueryPool, 0);
+  CHECK_VULKAN_ERRORS( vkEndCommandBuffer(commandBuffer) );
+
+  VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  TraceClock::time_point before;
+  TraceClock::time_point after;
+  {
+    std::lock_guard<std::mutex> lock(queueMutex(g_graphicsQueue));
+    before = TraceClock::now();
+    CHECK_VULKAN_ERRORS( vkQueueSubmit(g_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) );
+    CHECK_VULKAN_ERRORS( vkQueueWaitIdle(g_graphicsQueue) ); // Startup only
+    after = TraceClock::now();
+  }
+
+  uint64_t timestamp = 0;
+  CHECK_VULKAN_ERRORS( vkGetQueryPoolResults(g_device, g_gpuProfilerQueryPool, 0, 1, sizeof(timestamp), &timestamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) );
+  vkFreeCommandBuffers(g_device, g_commandPool, 1, &commandBuffer);
+  g_gpuTimestampOffset = (traceMicroseconds(before) + traceMicroseconds(after)) / 2.0 - gpuTicksToMicroseconds(timestamp & g_gpuTimestampMask);
+}
+
+void createGpuProfiler(uint32_t frameSlots)
+{
+  const DeviceInfo& info = getDeviceInfo(g_physicalDevice);
+  uint32_t validBits = info.queueFamilies[info.indices.graphicsFamily.value()].timestampValidBits;
+  if(validBits == 0 || g_properties.limits.timestampPeriod == 0.0f)
+  {
+    std::cout << "GPU profiler: graphics queue does not support timestamps, disabled." << std::endl;
+    return;
+  }
+  g_gpuTimestampMask = (validBits >= 64) ? ~0ULL : ((1ULL << validBits) - 1);
+
+  VkQueryPoolCreateInfo queryPoolCreateInfo = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+  queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolCreateInfo.queryCount = frameSlots * GPU_PROFILER_MAX_ZONES * 2;
+  CHECK_VULKAN_ERRORS( vkCreateQueryPool(g_device, &queryPoolCreateInfo, g_allocator, &g_gpuProfilerQueryPool) );
+  g_gpuProfilerSlots.assign(frameSlots, GpuProfilerSlot());
+
+  calibrateGpuTimestamps();
+  nameTraceTrack(TRACE_TRACK_GPU, "GPU (graphics queue)");
+}
+
+void destroyGpuProfiler()
+{
+  if(g_gpuProfilerQueryPool != VK_NULL_HANDLE) vkDestroyQueryPool(g_device, g_gpuProfilerQueryPool, g_allocator);
+  g_gpuProfilerQueryPool = VK_NULL_HANDLE;
+  g_gpuProfilerSlots.clear();
+}
+
+// At the beginning of the slot's command buffer, outside of render passes (queries are reset there).
+void beginGpuProfilerFrame(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+  if(g_gpuProfilerQueryPool == VK_NULL_HANDLE) return;
+  vkCmdResetQueryPool(commandBuffer, g_gpuProfilerQueryPool, slot * GPU_PROFILER_MAX_ZONES * 2, GPU_PROFILER_MAX_ZONES * 2);
+  g_gpuProfilerSlots[slot].zones.clear();
+  g_gpuProfilerSlots[slot].recorded = true;
+}
+
+// Returns the zone for endGpuZone(), UINT32_MAX when not profiling (or out of queries).
+uint32_t beginGpuZone(VkCommandBuffer commandBuffer, uint32_t slot, const char* name)
+{
+  if(g_gpuProfilerQueryPool == VK_NULL_HANDLE) return UINT32_MAX;
+  std::vector<GpuZone>& zones = g_gpuProfilerSlots[slot].zones;
+  if(zones.size() == GPU_PROFILER_MAX_ZONES) return UINT32_MAX;
+  uint32_t query = (slot * GPU_PROFILER_MAX_ZONES + static_cast<uint32_t>(zones.size())) * 2;
+  zones.push_back({ name, query });
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, g_gpuProfilerQueryPool, query);
+  return static_cast<uint32_t>(zones.size()) - 1;
+}
+
+void endGpuZone(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t zone)
+{
+  if(zone == UINT32_MAX) return;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_gpuProfilerQueryPool, g_gpuProfilerSlots[slot].zones[zone].query + 1);
+}
+
+struct ScopedGpuZone
+{
+  VkCommandBuffer commandBuffer;
+  uint32_t slot;
+  uint32_t zone;
+  ScopedGpuZone(VkCommandBuffer commandBuffer, uint32_t slot, const char* name) : commandBuffer(commandBuffer), slot(slot), zone(beginGpuZone(commandBuffer, slot, name)) {}
+  ~ScopedGpuZone() { endGpuZone(commandBuffer, slot, zone); }
+};
+
+static void addGpuZoneSample(const char* name, double milliseconds)
+{
+  GpuZoneStats& stats = g_gpuZoneStats[name];
+  if(stats.samples.size() < GPU_STATS_WINDOW) stats.samples.push_back(milliseconds);
+  else stats.samples[stats.next] = milliseconds;
+  stats.next = (stats.next + 1) % GPU_STATS_WINDOW;
+}
+
+// Call only after the slot's frame fence has signaled.
+void collectGpuProfilerFrame(uint32_t slot)
+{
+  if(g_gpuProfilerQueryPool == VK_NULL_HANDLE || !g_gpuProfilerSlots[slot].recorded) return;
+  GpuProfilerSlot& profilerSlot = g_gpuProfilerSlots[slot];
+  profilerSlot.recorded = false;
+  if(profilerSlot.zones.empty()) return;
+
+  std::vector<uint64_t> timestamps(profilerSlot.zones.size() * 2);
+  VkResult queryResult = vkGetQueryPoolResults(g_device, g_gpuProfilerQueryPool, slot * GPU_PROFILER_MAX_ZONES * 2, static_cast<uint32_t>(timestamps.size()),
+    timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if(queryResult != VK_SUCCESS) return; // VK_NOT_READY: skip the frame rather than stall
+
+  for(size_t i = 0; i < profilerSlot.zones.size(); i++)
+  {
+    uint64_t begin = timestamps[i * 2] & g_gpuTimestampMask;
+    uint64_t ticks = (timestamps[i * 2 + 1] - begin) & g_gpuTimestampMask; // Wraps with the valid bits
+    addGpuZoneSample(profilerSlot.zones[i].name, gpuTicksToMicroseconds(ticks) / 1000.0);
+    if(g_traceEnabled) addTraceEvent({ profilerSlot.zones[i].name, TRACE_TRACK_GPU, g_gpuTimestampOffset + gpuTicksToMicroseconds(begin), gpuTicksToMicroseconds(ticks) });
+  }
+}
+
+// Average of the zone over the stats window, 0 if it never ran.
+double gpuZoneAverage(const char* name)
+{
+  auto found = g_gpuZoneStats.find(name);
+  if(found == g_gpuZoneStats.end() || found->second.samples.empty()) return 0.0;
+  double sum = 0.0;
+  for(double sample : found->second.samples) sum += sample;
+  return sum / found->second.samples.size();
+}
+
+void reportGpuZones()
+{
+  for(const auto& [name, stats] : g_gpuZoneStats)
+  {
+    std::vector<double> samples = stats.samples;
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for(double sample : samples) sum += sample;
+    size_t p99Index = static_cast<size_t>(std::ceil(0.99 * samples.size())) - 1;
+    std::cout << "GPU pass " << name << " (ms, last " << samples.size() << " frames): min " << samples.front() << " | avg " << sum / samples.size() << " | p99 " << samples[p99Index] << " | max " << samples.back() << std::endl;
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "common.hpp"
+#include "memory.hpp"
+
+// Headless mode (no window, surface or swap chain) renders into offscreen images. They stand in for the swap chain:
+// g_swapChainImages, g_swapChainImageFormat and g_swapChainExtent are filled the same way, so rendering code works for both.
+
+const uint32_t OFFSCREEN_IMAGE_COUNT = 3; // Same amount as a typical swap chain (minImageCount + 1)
+
+std::vector<AllocatedImage> g_offscreenImages;
+
+void createOffscreenTargets(uint32_t width, uint32_t height)
+{
+  g_width = width;
+  g_height = height;
+  g_swapChainImageFormat = VK_FORMAT_B8G8R8A8_UNORM; // Color attachment and blit support is mandatory for this format
+  g_swapChainExtent = { width, height };
+
+  g_swapChainImages.resize(OFFSCREEN_IMAGE_COUNT);
+  g_offscreenImages.resize(OFFSCREEN_IMAGE_COUNT);
+  for(uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; i++)
+  {
+    VkImageCreateInfo imageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = g_swapChainImageFormat;
+    imageCreateInfo.extent = { width, height, 1 };
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT; // Rendered to, blitted to (dynamic resolution) and copied out
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // Only the graphics queue touches these
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    g_offscreenImages[i] = createImage(imageCreateInfo, MemoryUsage::GpuOnly, true); // Render targets get dedicated memory, like swap chain images
+    g_swapChainImages[i] = g_offscreenImages[i].image;
+  }
+}
+
+void destroyOffscreenTargets()
+{
+  for(AllocatedImage& image : g_offscreenImages) destroyImage(image);
+  g_swapChainImages.clear();
+  g_offscreenImages.clear();
+}
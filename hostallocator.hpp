@@ -0,0 +1,241 @@
+#pragma once
+#include "common.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+// Host memory of the driver (TEMPLATE_HOST_ALLOCATOR=1): every vkCreate*/vkDestroy* gets g_allocator, which routes the
+// driver's own allocations by their VkSystemAllocationScope and counts them per scope:
+// - COMMAND scope (freed before the call returns): a bump arena per thread, rewound whenever all of it has been freed.
+// - OBJECT, CACHE, DEVICE, INSTANCE: size-class pools per scope, so the per-object churn doesn't fragment around the
+//   device's long-lived allocations. Freed blocks are reused, never returned to the system before the instance is gone.
+// - Anything bigger than the largest class: malloc.
+// Allocation churn and growth of a long session are then visible (reportHostAllocations()), and bounded by the pools.
+// g_allocator stays nullptr (the driver's own allocator) when not enabled. The surface is created by SDL without callbacks,
+// thus destroyed without them too.
+
+const uint32_t HOST_SCOPE_COUNT = 5; // VK_SYSTEM_ALLOCATION_SCOPE_COMMAND..INSTANCE
+const uint32_t HOST_SIZE_CLASS_COUNT = 7; // 64 B .. 4 KiB blocks
+const size_t HOST_MIN_BLOCK_SIZE = 64;
+const size_t HOST_POOL_CHUNK_SIZE = 64 << 10; // Carved into the blocks of one class
+const size_t HOST_ARENA_SIZE = 256 << 10; // Per thread, COMMAND scope
+const uint16_t HOST_FROM_MALLOC = 0xFFFF;
+const uint16_t HOST_FROM_ARENA = 0xFFFE;
+
+struct HostArena;
+
+struct HostAllocationHeader // Right before the pointer handed to the driver
+{
+  void* base; // Block, arena position or malloc result
+  HostArena* arena; // HOST_FROM_ARENA only
+  uint32_t size; // Requested, for reallocations
+  uint16_t sizeClass; // Or HOST_FROM_MALLOC / HOST_FROM_ARENA
+  uint8_t scope;
+};
+
+struct HostPool
+{
+  std::mutex mutex;
+  void* freeList = nullptr; // Next pointer in the first bytes of each free block
+  std::vector<std::unique_ptr<char[]>> chunks;
+};
+
+struct HostArena
+{
+  std::unique_ptr<char[]> memory;
+  size_t head = 0;
+  std::atomic<uint32_t> live{0}; // Allocations not freed yet: rewound at 0
+};
+
+struct HostScopeStats
+{
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> reallocations{0};
+  std::atomic<uint64_t> frees{0};
+  std::atomic<uint64_t> liveBytes{0};
+  std::atomic<uint64_t> peakBytes{0};
+  std::atomic<uint64_t> internalBytes{0}; // Reported by the driver (pfnInternalAllocation), allocated by itself
+};
+
+HostPool g_hostPools[HOST_SCOPE_COUNT][HOST_SIZE_CLASS_COUNT];
+HostScopeStats g_hostStats[HOST_SCOPE_COUNT];
+std::mutex g_hostArenasMutex;
+std::vector<std::unique_ptr<HostArena>> g_hostArenas; // Owned here: a thread's arena outlives the thread
+thread_local HostArena* t_hostArena = nullptr;
+VkAllocationCallbacks g_allocationCallbacks = {};
+
+static const char* hostScopeName(uint32_t scope)
+{
+  static const char* names[HOST_SCOPE_COUNT] = { "command", "object", "cache", "device", "instance" };
+  return scope < HOST_SCOPE_COUNT ? names[scope] : "unknown";
+}
+
+static void countHostAllocation(uint32_t scope, size_t size)
+{
+  HostScopeStats& stats = g_hostStats[scope];
+  uint64_t live = stats.liveBytes += size;
+  uint64_t peak = stats.peakBytes.load();
+  while(live > peak && !stats.peakBytes.compare_exchange_weak(peak, live)) {}
+}
+
+static void* placeHostAllocation(void* base, size_t size, size_t alignment, uint16_t sizeClass, uint32_t scope, HostArena* arena = nullptr)
+{
+  uintptr_t user = (reinterpret_cast<uintptr_t>(base) + sizeof(HostAllocationHeader) + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+  HostAllocationHeader* header = reinterpret_cast<HostAllocationHeader*>(user) - 1;
+  header->base = base;
+  header->arena = arena;
+  header->size = static_cast<uint32_t>(size);
+  header->sizeClass = sizeClass;
+  header->scope = static_cast<uint8_t>(scope);
+  return reinterpret_cast<void*>(user);
+}
+
+static void* allocateFromArena(size_t needed)
+{
+  if(t_hostArena == nullptr)
+  {
+    std::lock_guard<std::mutex> lock(g_hostArenasMutex);
+    g_hostArenas.push_back(std::make_unique<HostArena>());
+    t_hostArena = g_hostArenas.back().get();
+    t_hostArena->memory = std::make_unique<char[]>(HOST_ARENA_SIZE);
+  }
+  HostArena& arena = *t_hostArena;
+  if(arena.live == 0) arena.head = 0; // Everything handed out has come back
+  if(arena.head + needed > HOST_ARENA_SIZE) return nullptr;
+  void* base = arena.memory.get() + arena.head;
+  arena.head += (needed + 15) & ~static_cast<size_t>(15);
+  arena.live++;
+  return base;
+}
+
+static void* allocateFromPool(uint32_t scope, uint32_t sizeClass)
+{
+  HostPool& pool = g_hostPools[scope][sizeClass];
+  size_t blockSize = HOST_MIN_BLOCK_SIZE << sizeClass;
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  if(pool.freeList == nullptr) // Carve a new chunk into free blocks
+  {
+    pool.chunks.push_back(std::make_unique<char[]>(HOST_POOL_CHUNK_SIZE));
+    char* chunk = pool.chunks.back().get();
+    for(size_t offset = 0; offset + blockSize <= HOST_POOL_CHUNK_SIZE; offset += blockSize)
+    {
+      *reinterpret_cast<void**>(chunk + offset) = pool.freeList;
+      pool.freeList = chunk + offset;
+    }
+  }
+  void* block = pool.freeList;
+  pool.freeList = *reinterpret_cast<void**>(block);
+  return block;
+}
+
+static void* VKAPI_CALL hostAllocate(void* userData, size_t size, size_t alignment, VkSystemAllocationScope allocationScope)
+{
+  if(size == 0) return nullptr;
+  uint32_t scope = std::min(static_cast<uint32_t>(allocationScope), HOST_SCOPE_COUNT - 1);
+  alignment = std::max(alignment, alignof(HostAllocationHeader));
+  size_t needed = size + sizeof(HostAllocationHeader) + alignment - 1; // Worst case padding for the alignment
+  g_hostStats[scope].allocations++;
+  countHostAllocation(scope, size);
+
+  if(scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND)
+  {
+    void* base = allocateFromArena(needed);
+    if(base != nullptr) return placeHostAllocation(base, size, alignment, HOST_FROM_ARENA, scope, t_hostArena);
+  }
+  for(uint32_t sizeClass = 0; sizeClass < HOST_SIZE_CLASS_COUNT; sizeClass++)
+  {
+    if(needed <= (HOST_MIN_BLOCK_SIZE << sizeClass)) return placeHostAllocation(allocateFromPool(scope, sizeClass), size, alignment, static_cast<uint16_t>(sizeClass), scope);
+  }
+  void* base = malloc(needed);
+  if(base == nullptr)
+  {
+    g_hostStats[scope].liveBytes -= size;
+    return nullptr;
+  }
+  return placeHostAllocation(base, size, alignment, HOST_FROM_MALLOC, scope);
+}
+
+static void VKAPI_CALL hostFree(void* userData, void* memory)
+{
+  if(memory == nullptr) return;
+  HostAllocationHeader* header = static_cast<HostAllocationHeader*>(memory) - 1;
+  g_hostStats[header->scope].frees++;
+  g_hostStats[header->scope].liveBytes -= header->size;
+  if(header->sizeClass == HOST_FROM_MALLOC) free(header->base);
+  else if(header->sizeClass == HOST_FROM_ARENA) header->arena->live--; // Rewound by its thread once nothing is live
+  else
+  {
+    HostPool& pool = g_hostPools[header->scope][header->sizeClass];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    *reinterpret_cast<void**>(header->base) = pool.freeList;
+    pool.freeList = header->base;
+  }
+}
+
+static void* VKAPI_CALL hostReallocate(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope allocationScope)
+{
+  if(original == nullptr) return hostAllocate(userData, size, alignment, allocationScope);
+  if(size == 0)
+  {
+    hostFree(userData, original);
+    return nullptr;
+  }
+  uint32_t originalSize = (static_cast<HostAllocationHeader*>(original) - 1)->size;
+  void* memory = hostAllocate(userData, size, alignment, allocationScope);
+  if(memory == nullptr) return nullptr; // The original stays valid
+  memcpy(memory, original, std::min<size_t>(originalSize, size));
+  hostFree(userData, original);
+  g_hostStats[std::min(static_cast<uint32_t>(allocationScope), HOST_SCOPE_COUNT - 1)].reallocations++;
+  return memory;
+}
+
+static void VKAPI_CALL hostInternalAllocation(void* userData, size_t size, VkInternalAllocationType allocationType, VkSystemAllocationScope allocationScope)
+{
+  g_hostStats[std::min(static_cast<uint32_t>(allocationScope), HOST_SCOPE_COUNT - 1)].internalBytes += size;
+}
+
+static void VKAPI_CALL hostInternalFree(void* userData, size_t size, VkInternalAllocationType allocationType, VkSystemAllocationScope allocationScope)
+{
+  g_hostStats[std::min(static_cast<uint32_t>(allocationScope), HOST_SCOPE_COUNT - 1)].internalBytes -= size;
+}
+
+// Before createInstance(): the instance and everything after it get the callbacks.
+void createHostAllocator()
+{
+  g_allocationCallbacks.pfnAllocation = hostAllocate;
+  g_allocationCallbacks.pfnReallocation = hostReallocate;
+  g_allocationCallbacks.pfnFree = hostFree;
+  g_allocationCallbacks.pfnInternalAllocation = hostInternalAllocation;
+  g_allocationCallbacks.pfnInternalFree = hostInternalFree;
+  g_allocator = &g_allocationCallbacks;
+}
+
+void reportHostAllocations()
+{
+  if(g_allocator == nullptr) return;
+  for(uint32_t scope = 0; scope < HOST_SCOPE_COUNT; scope++)
+  {
+    const HostScopeStats& stats = g_hostStats[scope];
+    if(stats.allocations == 0 && stats.internalBytes == 0) continue;
+    std::cout << "Host allocations, " << hostScopeName(scope) << " scope: " << stats.allocations << " allocations, " << stats.reallocations << " reallocations, "
+      << stats.frees << " frees, live " << (stats.liveBytes >> 10) << " KiB (peak " << (stats.peakBytes >> 10) << " KiB), driver internal " << (stats.internalBytes >> 10) << " KiB" << std::endl;
+  }
+}
+
+// After vkDestroyInstance: nothing may be left allocated through the callbacks.
+void destroyHostAllocator()
+{
+  if(g_allocator == nullptr) return;
+  for(uint32_t scope = 0; scope < HOST_SCOPE_COUNT; scope++)
+  {
+    if(g_hostStats[scope].liveBytes > 0) std::cerr << "Host allocator destroyed with " << g_hostStats[scope].liveBytes << " bytes live (" << hostScopeName(scope) << " scope)!" << std::endl;
+    for(HostPool& pool : g_hostPools[scope])
+    {
+      pool.chunks.clear();
+      pool.freeList = nullptr;
+    }
+  }
+  g_hostArenas.clear(); // t_hostArena of the threads still alive dangles: no Vulkan calls after this
+  g_allocator = nullptr;
+}
@@ -1,5 +1,8 @@
 #pragma once
 #include "common.hpp"
+#include "profiler.hpp"
+#include "validation.hpp"
+#include "hostallocator.hpp"
 
 const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"}; // Validation layers enabled
 #ifdef __APPLE__
@@ -8,6 +11,18 @@ const std::vector<const char *> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_
 const std::vector<const char *> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 #endif
 
+// Headless rendering never presents, so the swap chain extension is left out (software drivers may not even expose it).
+static std::vector<const char *> getRequiredDeviceExtensions()
+{
+  std::vector<const char *> extensions;
+  for(const char* extension : deviceExtensions)
+  {
+    if(g_headless && strcmp(extension, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0) continue;
+    extensions.push_back(extension);
+  }
+  return extensions;
+}
+
 static bool validationLayersSupported()
 {
   uint32_t layerCount, layersFound = 0;
@@ -32,10 +47,25 @@ static bool validationLayersSupported()
   return false; // All requested layers found!
 }
 
+static bool instanceExtensionSupported(const char* name)
+{
+  uint32_t count = 0;
+  vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> available(count);
+  vkEnumerateInstanceExtensionProperties(nullptr, &count, available.data());
+  for(const VkExtensionProperties& extension : available) if(strcmp(extension.extensionName, name) == 0) return true;
+  return false;
+}
+
+static bool deviceExtensionSupported(const DeviceInfo& info, const char* name)
+{
+  for(const VkExtensionProperties& extension : info.extensions) if(strcmp(extension.extensionName, name) == 0) return true;
+  return false;
+}
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData)
 {
-//  std::cerr << "Validation layer: " << pCallbackData->pMessage << std::endl;
-  std::cerr << pCallbackData->pMessage << std::endl;
+  submitValidationMessage(messageSeverity, pCallbackData); // Written by the sink thread (validation.hpp), the driver call isn't held up
   return VK_FALSE;
 }
 
@@ -85,21 +115,24 @@ static void createDebugMessenger(VkInstanceCreateInfo& createInfo, VkDebugUtilsM
 
 void setupDebugMessenger()
 {
+  PROFILE_FUNCTION();
   if(!g_enabledValidationLayers) return;
   
   VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
   settingsForDebugMessenger( debugCreateInfo );
   
-  CHECK_VULKAN_ERRORS( createDebugUtilsMessengerEXT(g_instance, &debugCreateInfo, nullptr, &g_debugMessenger) );
+  CHECK_VULKAN_ERRORS( createDebugUtilsMessengerEXT(g_instance, &debugCreateInfo, g_allocator, &g_debugMessenger) );
 }
 
 void createInstance(std::string app_name, std::vector<uint8_t> app_version, std::string engine_name, std::vector<uint8_t> engine_version, bool enableValidationLayers)
 {
+  PROFILE_FUNCTION();
   if(enableValidationLayers)
   {
     if(validationLayersSupported()) 
     {
       g_enabledValidationLayers = true;
+      startValidationSink(); // Before vkCreateInstance, which is validated too
     } else throw std::runtime_error("Validation layers requested, but are not supported!");
   } else g_enabledValidationLayers = false;
 
@@ -109,20 +142,42 @@ void createInstance(std::string app_name, std::vector<uint8_t> app_version, std:
   appInfo.applicationVersion = VK_MAKE_VERSION(app_version[0], app_version[1], app_version[2]); // Enter version
   appInfo.pEngineName = engine_name.c_str(); // Enter the name
   appInfo.engineVersion = VK_MAKE_VERSION(engine_version[0], engine_version[1], engine_version[2]); // Enter version
-  appInfo.apiVersion = VK_API_VERSION_1_0; // Vulkan API version
+  g_instanceApiVersion = VK_API_VERSION_1_0;
+  if(g_vulkan12Requested)
+  { // vkEnumerateInstanceVersion does not exist in 1.0 loaders, thus looked up instead of called
+    PFN_vkEnumerateInstanceVersion enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+    uint32_t loaderVersion = VK_API_VERSION_1_0;
+    if(enumerateInstanceVersion != nullptr) enumerateInstanceVersion(&loaderVersion);
+    if(loaderVersion >= VK_API_VERSION_1_2) g_instanceApiVersion = VK_API_VERSION_1_2;
+    else std::cout << "Vulkan 1.2 requested, but the loader only supports 1.0/1.1: using 1.0." << std::endl;
+  }
+  appInfo.apiVersion = g_instanceApiVersion; // Vulkan API version
   
   VkInstanceCreateInfo createInfo = { VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO }; // Create the application instance
   createInfo.pApplicationInfo = &appInfo;
   
   // Prepare extensions
-  std::vector<const char*> extensions = { VK_KHR_SURFACE_EXTENSION_NAME };
+  std::vector<const char*> extensions;
+  if(!g_headless) // Surface extensions only needed when presenting to a window
+  {
+    extensions.push_back( VK_KHR_SURFACE_EXTENSION_NAME );
 #ifdef _WIN32
-  extensions.push_back( VK_KHR_WIN32_SURFACE_EXTENSION_NAME );
+    extensions.push_back( VK_KHR_WIN32_SURFACE_EXTENSION_NAME );
 #elif defined(__APPLE__)
-  extensions.push_back( VK_MVK_MACOS_SURFACE_EXTENSION_NAME );
-  extensions.push_back( VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME ); // TODO: Make correct checking
+    extensions.push_back( VK_MVK_MACOS_SURFACE_EXTENSION_NAME );
 #elif defined(__linux__)
-  extensions.push_back( VK_KHR_XLIB_SURFACE_EXTENSION_NAME );
+    extensions.push_back( VK_KHR_XLIB_SURFACE_EXTENSION_NAME );
+#endif
+  }
+#ifdef __APPLE__
+  extensions.push_back( VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME ); // TODO: Make correct checking
+  g_physicalDeviceProperties2 = true;
+#else
+  if(g_instanceApiVersion == VK_API_VERSION_1_0 && instanceExtensionSupported(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) // Memory budget queries
+  {
+    extensions.push_back( VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME );
+    g_physicalDeviceProperties2 = true;
+  }
 #endif
 
   if(g_enabledValidationLayers) extensions.push_back( VK_EXT_DEBUG_UTILS_EXTENSION_NAME ); // For enabling callback setup in debugmessenger
@@ -133,11 +188,12 @@ void createInstance(std::string app_name, std::vector<uint8_t> app_version, std:
   VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = {}; // Initialize here
   createDebugMessenger( createInfo, debugCreateInfo );
 
-  CHECK_VULKAN_ERRORS( vkCreateInstance(&createInfo, nullptr, &g_instance) );
+  CHECK_VULKAN_ERRORS( vkCreateInstance(&createInfo, g_allocator, &g_instance) );
 }
 
 int createSurface(SDL_Window* window)
 {
+  PROFILE_FUNCTION();
   if(!SDL_Vulkan_CreateSurface(window, g_instance, &g_surface))
   {
     std::cerr << "SDL Error: " << SDL_GetError() << std::endl;
@@ -146,42 +202,47 @@ int createSurface(SDL_Window* window)
   return EXIT_SUCCESS;
 }
 
-QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
+static QueueFamilyIndices findQueueFamilyIndices(VkPhysicalDevice device, const std::vector<VkQueueFamilyProperties>& queueFamilies)
 {
   QueueFamilyIndices indices;
+  uint32_t queueFamilyCount = static_cast<uint32_t>(queueFamilies.size());
 
-  uint32_t queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr); // Count the families
-
-  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data()); // Get the valus into vector.
- 
   int i = 0;
   VkBool32 presentSupport = false;
   for(const auto& queueFamily : queueFamilies)
   {
     if(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) indices.graphicsFamily = i; // Found "graphics" bit, save index.
 
+    if(g_headless) // No surface to present to, only the graphics family is needed
+    {
+      if(indices.graphicsFamily.has_value()) break;
+      i++;
+      continue;
+    }
+
     vkGetPhysicalDeviceSurfaceSupportKHR(device, i, g_surface, &presentSupport); // Check of present  supported in the queue.
     if(presentSupport) indices.presentFamily = i; // If supported, then save the index
 
     if((indices.graphicsFamily.has_value() && indices.presentFamily.has_value())) break; // If the graphicsFamily is real (existing) and the presentFamily also, then stop.
     i++;
   }
+
+  // The transfer-only and async compute families can be anywhere in the list, so they're searched separately (first one of each):
+  for(uint32_t family = 0; family < queueFamilyCount; family++)
+  {
+    VkQueueFlags flags = queueFamilies[family].queueFlags;
+    if(!indices.transferFamily.has_value() && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) indices.transferFamily = family;
+    if(!indices.computeFamily.has_value() && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) indices.computeFamily = family;
+  }
   return indices;
 }
 
-static bool checkDeviceExtensionSupport(VkPhysicalDevice device)
+static bool checkDeviceExtensionSupport(const DeviceInfo& info)
 {
-  uint32_t extensionCount;
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr); // Count the extensions found
- 
-  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data()); // Get extensions
-
-  std::set<std::string> requiredExtensionShoppingList(deviceExtensions.begin(), deviceExtensions.end());
+  std::vector<const char *> requiredExtensions = getRequiredDeviceExtensions();
+  std::set<std::string> requiredExtensionShoppingList(requiredExtensions.begin(), requiredExtensions.end());
 
-  for(const auto& extension : availableExtensions) // Go trough and remove found required extensions from list until all found.
+  for(const auto& extension : info.extensions) // Go trough and remove found required extensions from list until all found.
   {
     requiredExtensionShoppingList.erase(extension.extensionName);
   }
@@ -189,26 +250,119 @@ static bool checkDeviceExtensionSupport(VkPhysicalDevice device)
   return requiredExtensionShoppingList.empty(); // If all required extensions found and crossed over (list empty).
 }
 
-static bool deviceIsSuitable(VkPhysicalDevice device)
+// Higher is better. Device type dominates, then VRAM, then queue layout and features (ties keep the enumeration order).
+static int64_t scoreDevice(const DeviceInfo& info)
 {
-  // ADD HERE OTHER REQUIREMENTS FUNCTIONS FOR CHOOSING THE GPU, NOW ONLY QUEUE FAMILIES WILL BE CHECKED:
-//   VkPhysicalDeviceProperties deviceProperties;
-//   VkPhysicalDeviceFeatures deviceFeatures;
-//   vkGetPhysicalDeviceProperties(device, &deviceProperties);
-//   vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-//   if(deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && deviceFeatures.geometryShader) // EXAMPLE!
-  //...
-
-// Queue families are separate queues (command queues) for different tasks: "compute command", "memory transfer", "graphics"... 
+  int64_t score = 0;
+  switch(info.properties.deviceType)
+  {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 100000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 50000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 20000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: score += 1000; break; // Software rendering: last resort
+    default: break;
+  }
+  VkDeviceSize deviceLocalBytes = 0;
+  for(uint32_t i = 0; i < info.memoryProperties.memoryHeapCount; i++)
+  {
+    if(info.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) deviceLocalBytes += info.memoryProperties.memoryHeaps[i].size;
+  }
+  score += static_cast<int64_t>(std::min<VkDeviceSize>(deviceLocalBytes >> 20, 40000) / 4); // +250 per GiB, up to 10000
+  if(info.indices.transferFamily.has_value()) score += 500; // Uploads don't stall graphics
+  if(info.indices.computeFamily.has_value()) score += 500; // Async compute
+  if(info.indices.presentFamily == info.indices.graphicsFamily) score += 200; // No concurrent sharing of swap chain images
+  if(info.features.samplerAnisotropy) score += 50;
+  score += info.properties.limits.maxImageDimension2D / 1024;
+  return score;
+}
+
+static bool deviceIsSuitable(const DeviceInfo& info)
+{
+  // Queue families are separate queues (command queues) for different tasks: "compute command", "memory transfer", "graphics"...
   // We need to find a queue family for "graphics" tasks at least (and that our SDL surface is supported:
-  
-  QueueFamilyIndices indices = findQueueFamilies(device);
-  g_deviceExtensionsSupported = checkDeviceExtensionSupport(device);
-  return (indices.graphicsFamily.has_value() && indices.presentFamily.has_value() && g_deviceExtensionsSupported && swapChainIsAdequate(device)); // Return true if the graphicsFamily is real (exists) and make sure device extensions are supported.
+  if(!info.indices.graphicsFamily.has_value() || !checkDeviceExtensionSupport(info)) return false;
+  if(g_headless) return true; // No surface: skip the present and swap chain checks
+  return info.indices.presentFamily.has_value() && !info.surfaceFormats.empty() && !info.presentModes.empty(); // Same as swapChainIsAdequate(), which can't be called while the entry is being filled
 }
 
+std::vector<std::unique_ptr<DeviceInfo>> g_deviceInfos; // Stable addresses: references are handed out
+
+// Queries (once, at the first call) everything init needs about the device. The surface must exist before, unless headless.
+const DeviceInfo& getDeviceInfo(VkPhysicalDevice device)
+{
+  for(const std::unique_ptr<DeviceInfo>& info : g_deviceInfos) if(info->device == device) return *info;
+
+  g_deviceInfos.push_back(std::make_unique<DeviceInfo>());
+  DeviceInfo& info = *g_deviceInfos.back();
+  info.device = device;
+  vkGetPhysicalDeviceProperties(device, &info.properties);
+  vkGetPhysicalDeviceFeatures(device, &info.features);
+  vkGetPhysicalDeviceMemoryProperties(device, &info.memoryProperties);
+  if(g_instanceApiVersion >= VK_API_VERSION_1_2 && info.properties.apiVersion >= VK_API_VERSION_1_2)
+  {
+    info.features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+    features2.pNext = &info.features12;
+    vkGetPhysicalDeviceFeatures2(device, &features2);
+    info.features12.pNext = nullptr;
+
+    info.properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties2.pNext = &info.properties12;
+    vkGetPhysicalDeviceProperties2(device, &properties2);
+    info.properties12.pNext = nullptr;
+  }
+
+  uint32_t count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+  info.queueFamilies.resize(count);
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, info.queueFamilies.data());
+
+  count = 0;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr);
+  info.extensions.resize(count);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &count, info.extensions.data());
+
+  info.indices = findQueueFamilyIndices(device, info.queueFamilies);
+  if(!g_headless)
+  {
+    count = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, g_surface, &count, nullptr);
+    info.surfaceFormats.resize(count);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, g_surface, &count, info.surfaceFormats.data());
+    info.surfaceFormats.resize(count);
+    count = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, g_surface, &count, nullptr);
+    info.presentModes.resize(count);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, g_surface, &count, info.presentModes.data());
+    info.presentModes.resize(count); // Only what was written: the policies must never pick a zero-filled entry (IMMEDIATE)
+  }
+  info.suitable = deviceIsSuitable(info);
+  info.score = scoreDevice(info);
+  return info;
+}
+
+QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
+{
+  return getDeviceInfo(device).indices;
+}
+
+static const char* deviceTypeName(VkPhysicalDeviceType type)
+{
+  switch(type)
+  {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+    default: return "other";
+  }
+}
+
+// Highest scoring suitable device, or TEMPLATE_GPU=N: the N:th device of the list printed here.
 int createPhysicalDevice()
 {
+  PROFILE_FUNCTION();
   uint32_t deviceCount = 0;
   CHECK_VULKAN_ERRORS( vkEnumeratePhysicalDevices(g_instance, &deviceCount, nullptr) );
   if(deviceCount == 0) throw std::runtime_error("Failed to find any GPU with Vulkan support!");
@@ -217,18 +371,32 @@ int createPhysicalDevice()
 
   CHECK_VULKAN_ERRORS( vkEnumeratePhysicalDevices(g_instance, &deviceCount, devices.data()) );
 
-  for(const auto& device : devices) // For all the devices check which one(s) meet the requirements
+  uint32_t forcedDevice = getEnvironmentValue("TEMPLATE_GPU", UINT32_MAX);
+  int64_t bestScore = -1;
+  for(uint32_t i = 0; i < deviceCount; i++) // For all the devices check which one(s) meet the requirements
   {
-    if(deviceIsSuitable(device))
+    const DeviceInfo& info = getDeviceInfo(devices[i]);
+    std::cout << "GPU " << i << ": " << info.properties.deviceName << " (" << deviceTypeName(info.properties.deviceType) << ") ";
+    if(info.suitable) std::cout << "score " << info.score << std::endl;
+    else std::cout << "not suitable" << std::endl;
+
+    if(forcedDevice == UINT32_MAX && info.suitable && info.score > bestScore)
     {
-      g_physicalDevice = device;
-      break;
+      g_physicalDevice = devices[i];
+      bestScore = info.score;
     }
   }
+  if(forcedDevice != UINT32_MAX)
+  {
+    if(forcedDevice >= deviceCount || !getDeviceInfo(devices[forcedDevice]).suitable) throw std::runtime_error("TEMPLATE_GPU does not name a suitable GPU!");
+    g_physicalDevice = devices[forcedDevice];
+  }
 
   if(g_physicalDevice == VK_NULL_HANDLE) throw std::runtime_error("Failed to find a suitable GPU!");
 
-  vkGetPhysicalDeviceProperties(g_physicalDevice, &g_properties);
+  const DeviceInfo& selected = getDeviceInfo(g_physicalDevice);
+  g_properties = selected.properties;
+  g_deviceExtensionsSupported = checkDeviceExtensionSupport(selected); // Of the selected device, not the last one checked
   std::cout << "Physical device: " << g_properties.deviceName << std::endl;
 
   return EXIT_SUCCESS;
@@ -236,13 +404,17 @@ int createPhysicalDevice()
 
 int createLogicalDevice()
 {
+  PROFILE_FUNCTION();
   QueueFamilyIndices indices = findQueueFamilies(g_physicalDevice); // Collect the quefamilies from the selected device(s)
 
   // Create graphics and present queues:
   float queuePriority = 1.0f; // Highest priority for only one queue
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos; // Two queue create infos
-  std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() }; // set of indeces
+  std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value() }; // set of indeces
+  if(indices.presentFamily.has_value()) uniqueQueueFamilies.insert(indices.presentFamily.value()); // Headless: no present family
+  if(indices.transferFamily.has_value()) uniqueQueueFamilies.insert(indices.transferFamily.value()); // Only when the device has a transfer-only family
+  if(indices.computeFamily.has_value()) uniqueQueueFamilies.insert(indices.computeFamily.value()); // Only when the device has a compute family without graphics
   for(const auto& queueFamily : uniqueQueueFamilies)
   {
     VkDeviceQueueCreateInfo queueCreateInfo = { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO }; 
@@ -252,15 +424,55 @@ int createLogicalDevice()
     queueCreateInfos.push_back(queueCreateInfo); // Save unique queue into the vector
   }
   
-  VkPhysicalDeviceFeatures deviceFeatures = {}; // Disable all feature for now
+  VkPhysicalDeviceFeatures deviceFeatures = {}; // Only the features something uses
+  const DeviceInfo& info = getDeviceInfo(g_physicalDevice);
+  g_multiDrawIndirect = info.features.multiDrawIndirect && info.features.drawIndirectFirstInstance; // GPU-driven scene (scene.hpp)
+  deviceFeatures.multiDrawIndirect = g_multiDrawIndirect;
+  deviceFeatures.drawIndirectFirstInstance = g_multiDrawIndirect;
+  g_textureCompressionBC = info.features.textureCompressionBC; // Streamed textures (streaming.hpp)
+  deviceFeatures.textureCompressionBC = g_textureCompressionBC;
   
   VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
   createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size()); // Graphics and present queues
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
   createInfo.pEnabledFeatures = &deviceFeatures;
 
-  createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  // Vulkan 1.2 path: the features are enabled through VkPhysicalDeviceFeatures2 in the chain instead of pEnabledFeatures.
+  VkPhysicalDeviceVulkan12Features enabledFeatures12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+  VkPhysicalDeviceFeatures2 enabledFeatures2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+  g_vulkan12 = info.features12.sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES; // Queried only when both sides are 1.2
+  if(g_vulkan12)
+  {
+    const VkPhysicalDeviceVulkan12Features& supported = info.features12;
+    g_descriptorIndexing = supported.descriptorIndexing && supported.runtimeDescriptorArray && supported.descriptorBindingPartiallyBound &&
+      supported.shaderSampledImageArrayNonUniformIndexing && supported.descriptorBindingSampledImageUpdateAfterBind &&
+      supported.descriptorBindingStorageBufferUpdateAfterBind && supported.descriptorBindingUpdateUnusedWhilePending;
+    if(g_descriptorIndexing)
+    {
+      enabledFeatures12.descriptorIndexing = VK_TRUE;
+      enabledFeatures12.runtimeDescriptorArray = VK_TRUE;
+      enabledFeatures12.descriptorBindingPartiallyBound = VK_TRUE;
+      enabledFeatures12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+      enabledFeatures12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+      enabledFeatures12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+      enabledFeatures12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    }
+    g_drawIndirectCount = g_multiDrawIndirect && supported.drawIndirectCount;
+    enabledFeatures12.drawIndirectCount = g_drawIndirectCount;
+    g_timelineSemaphores = supported.timelineSemaphore;
+    enabledFeatures12.timelineSemaphore = g_timelineSemaphores;
+    enabledFeatures2.features = deviceFeatures;
+    enabledFeatures2.pNext = &enabledFeatures12;
+    createInfo.pNext = &enabledFeatures2;
+    createInfo.pEnabledFeatures = nullptr; // Must be null with VkPhysicalDeviceFeatures2 in the chain
+  }
+  std::cout << "Device API: " << (g_vulkan12 ? "Vulkan 1.2" : "Vulkan 1.0") << ", descriptors: " << (g_descriptorIndexing ? "bindless" : "per draw") << std::endl;
+
+  std::vector<const char *> requiredExtensions = getRequiredDeviceExtensions();
+  g_memoryBudget = (g_vulkan12 || g_physicalDeviceProperties2) && deviceExtensionSupported(info, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME); // Optional: heap budgets (memory.hpp)
+  if(g_memoryBudget) requiredExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
+  createInfo.ppEnabledExtensionNames = requiredExtensions.data();
 
   // Below may not needed, included for legacy support: (Instance and device validation layers no need to separate anymore)  
   if(g_enabledValidationLayers) 
@@ -269,27 +481,32 @@ int createLogicalDevice()
     createInfo.ppEnabledLayerNames = validationLayers.data();
   } else createInfo.enabledLayerCount = 0;
 
-  CHECK_VULKAN_ERRORS( vkCreateDevice(g_physicalDevice, &createInfo, nullptr, &g_device ) );
+  CHECK_VULKAN_ERRORS( vkCreateDevice(g_physicalDevice, &createInfo, g_allocator, &g_device ) );
 
   // Queues are automatically created when logical devices are created, thus we just need to connect the handles:
   vkGetDeviceQueue(g_device, indices.graphicsFamily.value(), 0, &g_graphicsQueue); // These queue handles could point same place
-  vkGetDeviceQueue(g_device, indices.presentFamily.value(), 0, &g_presentQueue); // These queue handles could point same place
+  if(indices.presentFamily.has_value()) vkGetDeviceQueue(g_device, indices.presentFamily.value(), 0, &g_presentQueue); // These queue handles could point same place
+  if(indices.transferFamily.has_value()) vkGetDeviceQueue(g_device, indices.transferFamily.value(), 0, &g_transferQueue);
+  else g_transferQueue = g_graphicsQueue; // No separate transfer family: uploads share the graphics queue
+  if(indices.computeFamily.has_value()) vkGetDeviceQueue(g_device, indices.computeFamily.value(), 0, &g_computeQueue);
+  else g_computeQueue = g_graphicsQueue; // No separate compute family: compute passes are submitted to the graphics queue
 
   return EXIT_SUCCESS;
 }
 
 int createCommandPool()
 {
+  PROFILE_FUNCTION();
   QueueFamilyIndices indices = findQueueFamilies(g_physicalDevice);
   VkCommandPoolCreateInfo commandPoolCreateInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
   commandPoolCreateInfo.queueFamilyIndex = indices.graphicsFamily.value(); // Command pool connects buffers (memory) to only graphics related queues.
   // Transient: Command buffers rerecorded "often", Reset: Allow command buffers to be rerecorded "individually".
-//  commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Every frame in flight rerecords its own buffer
   commandPoolCreateInfo.pNext = NULL;
-  commandPoolCreateInfo.flags = 0;
 
-  CHECK_VULKAN_ERRORS( vkCreateCommandPool(g_device, &commandPoolCreateInfo, nullptr, &g_commandPool) );
+  CHECK_VULKAN_ERRORS( vkCreateCommandPool(g_device, &commandPoolCreateInfo, g_allocator, &g_commandPool) );
 
   return EXIT_SUCCESS;
 }
 
+
@@ -0,0 +1,125 @@
+#pragma once
+#include "common.hpp"
+#include "present.hpp"
+#include "profiler.hpp"
+
+#include <atomic>
+#include <thread>
+
+// Input is pumped apart from the rendering: the main thread (SDL wants its events pumped where the window was created)
+// waits for OS events and timestamps each one as it arrives, the render thread picks them up at the start of its next frame
+// through a single-producer single-consumer ring. A slow frame delays when input is handled, never when it is sampled:
+// latencies are measured from the arrival timestamps (SDL_GetPerformanceCounter ticks).
+// Resizes and minimizing travel through the ring too, so the swap chain state (g_width, g_height, g_framebufferResized,
+// g_windowMinimized) belongs to the render thread alone. Quitting is the one cross-thread flag: g_quitFlag is atomic, set by
+// either thread (window closed or Escape on the main thread, benchmark done or failure on the render thread).
+
+enum InputEventType { INPUT_RESIZE, INPUT_MINIMIZE, INPUT_RESTORE, INPUT_KEY_DOWN, INPUT_MOUSE_BUTTON_DOWN };
+
+struct InputEvent
+{
+  InputEventType type;
+  uint64_t arrival; // SDL_GetPerformanceCounter() when pumped
+  int32_t key; // SDL_Keycode: INPUT_KEY_DOWN
+  uint32_t width, height; // INPUT_RESIZE
+};
+
+const uint32_t INPUT_QUEUE_SIZE = 256; // Power of two
+
+struct InputQueue
+{
+  InputEvent events[INPUT_QUEUE_SIZE];
+  alignas(64) std::atomic<uint32_t> head{0}; // Next to read, written by the consumer
+  alignas(64) std::atomic<uint32_t> tail{0}; // Next to write, written by the producer
+};
+
+struct InputStats
+{
+  uint64_t events = 0;
+  uint64_t queuedTicks = 0; // Arrival -> handled, summed
+  uint64_t maxQueuedTicks = 0;
+};
+
+InputQueue g_inputQueue;
+InputStats g_inputStats; // Render thread only
+uint64_t g_droppedInputEvents = 0; // Producer only: pushed after quitting with the ring full
+
+// Producer (the thread pumping SDL events). Waits while the ring is full rather than losing a resize or a key, unless the
+// render thread is quitting: it may have left its loop already, nothing would empty the ring anymore.
+void pushInputEvent(const InputEvent& event)
+{
+  uint32_t tail = g_inputQueue.tail.load(std::memory_order_relaxed);
+  while(tail - g_inputQueue.head.load(std::memory_order_acquire) == INPUT_QUEUE_SIZE)
+  {
+    if(g_quitFlag)
+    {
+      g_droppedInputEvents++;
+      return;
+    }
+    std::this_thread::yield();
+  }
+  g_inputQueue.events[tail & (INPUT_QUEUE_SIZE - 1)] = event;
+  g_inputQueue.tail.store(tail + 1, std::memory_order_release);
+}
+
+// Consumer (the render thread).
+static bool popInputEvent(InputEvent& event)
+{
+  uint32_t head = g_inputQueue.head.load(std::memory_order_relaxed);
+  if(head == g_inputQueue.tail.load(std::memory_order_acquire)) return false;
+  event = g_inputQueue.events[head & (INPUT_QUEUE_SIZE - 1)];
+  g_inputQueue.head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+static void handleKeyDown(int32_t key)
+{
+  if(key == SDLK_F1) setPresentPolicy(PresentPolicy::LatencyFirst);
+  if(key == SDLK_F2) setPresentPolicy(PresentPolicy::ThroughputFirst);
+  if(key == SDLK_F3) setPresentPolicy(PresentPolicy::PowerSaving);
+}
+
+static void handleResize(uint32_t width, uint32_t height)
+{
+  if( (width > 0) && (height > 0) && ( (width != g_width) || (height != g_height) ) )
+  {
+    g_width = width;
+    g_height = height;
+    g_framebufferResized = true; // Swap chain is recreated (from the old one) before the next frame
+  }
+}
+
+// Render thread, once per frame: everything which arrived since the last frame, in arrival order.
+void processInputEvents()
+{
+  PROFILE_FUNCTION();
+  InputEvent event;
+  while(popInputEvent(event))
+  {
+    uint64_t queuedTicks = SDL_GetPerformanceCounter() - event.arrival;
+    g_inputStats.events++;
+    g_inputStats.queuedTicks += queuedTicks;
+    g_inputStats.maxQueuedTicks = std::max(g_inputStats.maxQueuedTicks, queuedTicks);
+    switch(event.type)
+    {
+      case INPUT_RESIZE: handleResize(event.width, event.height); break;
+      case INPUT_MINIMIZE: g_windowMinimized = true; break;
+      case INPUT_RESTORE: g_windowMinimized = false; break;
+      case INPUT_KEY_DOWN:
+        notePendingInput(event.arrival);
+        handleKeyDown(event.key);
+        break;
+      case INPUT_MOUSE_BUTTON_DOWN: notePendingInput(event.arrival); break;
+    }
+  }
+}
+
+// How long input waited for the render thread: about half a frame on average when the frames keep up.
+void reportInputStats()
+{
+  if(g_droppedInputEvents > 0) std::cout << "Input events: " << g_droppedInputEvents << " dropped while quitting" << std::endl;
+  if(g_inputStats.events == 0) return;
+  double ticksPerMs = static_cast<double>(SDL_GetPerformanceFrequency()) / 1000.0;
+  std::cout << "Input events: " << g_inputStats.events << " | queued avg " << g_inputStats.queuedTicks / ticksPerMs / g_inputStats.events
+    << " ms | max " << g_inputStats.maxQueuedTicks / ticksPerMs << " ms" << std::endl;
+}
@@ -2,6 +2,8 @@
 #include "sdl.hpp"
 #include "init.hpp"
 #include "swap.hpp"
+#include "headless.hpp"
+#include "frame.hpp"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -10,51 +12,157 @@ int wmain()
 int main()
 #endif
 {
+  g_headless = getEnvironmentValue("TEMPLATE_HEADLESS", 0) != 0; // TEMPLATE_HEADLESS=1: no window, render offscreen
+  uint32_t benchFrames = getEnvironmentValue("TEMPLATE_BENCH_FRAMES", 1000); // Frames rendered by a headless run
+  uint32_t headlessWidth = std::max(1u, getEnvironmentValue("TEMPLATE_HEADLESS_WIDTH", 1280)); // Offscreen image size
+  uint32_t headlessHeight = std::max(1u, getEnvironmentValue("TEMPLATE_HEADLESS_HEIGHT", 720));
+  uint32_t framesInFlight = getEnvironmentValue("TEMPLATE_FRAMES_IN_FLIGHT", 2); // Frames the CPU may record ahead of the GPU
+  g_hotReload = getEnvironmentValue("TEMPLATE_HOT_RELOAD", 0) != 0; // Rebuild pipelines when their .spv files change
+  g_traceEnabled = getEnvironmentValue("TEMPLATE_TRACE", 0) != 0; // Chrome trace of the run written at exit
+  uint32_t recordThreads = getEnvironmentValue("TEMPLATE_THREADS", 0); // Threads recording commands (main included), 0: one per hardware thread
+  uint32_t extraDraws = getEnvironmentValue("TEMPLATE_EXTRA_DRAWS", 0); // The triangle drawn this many more times: CPU recording load
+  uint32_t sceneObjects = getEnvironmentValue("TEMPLATE_SCENE_OBJECTS", 0); // GPU-driven scene of this many objects, 0: the triangle only
+  uint32_t streamTextures = getEnvironmentValue("TEMPLATE_STREAM_TEXTURES", 0); // Generated test textures streamed in the background
+  uint32_t streamThreads = getEnvironmentValue("TEMPLATE_STREAM_THREADS", 2); // Streaming I/O threads
+  uint32_t streamBudget = getEnvironmentValue("TEMPLATE_STREAM_BUDGET_MB", 256); // Streamed texture memory budget
+  g_captureMode = static_cast<CaptureMode>(std::min(getEnvironmentValue("TEMPLATE_CAPTURE", 0), 2u)); // Frames copied out: 1 PNG, 2 raw
+  g_captureEvery = std::max(1u, getEnvironmentValue("TEMPLATE_CAPTURE_EVERY", 1)); // Every Nth frame is captured
+  g_captureGolden = getEnvironmentValue("TEMPLATE_CAPTURE_GOLDEN", 0) != 0; // Compare the captured frames with golden/ instead
+  g_captureGoldenSeed = getEnvironmentValue("TEMPLATE_CAPTURE_GOLDEN_SEED", 0) != 0; // Golden mode: write golden/ from this run
+  g_captureGolden = g_captureGolden || g_captureGoldenSeed;
+  g_captureTolerance = getEnvironmentValue("TEMPLATE_CAPTURE_TOLERANCE", 2); // Golden comparison: allowed difference per channel
+  if(g_captureGolden && g_captureMode == CAPTURE_OFF) g_captureMode = CAPTURE_PNG;
+  g_captureRequested = g_captureMode != CAPTURE_OFF;
+  g_dynamicResolution = getEnvironmentValue("TEMPLATE_DYNAMIC_RESOLUTION", 0) != 0; // Render resolution follows the GPU frame time
+  g_blitTargetRequested = g_dynamicResolution;
+  g_resolutionMinPercent = getEnvironmentValue("TEMPLATE_RESOLUTION_MIN", 50); // Dynamic resolution bounds, percent of the window size
+  g_resolutionMaxPercent = getEnvironmentValue("TEMPLATE_RESOLUTION_MAX", 100);
+  g_resolutionTargetFps = getEnvironmentValue("TEMPLATE_TARGET_FPS", 60); // Frame rate the dynamic resolution keeps the GPU time within
+  bool hostAllocator = getEnvironmentValue("TEMPLATE_HOST_ALLOCATOR", 0) != 0; // Driver host allocations pooled and counted per scope
+  g_vulkan12Requested = getEnvironmentValue("TEMPLATE_VULKAN_1_2", 0) != 0; // Vulkan 1.2 path: bindless descriptors and queue timelines when supported
+  g_presentPolicy = static_cast<PresentPolicy>(std::min(getEnvironmentValue("TEMPLATE_PRESENT_POLICY", 2), PRESENT_POLICY_COUNT - 1)); // Power saving (FIFO) by default
+
   // Create
-  if(createWindow("Vulkan", 1280, 720) == EXIT_FAILURE) return EXIT_FAILURE;
+  if(!g_headless && createWindow("Vulkan", 1280, 720) == EXIT_FAILURE) return EXIT_FAILURE;
+  if(hostAllocator) createHostAllocator();
 #ifdef NDEBUG // Not debug : Disable validation for better performance and size
   createInstance("Triangle", {1,0,0}, "Template_Engine", {1,0,0}, false);
 #else // Debug : Enable validation
   createInstance("Triangle", {1,0,0}, "Template_Engine", {1,0,0}, true);
 #endif
   setupDebugMessenger();
-  if(createSurface(g_window) == EXIT_FAILURE) return EXIT_FAILURE;
+  if(!g_headless && createSurface(g_window) == EXIT_FAILURE) return EXIT_FAILURE;
   createPhysicalDevice();
   createLogicalDevice();
+  createTimelines();
+  createMemoryAllocator();
   createCommandPool();
-  createSwapChain();
+  createUploadContext();
+  createResourceHeap();
+  if(g_headless) createOffscreenTargets(headlessWidth, headlessHeight);
+  else createSwapChain();
+  createRenderPass();
+  createFramebuffers();
+  startWorkerThreads(recordThreads);
+  JobCounter pipelineCacheLoaded; // Startup jobs: the cache file is read while the pipelines and the scene are declared,
+  JobCounter pipelinesCompiled;   // the pipelines compile while the frame resources are created
+  runJob(createPipelineCache, &pipelineCacheLoaded);
+  createTrianglePipeline();
+  addTriangleDraws(extraDraws);
+  createMainPass();
+  createCapture(MAX_FRAMES_IN_FLIGHT, g_backbuffer);
+  if(sceneObjects > 0) createScene(sceneObjects, MAX_FRAMES_IN_FLIGHT);
+  uint32_t pipelineFailures = 0;
+  runJobAfter(pipelineCacheLoaded, [&pipelineFailures] { pipelineFailures = compilePipelines(); }, &pipelinesCompiled);
+  createFrames(framesInFlight);
+  waitForJobs(pipelinesCompiled);
+  waitForJobs(pipelineCacheLoaded);
+  if(pipelineFailures > 0) throw std::runtime_error("Failed to create the pipelines!");
+  if(streamTextures > 0)
+  {
+    std::vector<std::string> texturePaths = generateStreamingTextures(streamTextures, STREAMING_TEST_TEXTURE_SIZE);
+    startStreaming(streamThreads, static_cast<VkDeviceSize>(streamBudget) << 20);
+    for(uint32_t i = 0; i < streamTextures; i++) requestTexture(texturePaths[i], static_cast<int32_t>(i % 4)); // Mixed priorities
+  }
 
   // Loop
-  while(!g_quitFlag)
+  if(g_headless) renderLoop(benchFrames);
+  else // The main thread pumps the window events, a render thread draws (input.hpp)
   {
-    pollEvents();
+    std::exception_ptr renderError;
+    std::thread renderThread([&renderError]
+    {
+      try
+      {
+        renderLoop(0);
+      } catch(...)
+      {
+        renderError = std::current_exception();
+        g_quitFlag = true;
+      }
+    });
+    while(!g_quitFlag) pumpEvents();
+    renderThread.join();
+    if(renderError) std::rethrow_exception(renderError);
   }
+  CHECK_VULKAN_ERRORS( vkDeviceWaitIdle(g_device) ); // Frames still in flight must finish before anything is destroyed
+  bool capturesMatched = finishCapture(); // The last frames' captures are written before the report
+  reportFrameTimes();
+  reportDynamicResolution();
+  reportPresentLatencies();
+  reportInputStats();
+  printMemoryStats();
+  reportHostAllocations();
+  reportGpuZones();
+  reportSceneStats();
+  reportJobStats();
+  reportStreamingStats();
+  reportCaptureStats();
+  collectCpuZones();
+  writeTrace();
 
   // Delete
-  vkDestroyCommandPool(g_device, g_commandPool, nullptr);
+  stopStreaming();
+  destroyFrames();
+  destroyScene();
+  destroyCapture();
+  destroyRenderGraph();
+  destroyPipelines();
+  destroyPipelineCache(); // Saved for the next (warm) start
+  destroyResourceHeap();
+  destroyRenderPass();
+  stopWorkerThreads();
+  destroyUploadContext();
+  destroyTimelines();
+  vkDestroyCommandPool(g_device, g_commandPool, g_allocator);
   g_commandPool = VK_NULL_HANDLE;
 
-  if(g_enabledValidationLayers) destroyDebugUtilsMessengerEXT(g_instance, g_debugMessenger, nullptr); // extensions must be destroyed before instance destruction
+  if(g_enabledValidationLayers) destroyDebugUtilsMessengerEXT(g_instance, g_debugMessenger, g_allocator); // extensions must be destroyed before instance destruction
   g_debugMessenger = VK_NULL_HANDLE;
 
-  vkDestroySwapchainKHR(g_device, g_swapchain, nullptr);
+  if(g_headless) destroyOffscreenTargets();
+  else vkDestroySwapchainKHR(g_device, g_swapchain, g_allocator);
+  destroyRetiredSwapChains(UINT64_MAX); // Frames are finished (device idle), old swap chains can go
+  destroyMemoryAllocator();
   g_swapchain = VK_NULL_HANDLE;
 
-  vkDestroySurfaceKHR(g_instance, g_surface, nullptr);
+  if(!g_headless) vkDestroySurfaceKHR(g_instance, g_surface, nullptr); // Created by SDL without allocation callbacks
   g_surface = VK_NULL_HANDLE;
 
-  vkDestroyDevice(g_device, nullptr);
+  vkDestroyDevice(g_device, g_allocator);
   g_device = VK_NULL_HANDLE;
 
-  vkDestroyInstance(g_instance, nullptr);
+  vkDestroyInstance(g_instance, g_allocator);
   g_instance = VK_NULL_HANDLE;
+  stopValidationSink(); // After the instance: its destruction is validated too
+  destroyHostAllocator();
 
   g_graphicsQueue = VK_NULL_HANDLE;
   g_presentQueue = VK_NULL_HANDLE;
   g_physicalDevice = VK_NULL_HANDLE;
 
-  destroyWindow();
+  if(!g_headless) destroyWindow();
 
-  return EXIT_SUCCESS;
+  return capturesMatched ? EXIT_SUCCESS : EXIT_FAILURE; // Golden frame differences fail the run
 }
 
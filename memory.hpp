@@ -0,0 +1,527 @@
+#pragma once
+#include "common.hpp"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// GPU memory sub-allocator: instead of one vkAllocateMemory per resource (slow, and maxMemoryAllocationCount can be as low as 4096):
+// - Long-lived resources: buddy allocation inside big blocks, one block list per memory type and resource kind
+//   (linear buffers and optimal images never share a block, so bufferImageGranularity can't bite).
+// - Big resources (over half a block, e.g. render targets): dedicated VkDeviceMemory of their own.
+// - Per-frame transient data: a persistently mapped ring buffer, freed a whole frame at a time when its fence has signaled.
+// Host visible blocks are mapped once for their whole lifetime.
+
+const VkDeviceSize MEMORY_BLOCK_SIZE = 64ull << 20; // 64 MiB, smaller for small heaps
+const VkDeviceSize MEMORY_MIN_BUDDY_SIZE = 256; // Smallest sub-allocation
+const uint32_t MEMORY_KIND_LINEAR = 0; // Buffers (and linear images)
+const uint32_t MEMORY_KIND_OPTIMAL = 1; // Optimal tiling images
+
+enum class MemoryUsage
+{
+  GpuOnly, // DEVICE_LOCAL: render targets, textures, static geometry
+  CpuToGpu, // HOST_VISIBLE | HOST_COHERENT: staging, per-frame uniforms
+  GpuToCpu // HOST_VISIBLE | HOST_COHERENT, HOST_CACHED preferred: readbacks
+};
+
+struct MemoryBlock
+{
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  void* mapped = nullptr;
+  VkDeviceSize size = 0; // Power of two
+  uint32_t levelCount = 0; // Level 0 is the whole block, level n nodes are size >> n
+  std::vector<std::set<VkDeviceSize>> freeLists; // Free node offsets per level
+  std::unordered_map<VkDeviceSize, uint32_t> allocatedLevels; // Allocated node offset -> level
+  VkDeviceSize usedBytes = 0;
+};
+
+struct MemoryPool
+{
+  std::vector<std::unique_ptr<MemoryBlock>> blocks;
+};
+
+struct Allocation
+{
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void* mapped = nullptr; // Points to offset already, nullptr if not host visible
+  uint32_t memoryType = 0;
+  uint32_t kind = MEMORY_KIND_LINEAR;
+  MemoryBlock* block = nullptr; // nullptr: dedicated allocation
+};
+
+struct AllocatedBuffer
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation allocation;
+};
+
+struct AllocatedImage
+{
+  VkImage image = VK_NULL_HANDLE;
+  Allocation allocation;
+};
+
+struct HeapStats
+{
+  VkDeviceSize heapSize = 0;
+  VkDeviceSize blockBytes = 0; // Reserved in blocks for sub-allocation
+  VkDeviceSize usedBytes = 0; // Sub-allocated from the blocks (rounded up to buddy node sizes)
+  VkDeviceSize dedicatedBytes = 0;
+  VkDeviceSize largestFreeRegion = 0;
+  uint32_t blockCount = 0;
+  uint32_t dedicatedCount = 0;
+  uint32_t allocationCount = 0; // Sub-allocations + dedicated
+  uint32_t freeRegionCount = 0;
+  float fragmentation = 0.0f; // 1 - largest free region / all free bytes: 0 when all free space is in one piece
+};
+
+VkPhysicalDeviceMemoryProperties g_memoryProperties;
+std::vector<MemoryPool> g_memoryPools; // Index: memoryType * 2 + kind
+std::vector<VkDeviceSize> g_dedicatedBytes; // Per memory type
+std::vector<uint32_t> g_dedicatedCounts; // Per memory type
+uint32_t g_deviceMemoryCount = 0; // Live VkDeviceMemory objects, must stay below maxMemoryAllocationCount
+std::mutex g_memoryMutex;
+
+// Heap budgets: how much of a heap the process can use before the driver starts paging (or failing), and how much it uses.
+// From VK_EXT_memory_budget when enabled (also counting other processes and the driver's own allocations), otherwise 80%
+// of the heap size and the bytes this allocator holds stand in. Streaming sizes its textures by it (deviceLocalBudgetLeft()).
+const uint64_t MEMORY_BUDGET_INTERVAL = 60; // Frames between the samples of updateMemoryBudget()
+
+struct HeapBudget
+{
+  VkDeviceSize budget = 0;
+  VkDeviceSize usage = 0;
+  VkDeviceSize peakUsage = 0; // Of the samples
+  bool overBudget = false; // Reported once
+};
+
+PFN_vkGetPhysicalDeviceMemoryProperties2 g_getMemoryProperties2 = nullptr; // Set with g_memoryBudget
+std::vector<HeapBudget> g_heapBudgets; // Samples, the render thread only
+
+void createMemoryAllocator()
+{
+  g_memoryProperties = getDeviceInfo(g_physicalDevice).memoryProperties;
+  g_memoryPools.resize(g_memoryProperties.memoryTypeCount * 2);
+  g_dedicatedBytes.assign(g_memoryProperties.memoryTypeCount, 0);
+  g_dedicatedCounts.assign(g_memoryProperties.memoryTypeCount, 0);
+  g_heapBudgets.assign(g_memoryProperties.memoryHeapCount, {});
+  if(g_memoryBudget) g_getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2) vkGetInstanceProcAddr(g_instance, g_vulkan12 ? "vkGetPhysicalDeviceMemoryProperties2" : "vkGetPhysicalDeviceMemoryProperties2KHR");
+}
+
+// Find a memory type from the allowed types (bits) of a resource, which also has all the wanted properties.
+uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties)
+{
+  for(uint32_t i = 0; i < g_memoryProperties.memoryTypeCount; i++)
+  {
+    if((typeBits & (1 << i)) && (g_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) return i;
+  }
+  throw std::runtime_error("Failed to find a suitable memory type!");
+}
+
+static uint32_t findMemoryTypeForUsage(uint32_t typeBits, MemoryUsage usage)
+{
+  VkMemoryPropertyFlags required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  VkMemoryPropertyFlags preferred = 0;
+  if(usage == MemoryUsage::GpuOnly) required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  if(usage == MemoryUsage::GpuToCpu) preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT; // CPU reads are slow from uncached memory
+
+  if(preferred != 0)
+  {
+    for(uint32_t i = 0; i < g_memoryProperties.memoryTypeCount; i++)
+    {
+      if((typeBits & (1 << i)) && (g_memoryProperties.memoryTypes[i].propertyFlags & (required | preferred)) == (required | preferred)) return i;
+    }
+  }
+  return findMemoryType(typeBits, required);
+}
+
+static VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped)
+{
+  if(g_deviceMemoryCount >= g_properties.limits.maxMemoryAllocationCount) throw std::runtime_error("maxMemoryAllocationCount reached!");
+
+  VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+  allocateInfo.allocationSize = size;
+  allocateInfo.memoryTypeIndex = memoryType;
+  VkDeviceMemory memory;
+  CHECK_VULKAN_ERRORS( vkAllocateMemory(g_device, &allocateInfo, g_allocator, &memory) );
+  g_deviceMemoryCount++;
+
+  *mapped = nullptr;
+  if(g_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+  {
+    CHECK_VULKAN_ERRORS( vkMapMemory(g_device, memory, 0, VK_WHOLE_SIZE, 0, mapped) ); // Persistently mapped
+  }
+  return memory;
+}
+
+static void freeDeviceMemory(VkDeviceMemory memory)
+{
+  vkFreeMemory(g_device, memory, g_allocator); // Implicitly unmapped
+  g_deviceMemoryCount--;
+}
+
+static VkDeviceSize blockSizeForType(uint32_t memoryType)
+{
+  VkDeviceSize heapSize = g_memoryProperties.memoryHeaps[g_memoryProperties.memoryTypes[memoryType].heapIndex].size;
+  VkDeviceSize blockSize = MEMORY_BLOCK_SIZE;
+  while(blockSize > MEMORY_MIN_BUDDY_SIZE && blockSize > heapSize / 8) blockSize /= 2; // Small heaps (e.g. 256 MiB BAR) get smaller blocks
+  return blockSize;
+}
+
+static MemoryBlock* createMemoryBlock(MemoryPool& pool, uint32_t memoryType)
+{
+  std::unique_ptr<MemoryBlock> block(new MemoryBlock);
+  block->size = blockSizeForType(memoryType);
+  block->memory = allocateDeviceMemory(block->size, memoryType, &block->mapped);
+  for(VkDeviceSize nodeSize = block->size; nodeSize >= MEMORY_MIN_BUDDY_SIZE; nodeSize /= 2) block->levelCount++;
+  block->freeLists.resize(block->levelCount);
+  block->freeLists[0].insert(0); // Whole block free
+  pool.blocks.push_back(std::move(block));
+  return pool.blocks.back().get();
+}
+
+// Deepest level (smallest node) still fitting the size. Node offsets are aligned to their size, which covers the alignment.
+static uint32_t buddyLevelFor(const MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment)
+{
+  VkDeviceSize needed = std::max(size, std::max(alignment, MEMORY_MIN_BUDDY_SIZE));
+  uint32_t level = 0;
+  while(level + 1 < block.levelCount && (block.size >> (level + 1)) >= needed) level++;
+  return level;
+}
+
+static bool buddyAllocate(MemoryBlock& block, uint32_t level, VkDeviceSize& offset)
+{
+  int freeLevel = static_cast<int>(level);
+  while(freeLevel >= 0 && block.freeLists[freeLevel].empty()) freeLevel--; // Smallest free node which is big enough
+  if(freeLevel < 0) return false;
+
+  offset = *block.freeLists[freeLevel].begin();
+  block.freeLists[freeLevel].erase(block.freeLists[freeLevel].begin());
+  for(uint32_t split = freeLevel + 1; split <= level; split++) // Split down, the upper halves become free buddies
+  {
+    block.freeLists[split].insert(offset + (block.size >> split));
+  }
+  block.allocatedLevels[offset] = level;
+  block.usedBytes += block.size >> level;
+  return true;
+}
+
+static void buddyFree(MemoryBlock& block, VkDeviceSize offset)
+{
+  auto allocated = block.allocatedLevels.find(offset);
+  assert(allocated != block.allocatedLevels.end());
+  uint32_t level = allocated->second;
+  block.allocatedLevels.erase(allocated);
+  block.usedBytes -= block.size >> level;
+
+  while(level > 0) // Merge with the buddy as long as it's free too
+  {
+    VkDeviceSize buddy = offset ^ (block.size >> level);
+    if(block.freeLists[level].erase(buddy) == 0) break;
+    offset = std::min(offset, buddy);
+    level--;
+  }
+  block.freeLists[level].insert(offset);
+}
+
+Allocation allocateMemory(const VkMemoryRequirements& requirements, MemoryUsage usage, uint32_t kind, bool dedicated = false)
+{
+  std::lock_guard<std::mutex> lock(g_memoryMutex);
+
+  Allocation allocation;
+  allocation.memoryType = findMemoryTypeForUsage(requirements.memoryTypeBits, usage);
+  allocation.size = requirements.size;
+  allocation.kind = kind;
+
+  if(dedicated || requirements.size > blockSizeForType(allocation.memoryType) / 2) // Big resources get their own memory
+  {
+    allocation.memory = allocateDeviceMemory(requirements.size, allocation.memoryType, &allocation.mapped);
+    g_dedicatedBytes[allocation.memoryType] += requirements.size;
+    g_dedicatedCounts[allocation.memoryType]++;
+    return allocation;
+  }
+
+  MemoryPool& pool = g_memoryPools[allocation.memoryType * 2 + kind];
+  for(auto& block : pool.blocks)
+  {
+    if(buddyAllocate(*block, buddyLevelFor(*block, requirements.size, requirements.alignment), allocation.offset))
+    {
+      allocation.block = block.get();
+      break;
+    }
+  }
+  if(allocation.block == nullptr) // All blocks full (or fragmented): new block
+  {
+    MemoryBlock* block = createMemoryBlock(pool, allocation.memoryType);
+    buddyAllocate(*block, buddyLevelFor(*block, requirements.size, requirements.alignment), allocation.offset);
+    allocation.block = block;
+  }
+  allocation.memory = allocation.block->memory;
+  if(allocation.block->mapped) allocation.mapped = static_cast<char*>(allocation.block->mapped) + allocation.offset;
+  return allocation;
+}
+
+void freeMemory(Allocation& allocation)
+{
+  if(allocation.memory == VK_NULL_HANDLE) return;
+  std::lock_guard<std::mutex> lock(g_memoryMutex);
+
+  if(allocation.block == nullptr)
+  {
+    freeDeviceMemory(allocation.memory);
+    g_dedicatedBytes[allocation.memoryType] -= allocation.size;
+    g_dedicatedCounts[allocation.memoryType]--;
+  } else
+  {
+    buddyFree(*allocation.block, allocation.offset);
+    // Empty blocks are given back, except the last one of the pool (avoids allocate/free churn at the boundary)
+    MemoryPool& pool = g_memoryPools[allocation.memoryType * 2 + allocation.kind];
+    if(allocation.block->usedBytes == 0 && pool.blocks.size() > 1)
+    {
+      for(size_t i = 0; i < pool.blocks.size(); i++)
+      {
+        if(pool.blocks[i].get() != allocation.block) continue;
+        freeDeviceMemory(pool.blocks[i]->memory);
+        pool.blocks.erase(pool.blocks.begin() + i);
+        break;
+      }
+    }
+  }
+  allocation = Allocation();
+}
+
+// sharedFamilies: queue families using the buffer without ownership transfers (two or more: concurrent sharing)
+AllocatedBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage, const std::vector<uint32_t>& sharedFamilies = {})
+{
+  AllocatedBuffer allocated;
+  VkBufferCreateInfo bufferCreateInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+  bufferCreateInfo.size = size;
+  bufferCreateInfo.usage = usage;
+  bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if(sharedFamilies.size() > 1)
+  {
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharedFamilies.size());
+    bufferCreateInfo.pQueueFamilyIndices = sharedFamilies.data();
+  }
+  CHECK_VULKAN_ERRORS( vkCreateBuffer(g_device, &bufferCreateInfo, g_allocator, &allocated.buffer) );
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(g_device, allocated.buffer, &requirements);
+  allocated.allocation = allocateMemory(requirements, memoryUsage, MEMORY_KIND_LINEAR);
+  CHECK_VULKAN_ERRORS( vkBindBufferMemory(g_device, allocated.buffer, allocated.allocation.memory, allocated.allocation.offset) );
+  return allocated;
+}
+
+void destroyBuffer(AllocatedBuffer& buffer)
+{
+  if(buffer.buffer != VK_NULL_HANDLE) vkDestroyBuffer(g_device, buffer.buffer, g_allocator);
+  freeMemory(buffer.allocation);
+  buffer.buffer = VK_NULL_HANDLE;
+}
+
+// dedicated: force own VkDeviceMemory (render targets which may be resized / aliased later)
+AllocatedImage createImage(const VkImageCreateInfo& imageCreateInfo, MemoryUsage memoryUsage, bool dedicated = false)
+{
+  AllocatedImage allocated;
+  CHECK_VULKAN_ERRORS( vkCreateImage(g_device, &imageCreateInfo, g_allocator, &allocated.image) );
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(g_device, allocated.image, &requirements);
+  uint32_t kind = (imageCreateInfo.tiling == VK_IMAGE_TILING_OPTIMAL) ? MEMORY_KIND_OPTIMAL : MEMORY_KIND_LINEAR;
+  allocated.allocation = allocateMemory(requirements, memoryUsage, kind, dedicated);
+  CHECK_VULKAN_ERRORS( vkBindImageMemory(g_device, allocated.image, allocated.allocation.memory, allocated.allocation.offset) );
+  return allocated;
+}
+
+void destroyImage(AllocatedImage& image)
+{
+  if(image.image != VK_NULL_HANDLE) vkDestroyImage(g_device, image.image, g_allocator);
+  freeMemory(image.allocation);
+  image.image = VK_NULL_HANDLE;
+}
+
+std::vector<HeapStats> getMemoryStats()
+{
+  std::lock_guard<std::mutex> lock(g_memoryMutex);
+  std::vector<HeapStats> stats(g_memoryProperties.memoryHeapCount);
+
+  for(uint32_t heap = 0; heap < g_memoryProperties.memoryHeapCount; heap++) stats[heap].heapSize = g_memoryProperties.memoryHeaps[heap].size;
+  for(uint32_t type = 0; type < g_memoryProperties.memoryTypeCount; type++)
+  {
+    HeapStats& heap = stats[g_memoryProperties.memoryTypes[type].heapIndex];
+    heap.dedicatedBytes += g_dedicatedBytes[type];
+    heap.dedicatedCount += g_dedicatedCounts[type];
+    heap.allocationCount += g_dedicatedCounts[type];
+
+    for(uint32_t kind = 0; kind < 2; kind++)
+    {
+      for(const auto& block : g_memoryPools[type * 2 + kind].blocks)
+      {
+        heap.blockCount++;
+        heap.blockBytes += block->size;
+        heap.usedBytes += block->usedBytes;
+        heap.allocationCount += static_cast<uint32_t>(block->allocatedLevels.size());
+        for(uint32_t level = 0; level < block->levelCount; level++)
+        {
+          if(block->freeLists[level].empty()) continue;
+          heap.freeRegionCount += static_cast<uint32_t>(block->freeLists[level].size());
+          heap.largestFreeRegion = std::max(heap.largestFreeRegion, block->size >> level);
+        }
+      }
+    }
+  }
+  for(uint32_t heap = 0; heap < g_memoryProperties.memoryHeapCount; heap++)
+  {
+    VkDeviceSize free = stats[heap].blockBytes - stats[heap].usedBytes;
+    if(free > 0) stats[heap].fragmentation = 1.0f - static_cast<float>(stats[heap].largestFreeRegion) / static_cast<float>(free);
+  }
+  return stats;
+}
+
+// Current budgets of every heap. Thread safe, cheap enough to ask before big allocations.
+std::vector<HeapBudget> getMemoryBudgets()
+{
+  std::vector<HeapBudget> budgets(g_memoryProperties.memoryHeapCount);
+  if(g_getMemoryProperties2 != nullptr)
+  {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+    VkPhysicalDeviceMemoryProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2 };
+    properties.pNext = &budgetProperties;
+    g_getMemoryProperties2(g_physicalDevice, &properties);
+    for(uint32_t heap = 0; heap < g_memoryProperties.memoryHeapCount; heap++)
+    {
+      budgets[heap].budget = budgetProperties.heapBudget[heap];
+      budgets[heap].usage = budgetProperties.heapUsage[heap];
+    }
+    return budgets;
+  }
+  std::vector<HeapStats> stats = getMemoryStats();
+  for(uint32_t heap = 0; heap < g_memoryProperties.memoryHeapCount; heap++)
+  {
+    budgets[heap].budget = stats[heap].heapSize / 10 * 8;
+    budgets[heap].usage = stats[heap].blockBytes + stats[heap].dedicatedBytes;
+  }
+  return budgets;
+}
+
+// Bytes GpuOnly resources can still take from their heap within the budget.
+VkDeviceSize deviceLocalBudgetLeft()
+{
+  uint32_t heap = g_memoryProperties.memoryTypes[findMemoryType(~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)].heapIndex;
+  HeapBudget budget = getMemoryBudgets()[heap];
+  return budget.usage < budget.budget ? budget.budget - budget.usage : 0;
+}
+
+// Every MEMORY_BUDGET_INTERVAL frames: peak usage per heap, and a warning when a heap goes over its budget.
+void updateMemoryBudget()
+{
+  std::vector<HeapBudget> budgets = getMemoryBudgets();
+  for(uint32_t heap = 0; heap < budgets.size(); heap++)
+  {
+    HeapBudget& sample = g_heapBudgets[heap];
+    sample.budget = budgets[heap].budget;
+    sample.usage = budgets[heap].usage;
+    sample.peakUsage = std::max(sample.peakUsage, sample.usage);
+    if(sample.usage > sample.budget && !sample.overBudget) std::cerr << "Heap " << heap << " over its budget: " << (sample.usage >> 20) << " / " << (sample.budget >> 20) << " MiB" << std::endl;
+    sample.overBudget = sample.usage > sample.budget;
+  }
+}
+
+void printMemoryStats()
+{
+  std::vector<HeapStats> stats = getMemoryStats();
+  for(size_t heap = 0; heap < stats.size(); heap++)
+  {
+    const HeapStats& s = stats[heap];
+    if(s.blockCount == 0 && s.dedicatedCount == 0) continue;
+    std::cout << "Heap " << heap << " (" << (s.heapSize >> 20) << " MiB): " << s.blockCount << " blocks " << (s.blockBytes >> 10) << " KiB, used " << (s.usedBytes >> 10)
+      << " KiB, " << s.dedicatedCount << " dedicated " << (s.dedicatedBytes >> 10) << " KiB, " << s.allocationCount << " allocations, "
+      << s.freeRegionCount << " free regions (largest " << (s.largestFreeRegion >> 10) << " KiB), fragmentation " << s.fragmentation << std::endl;
+  }
+  updateMemoryBudget();
+  for(size_t heap = 0; heap < g_heapBudgets.size(); heap++)
+  {
+    const HeapBudget& budget = g_heapBudgets[heap];
+    if(budget.peakUsage == 0) continue;
+    std::cout << "Heap " << heap << " budget" << (g_memoryBudget ? "" : " (estimated)") << ": usage " << (budget.usage >> 20) << " MiB, peak " << (budget.peakUsage >> 20) << " MiB of " << (budget.budget >> 20) << " MiB" << std::endl;
+  }
+  std::cout << "Device memory objects: " << g_deviceMemoryCount << " / " << g_properties.limits.maxMemoryAllocationCount << std::endl;
+}
+
+void destroyMemoryAllocator()
+{
+  for(MemoryPool& pool : g_memoryPools)
+  {
+    for(auto& block : pool.blocks)
+    {
+      if(!block->allocatedLevels.empty()) std::cerr << "Memory block destroyed with " << block->allocatedLevels.size() << " live allocations!" << std::endl;
+      freeDeviceMemory(block->memory);
+    }
+  }
+  g_memoryPools.clear();
+}
+
+// Per-frame transient data (uniforms, dynamic vertices, ...): a mapped ring buffer. Positions only grow (virtual positions), the
+// real offset is position % capacity. A frame slot's data is released all at once when the slot comes around again.
+struct TransientAllocation
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  void* mapped = nullptr;
+};
+
+struct TransientRing
+{
+  AllocatedBuffer buffer;
+  VkDeviceSize capacity = 0;
+  uint64_t head = 0; // Next free position
+  uint64_t tail = 0; // Oldest position still possibly used by the GPU
+  std::vector<uint64_t> frameEnds; // Head at the end of each frame slot
+};
+
+TransientRing g_transientRing;
+
+void createTransientRing(VkDeviceSize capacity, uint32_t frameSlots)
+{
+  VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+  g_transientRing.buffer = createBuffer(capacity, usage, MemoryUsage::CpuToGpu);
+  g_transientRing.capacity = capacity;
+  g_transientRing.head = 0;
+  g_transientRing.tail = 0;
+  g_transientRing.frameEnds.assign(frameSlots, 0);
+}
+
+void destroyTransientRing()
+{
+  destroyBuffer(g_transientRing.buffer);
+  g_transientRing = TransientRing();
+}
+
+// Call after the frame slot's fence has been waited: everything the slot allocated last time is free again.
+void beginTransientFrame(uint32_t slot)
+{
+  g_transientRing.tail = std::max(g_transientRing.tail, g_transientRing.frameEnds[slot]);
+}
+
+void endTransientFrame(uint32_t slot)
+{
+  g_transientRing.frameEnds[slot] = g_transientRing.head;
+}
+
+TransientAllocation allocateTransient(VkDeviceSize size, VkDeviceSize alignment = 256)
+{
+  TransientRing& ring = g_transientRing;
+  uint64_t position = (ring.head + alignment - 1) & ~(alignment - 1);
+  if((position % ring.capacity) + size > ring.capacity) position = (position / ring.capacity + 1) * ring.capacity; // Don't wrap inside an allocation
+  if(position + size - ring.tail > ring.capacity) throw std::runtime_error("Transient ring buffer full, frames use more than its capacity!");
+
+  ring.head = position + size;
+  TransientAllocation allocation;
+  allocation.buffer = ring.buffer.buffer;
+  allocation.offset = position % ring.capacity;
+  allocation.mapped = static_cast<char*>(ring.buffer.allocation.mapped) + allocation.offset;
+  return allocation;
+}
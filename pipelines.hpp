@@ -0,0 +1,202 @@
+#pragma once
+#include "common.hpp"
+#include "bench.hpp"
+#include "threads.hpp"
+#include "shaders.hpp"
+#include "profiler.hpp"
+
+#include <fstream>
+#include <functional>
+
+// Pipeline cache: driver compiled pipelines are saved at exit and loaded at the next start, so a warm start skips the
+// shader compilation. Data from another driver or GPU is useless (or worse), so the header is checked against g_properties
+// first. Pipelines are compiled in parallel on the worker threads (the cache itself is internally synchronized).
+// Builds are kept: with hot reload a pipeline is rebuilt when one of its shader files changes.
+
+const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+const uint32_t PIPELINE_CACHE_HEADER_SIZE = 16 + VK_UUID_SIZE; // VkPipelineCacheHeaderVersionOne
+const uint32_t HOT_RELOAD_INTERVAL = 30; // Frames between shader file checks
+
+struct PipelineBuild
+{
+  std::string name;
+  std::vector<std::string> shaderFiles; // .spv files the build loads (hot reload rebuilds when one changes)
+  std::function<VkPipeline(VkPipelineCache)> build; // Creates the pipeline using the cache
+  VkPipeline* pipeline; // Where the result goes
+  bool compiled = false;
+};
+
+// Replaced pipelines may still be used by frames in flight, like retired swap chains.
+struct RetiredPipeline
+{
+  VkPipeline pipeline;
+  uint64_t usedUntilFrame; // Frames numbered below this may still use it
+};
+
+VkPipelineCache g_pipelineCache = VK_NULL_HANDLE;
+bool g_pipelineCacheWarm = false; // A valid cache file was loaded
+std::vector<PipelineBuild> g_pipelineBuilds;
+std::vector<RetiredPipeline> g_retiredPipelines;
+
+static uint32_t readUint32(const std::vector<char>& data, size_t offset)
+{
+  uint32_t value;
+  memcpy(&value, data.data() + offset, sizeof(value)); // Header fields are in host byte order
+  return value;
+}
+
+static bool pipelineCacheIsValid(const std::vector<char>& data)
+{
+  if(data.size() < PIPELINE_CACHE_HEADER_SIZE) return false;
+  if(readUint32(data, 0) < PIPELINE_CACHE_HEADER_SIZE) return false; // headerSize
+  if(readUint32(data, 4) != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) return false;
+  if(readUint32(data, 8) != g_properties.vendorID) return false;
+  if(readUint32(data, 12) != g_properties.deviceID) return false;
+  return memcmp(data.data() + 16, g_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0; // Changes with driver updates
+}
+
+void createPipelineCache()
+{
+  PROFILE_FUNCTION();
+  std::vector<char> data;
+  std::ifstream file(PIPELINE_CACHE_FILE, std::ios::binary | std::ios::ate);
+  if(file.is_open())
+  {
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+    if(!pipelineCacheIsValid(data))
+    {
+      std::cout << "Pipeline cache: " << PIPELINE_CACHE_FILE << " is from another device or driver, ignored" << std::endl;
+      data.clear();
+    }
+  }
+  g_pipelineCacheWarm = !data.empty();
+
+  VkPipelineCacheCreateInfo pipelineCacheCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+  pipelineCacheCreateInfo.initialDataSize = data.size();
+  pipelineCacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+  CHECK_VULKAN_ERRORS( vkCreatePipelineCache(g_device, &pipelineCacheCreateInfo, g_allocator, &g_pipelineCache) );
+}
+
+// Written to a temporary file first: a crash while saving must not leave a truncated cache behind.
+void savePipelineCache()
+{
+  size_t size = 0;
+  CHECK_VULKAN_ERRORS( vkGetPipelineCacheData(g_device, g_pipelineCache, &size, nullptr) );
+  std::vector<char> data(size);
+  CHECK_VULKAN_ERRORS( vkGetPipelineCacheData(g_device, g_pipelineCache, &size, data.data()) );
+
+  std::string temporaryFile = std::string(PIPELINE_CACHE_FILE) + ".tmp";
+  {
+    std::ofstream file(temporaryFile, std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) return; // Read-only working directory: just no warm start next time
+    file.write(data.data(), size);
+    if(!file) return;
+  }
+  std::remove(PIPELINE_CACHE_FILE); // Windows rename doesn't replace
+  std::rename(temporaryFile.c_str(), PIPELINE_CACHE_FILE);
+}
+
+void destroyPipelineCache()
+{
+  savePipelineCache();
+  vkDestroyPipelineCache(g_device, g_pipelineCache, g_allocator);
+  g_pipelineCache = VK_NULL_HANDLE;
+}
+
+void addPipeline(const std::string& name, const std::vector<std::string>& shaderFiles, std::function<VkPipeline(VkPipelineCache)> build, VkPipeline* pipeline)
+{
+  g_pipelineBuilds.push_back({ name, shaderFiles, build, pipeline });
+}
+
+// Compiles every added pipeline not compiled yet on all threads, reports the time (cold: no cache, warm: cache loaded).
+// Returns the amount of failed builds (they stay not compiled, their VkPipeline untouched).
+uint32_t compilePipelines()
+{
+  std::vector<PipelineBuild*> pending;
+  for(PipelineBuild& pipelineBuild : g_pipelineBuilds) if(!pipelineBuild.compiled) pending.push_back(&pipelineBuild);
+  if(pending.empty()) return 0;
+
+  std::atomic<uint32_t> failures(0);
+  BenchClock::time_point start = BenchClock::now();
+  parallelFor(static_cast<uint32_t>(pending.size()), [&](uint32_t item, uint32_t)
+  {
+    PROFILE_ZONE("compile pipeline");
+    try // Exceptions must not leave a worker thread
+    {
+      *pending[item]->pipeline = pending[item]->build(g_pipelineCache);
+      pending[item]->compiled = true;
+    } catch(const std::runtime_error& error)
+    {
+      std::cerr << "Pipeline " << pending[item]->name << ": " << error.what() << std::endl;
+      failures++;
+    }
+  });
+  double milliseconds = millisecondsBetween(start, BenchClock::now());
+  std::cout << "Pipelines: " << pending.size() << " compiled in " << milliseconds << " ms on " << threadCount() << " threads (" << (g_pipelineCacheWarm ? "warm" : "cold") << " start)" << std::endl;
+  return failures;
+}
+
+// Hot reload: rebuilds the pipelines using any of the changed files. Replaced pipelines are retired, not waited for;
+// when a rebuild fails (broken shader) the old pipeline simply stays.
+void reloadPipelines(const std::vector<std::string>& changedFiles, uint64_t submittedFrames)
+{
+  std::vector<std::pair<PipelineBuild*, VkPipeline>> rebuilt;
+  for(PipelineBuild& pipelineBuild : g_pipelineBuilds)
+  {
+    bool affected = false;
+    for(const std::string& file : pipelineBuild.shaderFiles) affected |= (std::find(changedFiles.begin(), changedFiles.end(), file) != changedFiles.end());
+    if(!affected || !pipelineBuild.compiled) continue;
+    rebuilt.push_back({ &pipelineBuild, *pipelineBuild.pipeline });
+    pipelineBuild.compiled = false;
+  }
+  compilePipelines();
+
+  for(auto& [pipelineBuild, oldPipeline] : rebuilt)
+  {
+    if(pipelineBuild->compiled)
+    {
+      std::cout << "Hot reload: " << pipelineBuild->name << std::endl;
+      g_retiredPipelines.push_back({ oldPipeline, submittedFrames });
+    } else
+    {
+      *pipelineBuild->pipeline = oldPipeline;
+      pipelineBuild->compiled = true;
+    }
+  }
+  destroyUnusedShaderModules();
+}
+
+// Called every frame: looks for changed shader files every HOT_RELOAD_INTERVAL frames when hot reload is on.
+void checkHotReload(uint64_t submittedFrames)
+{
+  if(!g_hotReload || submittedFrames % HOT_RELOAD_INTERVAL != 0) return;
+  std::vector<std::string> changedFiles = findChangedShaderFiles();
+  if(!changedFiles.empty()) reloadPipelines(changedFiles, submittedFrames);
+}
+
+// completedFrames: every frame numbered below it has finished on the GPU.
+void destroyRetiredPipelines(uint64_t completedFrames)
+{
+  for(size_t i = 0; i < g_retiredPipelines.size();)
+  {
+    if(g_retiredPipelines[i].usedUntilFrame <= completedFrames)
+    {
+      vkDestroyPipeline(g_device, g_retiredPipelines[i].pipeline, g_allocator);
+      g_retiredPipelines.erase(g_retiredPipelines.begin() + i);
+    } else i++;
+  }
+}
+
+void destroyPipelines()
+{
+  destroyRetiredPipelines(UINT64_MAX);
+  for(PipelineBuild& pipelineBuild : g_pipelineBuilds)
+  {
+    if(pipelineBuild.compiled) vkDestroyPipeline(g_device, *pipelineBuild.pipeline, g_allocator);
+    *pipelineBuild.pipeline = VK_NULL_HANDLE;
+  }
+  g_pipelineBuilds.clear();
+  destroyShaderModules();
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "common.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Present policy decides the present mode and the swap chain image count together, as both set the latency:
+// LatencyFirst    : IMMEDIATE > MAILBOX > FIFO_RELAXED > FIFO, minimum image count (nothing waits queued up, may tear)
+// ThroughputFirst : MAILBOX > IMMEDIATE > FIFO, minimum + 1 images ("triple buffering", the GPU never waits for the display)
+// PowerSaving     : FIFO, minimum + 1 images (VSync: no frames rendered which are never shown)
+// Switching (F1/F2/F3) recreates the swap chain from the old one, no restart needed.
+
+enum class PresentPolicy { LatencyFirst = 0, ThroughputFirst = 1, PowerSaving = 2 };
+const uint32_t PRESENT_POLICY_COUNT = 3;
+
+PresentPolicy g_presentPolicy = PresentPolicy::PowerSaving; // TEMPLATE_PRESENT_POLICY: 0 latency, 1 throughput, 2 power saving
+bool g_presentPolicyChanged = false; // Swap chain is recreated before the next frame
+
+// Input-to-present latency: arrival of the oldest input not yet presented (input.hpp) -> vkQueuePresentKHR returned.
+uint64_t g_pendingInputTimestamp = 0; // SDL_GetPerformanceCounter() ticks
+bool g_inputPending = false;
+std::vector<double> g_presentLatencies[PRESENT_POLICY_COUNT]; // Milliseconds, per policy
+
+static const char* presentPolicyName(PresentPolicy policy)
+{
+  switch(policy)
+  {
+    case PresentPolicy::LatencyFirst: return "latency-first";
+    case PresentPolicy::ThroughputFirst: return "throughput-first";
+    case PresentPolicy::PowerSaving: return "power-saving";
+  }
+  return "unknown";
+}
+
+static const char* presentModeName(VkPresentModeKHR presentMode)
+{
+  switch(presentMode)
+  {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "IMMEDIATE";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "MAILBOX";
+    case VK_PRESENT_MODE_FIFO_KHR: return "FIFO";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+    default: return "other";
+  }
+}
+
+// First available mode in the policy's order of preference. FIFO is always supported, thus the backup for all of them.
+VkPresentModeKHR choosePolicyPresentMode(PresentPolicy policy, const std::vector<VkPresentModeKHR>& availablePresentModes)
+{
+  std::vector<VkPresentModeKHR> preferred;
+  switch(policy)
+  {
+    case PresentPolicy::LatencyFirst: preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR }; break;
+    case PresentPolicy::ThroughputFirst: preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR }; break;
+    case PresentPolicy::PowerSaving: break;
+  }
+  for(VkPresentModeKHR mode : preferred)
+  {
+    if(std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) != availablePresentModes.end()) return mode;
+  }
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+uint32_t choosePolicyImageCount(PresentPolicy policy, VkPresentModeKHR presentMode, const VkSurfaceCapabilitiesKHR& capabilities)
+{
+  uint32_t imageCount = capabilities.minImageCount + 1;
+  // Fewest images when latency matters, but MAILBOX needs the extra one to always have a free image to render to.
+  if(policy == PresentPolicy::LatencyFirst && presentMode != VK_PRESENT_MODE_MAILBOX_KHR) imageCount = capabilities.minImageCount;
+  // ImageCount should not exceed max image amount (maxImageCount = 0 means a max image amount is not set!)
+  if(capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) imageCount = capabilities.maxImageCount;
+  return imageCount;
+}
+
+static void reportPresentLatency(PresentPolicy policy)
+{
+  std::vector<double> samples = g_presentLatencies[static_cast<int>(policy)];
+  if(samples.empty()) return;
+  std::sort(samples.begin(), samples.end());
+
+  double sum = 0.0;
+  for(double sample : samples) sum += sample;
+  size_t p99Index = static_cast<size_t>(std::ceil(0.99 * samples.size())) - 1;
+
+  std::cout << "Input-to-present latency, " << presentPolicyName(policy) << " (ms): min " << samples.front() << " | avg " << sum / samples.size() << " | p99 " << samples[p99Index] << " | max " << samples.back() << " | samples " << samples.size() << std::endl;
+}
+
+void reportPresentLatencies()
+{
+  for(uint32_t i = 0; i < PRESENT_POLICY_COUNT; i++) reportPresentLatency(static_cast<PresentPolicy>(i));
+}
+
+void setPresentPolicy(PresentPolicy policy)
+{
+  if(policy == g_presentPolicy) return;
+  g_presentPolicy = policy;
+  g_presentPolicyChanged = true;
+  g_inputPending = false; // Don't blame the new policy for input which arrived before the switch
+}
+
+// Called for input events: the oldest input waiting for a present is the one measured.
+void notePendingInput(uint64_t eventTimestamp)
+{
+  if(g_inputPending) return;
+  g_pendingInputTimestamp = eventTimestamp;
+  g_inputPending = true;
+}
+
+// Called after a successful vkQueuePresentKHR of a frame which consumed the pending input.
+void recordPresentLatency()
+{
+  if(!g_inputPending) return;
+  double ticksPerMs = static_cast<double>(SDL_GetPerformanceFrequency()) / 1000.0;
+  g_presentLatencies[static_cast<int>(g_presentPolicy)].push_back((SDL_GetPerformanceCounter() - g_pendingInputTimestamp) / ticksPerMs); // Same clock as the input arrival
+  g_inputPending = false;
+}
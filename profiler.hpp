@@ -0,0 +1,119 @@
+#pragma once
+#include "common.hpp"
+#include "trace.hpp"
+
+#include <atomic>
+#include <memory>
+
+// CPU profiler: PROFILE_ZONE("name") times the rest of the enclosing scope, PROFILE_FUNCTION() the whole function.
+// Zones are recorded only with TEMPLATE_TRACE=1 and end up in the Chrome trace next to the GPU passes. Every thread writes
+// into its own buffer (chunks of events published with an atomic count), so recording never takes a lock.
+// Building with "make lin PROFILER=0" (TEMPLATE_PROFILER=0) compiles every zone out completely.
+
+#ifndef TEMPLATE_PROFILER
+#define TEMPLATE_PROFILER 1
+#endif
+
+#if TEMPLATE_PROFILER
+
+const uint32_t PROFILER_CHUNK_EVENTS = 4096;
+
+struct CpuZoneEvent
+{
+  const char* name; // Static string
+  TraceClock::time_point start;
+  TraceClock::time_point end;
+};
+
+struct ProfilerChunk
+{
+  CpuZoneEvent events[PROFILER_CHUNK_EVENTS];
+  std::atomic<uint32_t> count{0}; // Events published to readers
+  std::atomic<ProfilerChunk*> next{nullptr};
+};
+
+struct ProfilerThreadBuffer
+{
+  uint32_t track = 0;
+  ProfilerChunk* first = nullptr;
+  ProfilerChunk* last = nullptr; // Only the owning thread writes
+  std::vector<std::unique_ptr<ProfilerChunk>> chunks; // Ownership, touched only by the owning thread
+};
+
+std::vector<std::unique_ptr<ProfilerThreadBuffer>> g_profilerBuffers; // Live until exit: the trace is read from them
+std::mutex g_profilerBuffersMutex; // Registration only, once per thread
+thread_local ProfilerThreadBuffer* t_profilerBuffer = nullptr;
+
+static ProfilerThreadBuffer* registerProfilerThread()
+{
+  std::lock_guard<std::mutex> lock(g_profilerBuffersMutex);
+  g_profilerBuffers.push_back(std::make_unique<ProfilerThreadBuffer>());
+  ProfilerThreadBuffer* buffer = g_profilerBuffers.back().get();
+  buffer->track = static_cast<uint32_t>(g_profilerBuffers.size()) - 1; // The first thread to profile is the main thread (init)
+  buffer->chunks.push_back(std::make_unique<ProfilerChunk>());
+  buffer->first = buffer->last = buffer->chunks.back().get();
+  nameTraceTrack(buffer->track, buffer->track == 0 ? "CPU main thread" : "CPU thread " + std::to_string(buffer->track));
+  return buffer;
+}
+
+static void recordCpuZone(const char* name, TraceClock::time_point start, TraceClock::time_point end)
+{
+  if(t_profilerBuffer == nullptr) t_profilerBuffer = registerProfilerThread();
+  ProfilerThreadBuffer& buffer = *t_profilerBuffer;
+  uint32_t count = buffer.last->count.load(std::memory_order_relaxed);
+  if(count == PROFILER_CHUNK_EVENTS) // Full: chain a new chunk, the old one stays readable
+  {
+    buffer.chunks.push_back(std::make_unique<ProfilerChunk>());
+    buffer.last->next.store(buffer.chunks.back().get(), std::memory_order_release);
+    buffer.last = buffer.chunks.back().get();
+    count = 0;
+  }
+  buffer.last->events[count] = { name, start, end };
+  buffer.last->count.store(count + 1, std::memory_order_release); // Publish after the event is written
+}
+
+struct ScopedCpuZone
+{
+  const char* name;
+  TraceClock::time_point start;
+  explicit ScopedCpuZone(const char* name) : name(name)
+  {
+    if(g_traceEnabled) start = TraceClock::now();
+  }
+  ~ScopedCpuZone()
+  {
+    if(g_traceEnabled) recordCpuZone(name, start, TraceClock::now());
+  }
+};
+
+// Copies everything recorded into the trace: once, right before writeTrace(). Safe while other threads keep recording.
+void collectCpuZones()
+{
+  std::lock_guard<std::mutex> lock(g_profilerBuffersMutex);
+  for(std::unique_ptr<ProfilerThreadBuffer>& buffer : g_profilerBuffers)
+  {
+    for(ProfilerChunk* chunk = buffer->first; chunk != nullptr; chunk = chunk->next.load(std::memory_order_acquire))
+    {
+      uint32_t count = chunk->count.load(std::memory_order_acquire);
+      for(uint32_t i = 0; i < count; i++)
+      {
+        const CpuZoneEvent& event = chunk->events[i];
+        addTraceEvent({ event.name, buffer->track, traceMicroseconds(event.start), std::chrono::duration<double, std::micro>(event.end - event.start).count() });
+      }
+    }
+  }
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ScopedCpuZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+
+#else
+
+void collectCpuZones() {}
+
+#define PROFILE_ZONE(name) do {} while(0)
+#define PROFILE_FUNCTION() do {} while(0)
+
+#endif
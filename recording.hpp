@@ -0,0 +1,126 @@
+#pragma once
+#include "common.hpp"
+#include "threads.hpp"
+#include "profiler.hpp"
+#include "bindless.hpp"
+
+#include <functional>
+
+// Multi-threaded command recording. Command pools are not thread-safe, so every thread has its own pool per frame slot.
+// A slot's pools are reset as a whole (vkResetCommandPool, cheaper than resetting buffers one by one) once the slot's fence
+// has signaled, and their secondary command buffers are reused. Draw work is split into contiguous chunks, one secondary
+// command buffer per chunk, each a job; the render thread executes them in chunk order, so the result doesn't depend on
+// which thread recorded what.
+
+const uint32_t MIN_DRAWS_PER_CHUNK = 64; // Fewer draws are not worth a thread hop
+
+struct ThreadCommandPool
+{
+  VkCommandPool pool = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> secondaries; // Allocated on demand, reused after every reset
+  uint32_t used = 0;
+};
+
+std::vector<std::vector<ThreadCommandPool>> g_threadCommandPools; // [frame slot][thread]
+std::vector<std::function<void(VkCommandBuffer, uint32_t)>> g_drawWork; // (command buffer, frame slot): one item per draw (or small group)
+
+void createThreadCommandPools(uint32_t frameSlots, uint32_t threads)
+{
+  QueueFamilyIndices indices = findQueueFamilies(g_physicalDevice);
+  VkCommandPoolCreateInfo commandPoolCreateInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+  commandPoolCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
+  commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // No per-buffer reset: the whole pool is reset
+
+  g_threadCommandPools.assign(frameSlots, std::vector<ThreadCommandPool>(threads));
+  for(std::vector<ThreadCommandPool>& slotPools : g_threadCommandPools)
+  {
+    for(ThreadCommandPool& threadPool : slotPools) CHECK_VULKAN_ERRORS( vkCreateCommandPool(g_device, &commandPoolCreateInfo, g_allocator, &threadPool.pool) );
+  }
+}
+
+void destroyThreadCommandPools()
+{
+  for(std::vector<ThreadCommandPool>& slotPools : g_threadCommandPools)
+  {
+    for(ThreadCommandPool& threadPool : slotPools) vkDestroyCommandPool(g_device, threadPool.pool, g_allocator);
+  }
+  g_threadCommandPools.clear();
+}
+
+// Only after the slot's fence has been waited on: its command buffers are not in use by the GPU anymore.
+void resetThreadCommandPools(uint32_t slot)
+{
+  for(ThreadCommandPool& threadPool : g_threadCommandPools[slot])
+  {
+    if(threadPool.used == 0) continue; // Nothing recorded since the last reset
+    CHECK_VULKAN_ERRORS( vkResetCommandPool(g_device, threadPool.pool, 0) );
+    threadPool.used = 0;
+  }
+}
+
+// Next free secondary command buffer of the calling thread's pool (thread = t_threadIndex).
+static VkCommandBuffer nextSecondaryCommandBuffer(uint32_t slot, uint32_t thread)
+{
+  ThreadCommandPool& threadPool = g_threadCommandPools[slot][thread];
+  if(threadPool.used == threadPool.secondaries.size())
+  {
+    VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+    allocateInfo.commandPool = threadPool.pool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    CHECK_VULKAN_ERRORS( vkAllocateCommandBuffers(g_device, &allocateInfo, &commandBuffer) );
+    threadPool.secondaries.push_back(commandBuffer);
+  }
+  return threadPool.secondaries[threadPool.used++];
+}
+
+void addDrawWork(std::function<void(VkCommandBuffer, uint32_t)> record)
+{
+  g_drawWork.push_back(record);
+}
+
+// Draw work being recorded: started before the primary command buffer gets to the render pass (startDrawWork()), so the
+// secondary command buffers are recorded by the workers while the render thread records the passes before it.
+struct DrawWorkRecording
+{
+  JobCounter jobs;
+  VkCommandBufferInheritanceInfo inheritance = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+  std::vector<VkCommandBuffer> chunkBuffers;
+};
+
+// Queues the recording of g_drawWork into secondary command buffers, one job per chunk.
+// inheritance: render pass / subpass / framebuffer when executed inside a render pass, renderPass VK_NULL_HANDLE outside of one.
+void startDrawWork(DrawWorkRecording& recording, uint32_t slot, const VkCommandBufferInheritanceInfo& inheritance)
+{
+  recording.inheritance = inheritance;
+  uint32_t drawCount = static_cast<uint32_t>(g_drawWork.size());
+  uint32_t chunkCount = drawCount == 0 ? 0 : std::min(threadCount(), (drawCount + MIN_DRAWS_PER_CHUNK - 1) / MIN_DRAWS_PER_CHUNK);
+  recording.chunkBuffers.assign(chunkCount, VK_NULL_HANDLE);
+
+  for(uint32_t chunk = 0; chunk < chunkCount; chunk++) runJob([&recording, slot, drawCount, chunkCount, chunk]
+  {
+    PROFILE_ZONE("record draw chunk");
+    VkCommandBuffer commandBuffer = nextSecondaryCommandBuffer(slot, t_threadIndex);
+    VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if(recording.inheritance.renderPass != VK_NULL_HANDLE) beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &recording.inheritance;
+    CHECK_VULKAN_ERRORS( vkBeginCommandBuffer(commandBuffer, &beginInfo) );
+    bindResourceHeap(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS); // Bindless: once per secondary, draws only push indices
+
+    uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(drawCount) * chunk / chunkCount);
+    uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(drawCount) * (chunk + 1) / chunkCount);
+    for(uint32_t i = first; i < last; i++) g_drawWork[i](commandBuffer, slot);
+
+    CHECK_VULKAN_ERRORS( vkEndCommandBuffer(commandBuffer) );
+    recording.chunkBuffers[chunk] = commandBuffer;
+  }, &recording.jobs);
+}
+
+// Waits for the chunks (helping with them) and executes them in primary, in chunk order.
+void executeDrawWork(VkCommandBuffer primary, DrawWorkRecording& recording)
+{
+  waitForJobs(recording.jobs);
+  if(!recording.chunkBuffers.empty()) vkCmdExecuteCommands(primary, static_cast<uint32_t>(recording.chunkBuffers.size()), recording.chunkBuffers.data());
+}
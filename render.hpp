@@ -0,0 +1,213 @@
+#pragma once
+#include "common.hpp"
+#include "pipelines.hpp"
+#include "recording.hpp"
+
+// The frame's render pass: clears the target image and runs the draw work (secondary command buffers from all threads)
+// into it, ending in the layout the image is used in next (present, or copy out when headless). Pipelines and framebuffers
+// are created against it; the render graph (rendergraph.hpp) begins a compatible one of its own, with the transitions done
+// by its barriers instead.
+// Framebuffers belong to the swap chain images, so they are recreated with the swap chain and retired like it.
+
+struct RetiredFramebuffers
+{
+  std::vector<VkFramebuffer> framebuffers;
+  std::vector<VkImageView> imageViews;
+  uint64_t usedUntilFrame; // Frames numbered below this may still use them
+};
+
+VkRenderPass g_renderPass = VK_NULL_HANDLE;
+std::vector<VkImageView> g_swapChainImageViews;
+std::vector<VkFramebuffer> g_framebuffers; // One per swap chain (or offscreen) image
+std::vector<RetiredFramebuffers> g_retiredFramebuffers;
+VkPipelineLayout g_trianglePipelineLayout = VK_NULL_HANDLE;
+VkPipeline g_trianglePipeline = VK_NULL_HANDLE;
+
+void createRenderPass()
+{
+  VkAttachmentDescription colorAttachment = {};
+  colorAttachment.format = g_swapChainImageFormat; // Same for every recreated swap chain of the surface
+  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Previous contents are not needed
+  colorAttachment.finalLayout = g_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // Offscreen: ready to be copied out
+
+  VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &colorReference;
+
+  VkSubpassDependency dependencies[2] = {};
+  // Stage waiting for imageAvailable: chains the layout transition (and the clear) after the acquire.
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].srcAccessMask = 0;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  // Headless: copies out of the image come after the rendering. Presentation is synchronized by the renderFinished semaphore.
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassCreateInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+  renderPassCreateInfo.attachmentCount = 1;
+  renderPassCreateInfo.pAttachments = &colorAttachment;
+  renderPassCreateInfo.subpassCount = 1;
+  renderPassCreateInfo.pSubpasses = &subpass;
+  renderPassCreateInfo.dependencyCount = g_headless ? 2 : 1;
+  renderPassCreateInfo.pDependencies = dependencies;
+  CHECK_VULKAN_ERRORS( vkCreateRenderPass(g_device, &renderPassCreateInfo, g_allocator, &g_renderPass) );
+}
+
+void createFramebuffers()
+{
+  g_swapChainImageViews.resize(g_swapChainImages.size());
+  g_framebuffers.resize(g_swapChainImages.size());
+  for(size_t i = 0; i < g_swapChainImages.size(); i++)
+  {
+    VkImageViewCreateInfo imageViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+    imageViewCreateInfo.image = g_swapChainImages[i];
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.format = g_swapChainImageFormat;
+    imageViewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    CHECK_VULKAN_ERRORS( vkCreateImageView(g_device, &imageViewCreateInfo, g_allocator, &g_swapChainImageViews[i]) );
+
+    VkFramebufferCreateInfo framebufferCreateInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+    framebufferCreateInfo.renderPass = g_renderPass;
+    framebufferCreateInfo.attachmentCount = 1;
+    framebufferCreateInfo.pAttachments = &g_swapChainImageViews[i];
+    framebufferCreateInfo.width = g_swapChainExtent.width;
+    framebufferCreateInfo.height = g_swapChainExtent.height;
+    framebufferCreateInfo.layers = 1;
+    CHECK_VULKAN_ERRORS( vkCreateFramebuffer(g_device, &framebufferCreateInfo, g_allocator, &g_framebuffers[i]) );
+  }
+}
+
+// After a swap chain recreation: the old framebuffers may still be used by frames in flight.
+void recreateFramebuffers(uint64_t submittedFrames)
+{
+  g_retiredFramebuffers.push_back({ g_framebuffers, g_swapChainImageViews, submittedFrames });
+  createFramebuffers();
+}
+
+// completedFrames: every frame numbered below it has finished on the GPU.
+void destroyRetiredFramebuffers(uint64_t completedFrames)
+{
+  for(size_t i = 0; i < g_retiredFramebuffers.size();)
+  {
+    if(g_retiredFramebuffers[i].usedUntilFrame <= completedFrames)
+    {
+      for(VkFramebuffer framebuffer : g_retiredFramebuffers[i].framebuffers) vkDestroyFramebuffer(g_device, framebuffer, g_allocator);
+      for(VkImageView imageView : g_retiredFramebuffers[i].imageViews) vkDestroyImageView(g_device, imageView, g_allocator);
+      g_retiredFramebuffers.erase(g_retiredFramebuffers.begin() + i);
+    } else i++;
+  }
+}
+
+static VkPipeline buildTrianglePipeline(VkPipelineCache pipelineCache)
+{
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = loadShaderModule("shaders/triangle.vert.spv");
+  stages[0].pName = "main";
+  stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = loadShaderModule("shaders/triangle.frag.spv");
+  stages[1].pName = "main";
+
+  VkPipelineVertexInputStateCreateInfo vertexInput = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO }; // Positions come from gl_VertexIndex
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkPipelineViewportStateCreateInfo viewportState = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+  viewportState.viewportCount = 1; // Dynamic: the pipeline survives swap chain resizes
+  viewportState.scissorCount = 1;
+  VkPipelineRasterizationStateCreateInfo rasterization = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+  rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterization.cullMode = VK_CULL_MODE_NONE;
+  rasterization.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterization.lineWidth = 1.0f;
+  VkPipelineMultisampleStateCreateInfo multisample = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+  multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  VkPipelineColorBlendAttachmentState blendAttachment = {};
+  blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  VkPipelineColorBlendStateCreateInfo colorBlend = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+  colorBlend.attachmentCount = 1;
+  colorBlend.pAttachments = &blendAttachment;
+  VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  VkPipelineDynamicStateCreateInfo dynamicState = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
+
+  VkGraphicsPipelineCreateInfo pipelineCreateInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+  pipelineCreateInfo.stageCount = 2;
+  pipelineCreateInfo.pStages = stages;
+  pipelineCreateInfo.pVertexInputState = &vertexInput;
+  pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+  pipelineCreateInfo.pViewportState = &viewportState;
+  pipelineCreateInfo.pRasterizationState = &rasterization;
+  pipelineCreateInfo.pMultisampleState = &multisample;
+  pipelineCreateInfo.pColorBlendState = &colorBlend;
+  pipelineCreateInfo.pDynamicState = &dynamicState;
+  pipelineCreateInfo.layout = g_trianglePipelineLayout;
+  pipelineCreateInfo.renderPass = g_renderPass;
+  pipelineCreateInfo.subpass = 0;
+
+  VkPipeline pipeline;
+  CHECK_VULKAN_ERRORS( vkCreateGraphicsPipelines(g_device, pipelineCache, 1, &pipelineCreateInfo, g_allocator, &pipeline) );
+  return pipeline;
+}
+
+// Secondary command buffers don't inherit dynamic state: every draw work item sets its own.
+static void recordViewportAndScissor(VkCommandBuffer commandBuffer)
+{
+  VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(g_renderExtent.width), static_cast<float>(g_renderExtent.height), 0.0f, 1.0f };
+  VkRect2D scissor = { { 0, 0 }, g_renderExtent };
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+static void recordTriangle(VkCommandBuffer commandBuffer, uint32_t)
+{
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_trianglePipeline);
+  recordViewportAndScissor(commandBuffer);
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+// Draw work items of the triangle. More than one: CPU recording load for the thread scaling benchmark (TEMPLATE_EXTRA_DRAWS).
+void addTriangleDraws(uint32_t count)
+{
+  for(uint32_t i = 0; i < count; i++) addDrawWork(recordTriangle);
+}
+
+// Registers the triangle: compiled by compilePipelines(), drawn by the frame's draw work.
+void createTrianglePipeline()
+{
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+  CHECK_VULKAN_ERRORS( vkCreatePipelineLayout(g_device, &pipelineLayoutCreateInfo, g_allocator, &g_trianglePipelineLayout) );
+
+  addPipeline("triangle", { "shaders/triangle.vert.spv", "shaders/triangle.frag.spv" }, buildTrianglePipeline, &g_trianglePipeline);
+  addTriangleDraws(1);
+}
+
+// Pipelines (destroyPipelines) first: they are made for the render pass.
+void destroyRenderPass()
+{
+  destroyRetiredFramebuffers(UINT64_MAX);
+  for(VkFramebuffer framebuffer : g_framebuffers) vkDestroyFramebuffer(g_device, framebuffer, g_allocator);
+  for(VkImageView imageView : g_swapChainImageViews) vkDestroyImageView(g_device, imageView, g_allocator);
+  g_framebuffers.clear();
+  g_swapChainImageViews.clear();
+  vkDestroyPipelineLayout(g_device, g_trianglePipelineLayout, g_allocator);
+  g_trianglePipelineLayout = VK_NULL_HANDLE;
+  vkDestroyRenderPass(g_device, g_renderPass, g_allocator);
+  g_renderPass = VK_NULL_HANDLE;
+}
@@ -0,0 +1,633 @@
+#pragma once
+#include "common.hpp"
+#include "memory.hpp"
+#include "render.hpp"
+#include "gpuprofiler.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <functional>
+
+// Render graph: passes declare the resources they use and how (RenderGraphAccess), the graph works out the rest when it's
+// compiled (first frame, and again after every swap chain change):
+// - Passes whose results nobody uses are culled. The roots are the resources with a final access (backbuffer, readbacks).
+// - Barriers: at most one vkCmdPipelineBarrier before a pass, all its transitions merged into it. A read after a read in the
+//   same layout needs nothing, and a stage which has already seen the last write isn't synchronized again.
+// - Transient images (created by the graph, sized relative to the swap chain) get their usage flags from the accesses, and
+//   share memory when their lifetimes (first to last pass using them) don't overlap: biggest first, into the first fit.
+//   Attachments nobody reads after the pass are not stored, attachments with nothing to keep are not loaded.
+// Imported resources (swap chain image, buffers of other modules) are tracked the same way, but not created. Imported
+// buffers must not be in use by earlier frames (one per frame slot, or static): their first access doesn't wait for anything.
+// Passes run in declaration order. Raster passes get a render pass made for their attachments, already in
+// COLOR_ATTACHMENT_OPTIMAL, and compatible with g_renderPass when they render to one image of the backbuffer's format
+// (the backbuffer itself, or e.g. the dynamic resolution target).
+
+enum RenderGraphPassType { RENDER_GRAPH_RASTER, RENDER_GRAPH_COMPUTE, RENDER_GRAPH_TRANSFER };
+
+struct RenderGraphAccess
+{
+  VkPipelineStageFlags stages;
+  VkAccessFlags access;
+  VkImageLayout layout; // Images only
+  bool write;
+  VkImageUsageFlags usage; // What a transient image needs for it
+  bool clear; // Color attachment cleared: previous contents not needed
+};
+
+const RenderGraphAccess RG_COLOR_WRITE = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, false };
+const RenderGraphAccess RG_COLOR_CLEAR = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true };
+const RenderGraphAccess RG_FRAGMENT_SAMPLED = { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false, VK_IMAGE_USAGE_SAMPLED_BIT, false };
+const RenderGraphAccess RG_VERTEX_READ = { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false, VK_IMAGE_USAGE_STORAGE_BIT, false };
+const RenderGraphAccess RG_COMPUTE_READ = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false, VK_IMAGE_USAGE_STORAGE_BIT, false };
+const RenderGraphAccess RG_COMPUTE_WRITE = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true, VK_IMAGE_USAGE_STORAGE_BIT, false };
+const RenderGraphAccess RG_INDIRECT_READ = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false, 0, false };
+const RenderGraphAccess RG_TRANSFER_READ = { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false };
+const RenderGraphAccess RG_TRANSFER_WRITE = { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true, VK_IMAGE_USAGE_TRANSFER_DST_BIT, false };
+const RenderGraphAccess RG_HOST_READ = { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false, 0, false };
+const RenderGraphAccess RG_PRESENT = { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false, 0, false }; // Synchronized by the renderFinished semaphore
+const RenderGraphAccess RG_ACQUIRED = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, true, 0, false }; // Stage waiting for imageAvailable
+const RenderGraphAccess RG_NONE = { 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, false, 0, false };
+
+struct RenderGraphContext
+{
+  VkCommandBuffer commandBuffer;
+  uint32_t slot; // Frame slot
+  uint32_t imageIndex;
+  uint64_t frameNumber;
+  VkRenderPass renderPass; // Raster passes: begin this with framebuffer, the attachments are in COLOR_ATTACHMENT_OPTIMAL
+  VkFramebuffer framebuffer;
+  VkExtent2D extent;
+};
+
+struct RenderGraphUse
+{
+  uint32_t resource;
+  RenderGraphAccess access;
+};
+
+struct RenderGraphImageTransition
+{
+  uint32_t resource;
+  VkImageLayout oldLayout;
+  VkImageLayout newLayout;
+  VkAccessFlags srcAccess;
+  VkAccessFlags dstAccess;
+};
+
+struct RenderGraphBarriers // Merged into one vkCmdPipelineBarrier
+{
+  VkPipelineStageFlags srcStages = 0;
+  VkPipelineStageFlags dstStages = 0;
+  VkAccessFlags srcAccess = 0; // Buffers: one global memory barrier
+  VkAccessFlags dstAccess = 0;
+  std::vector<RenderGraphImageTransition> images;
+};
+
+struct RenderGraphPass
+{
+  const char* name; // Static string: GPU and CPU profiler zones
+  RenderGraphPassType type;
+  std::function<void(const RenderGraphContext&)> record;
+  std::function<void(const RenderGraphContext&)> prepare; // Optional, see setRenderGraphPassPrepare()
+  std::vector<RenderGraphUse> uses;
+  // Compiled:
+  bool culled = false;
+  RenderGraphBarriers barriers;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  std::vector<VkFramebuffer> framebuffers; // Own framebuffers (transient attachments), one
+  std::function<VkFramebuffer(uint32_t)> importedFramebuffer; // Or the imported attachment's, per image index
+};
+
+struct RenderGraphResource
+{
+  const char* name;
+  bool isImage;
+  bool imported;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  float scale = 1.0f; // Transient images: size relative to g_swapChainExtent
+  std::function<VkImage(uint32_t)> importedImage; // By image index
+  std::function<VkFramebuffer(uint32_t)> importedFramebuffer; // Framebuffer with this image as the only attachment, may be empty
+  RenderGraphAccess initial = RG_NONE; // State at the beginning of the frame (imported)
+  RenderGraphAccess final = RG_NONE; // Transition at the end of the frame, makes the resource a root
+  bool hasFinal = false;
+  // Compiled (transient images):
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  VkImageUsageFlags usage = 0;
+  VkExtent2D extent = {};
+  uint32_t firstPass = UINT32_MAX;
+  uint32_t lastPass = 0;
+  uint32_t memory = UINT32_MAX; // Index into g_renderGraphMemory
+};
+
+struct RenderGraphMemory
+{
+  Allocation allocation;
+  VkMemoryRequirements requirements = {};
+  std::vector<uint32_t> resources; // Aliased: lifetimes never overlap
+};
+
+struct RetiredRenderGraph
+{
+  std::vector<VkImage> images;
+  std::vector<VkImageView> views;
+  std::vector<VkFramebuffer> framebuffers;
+  std::vector<VkRenderPass> renderPasses;
+  std::vector<Allocation> allocations;
+  uint64_t usedUntilFrame; // Frames numbered below this may still use them
+};
+
+struct RenderGraphState
+{
+  VkImageLayout layout;
+  VkPipelineStageFlags writeStages; // Last write, or everything to wait for before the first access
+  VkAccessFlags writeAccess;
+  VkPipelineStageFlags readStages; // Synchronized with the last write already
+  VkAccessFlags readAccess;
+};
+
+std::vector<RenderGraphPass> g_renderGraphPasses;
+std::vector<RenderGraphResource> g_renderGraphResources;
+std::vector<RenderGraphMemory> g_renderGraphMemory;
+RenderGraphBarriers g_renderGraphFinalBarriers;
+std::vector<RetiredRenderGraph> g_retiredRenderGraphs;
+bool g_renderGraphCompiled = false;
+
+uint32_t importRenderGraphImage(const char* name, VkFormat format, std::function<VkImage(uint32_t)> image, std::function<VkFramebuffer(uint32_t)> framebuffer, const RenderGraphAccess& initial, const RenderGraphAccess& final)
+{
+  RenderGraphResource resource = { name, true, true, format };
+  resource.importedImage = image;
+  resource.importedFramebuffer = framebuffer;
+  resource.initial = initial;
+  resource.final = final;
+  resource.hasFinal = true;
+  g_renderGraphResources.push_back(resource);
+  g_renderGraphCompiled = false;
+  return static_cast<uint32_t>(g_renderGraphResources.size()) - 1;
+}
+
+// final: RG_NONE unless something outside of the graph (the host) uses the buffer after the frame.
+uint32_t importRenderGraphBuffer(const char* name, const RenderGraphAccess& final = RG_NONE)
+{
+  RenderGraphResource resource = { name, false, true };
+  resource.final = final;
+  resource.hasFinal = final.stages != 0;
+  g_renderGraphResources.push_back(resource);
+  g_renderGraphCompiled = false;
+  return static_cast<uint32_t>(g_renderGraphResources.size()) - 1;
+}
+
+// Contents don't survive the frame. Color formats only.
+uint32_t createRenderGraphImage(const char* name, VkFormat format, float scale = 1.0f)
+{
+  RenderGraphResource resource = { name, true, false, format, scale };
+  g_renderGraphResources.push_back(resource);
+  g_renderGraphCompiled = false;
+  return static_cast<uint32_t>(g_renderGraphResources.size()) - 1;
+}
+
+// For the passes' record functions: the transient image once compiled, or the imported one of this frame.
+VkImage renderGraphImage(uint32_t resource, uint32_t imageIndex)
+{
+  const RenderGraphResource& image = g_renderGraphResources[resource];
+  return image.imported ? image.importedImage(imageIndex) : image.image;
+}
+
+static RenderGraphPass& findRenderGraphPass(const char* name)
+{
+  for(RenderGraphPass& pass : g_renderGraphPasses) if(strcmp(pass.name, name) == 0) return pass;
+  throw std::runtime_error(std::string("Render graph: no pass ") + name);
+}
+
+// before: name of an already added pass to insert this one in front of, nullptr to append.
+void addRenderGraphPass(const char* name, RenderGraphPassType type, std::function<void(const RenderGraphContext&)> record, const char* before = nullptr)
+{
+  RenderGraphPass pass = { name, type, record };
+  auto position = g_renderGraphPasses.end();
+  if(before != nullptr) position = g_renderGraphPasses.begin() + (&findRenderGraphPass(before) - g_renderGraphPasses.data());
+  g_renderGraphPasses.insert(position, pass);
+  g_renderGraphCompiled = false;
+}
+
+// prepare runs for every pass, in pass order, before any of them is recorded: the place to start jobs recording into
+// secondary command buffers (they run while the render thread records the passes before), or to update what those jobs read.
+void setRenderGraphPassPrepare(const char* passName, std::function<void(const RenderGraphContext&)> prepare)
+{
+  findRenderGraphPass(passName).prepare = prepare;
+}
+
+// Passes may get accesses from other modules too, e.g. the main pass reading what a culling pass wrote.
+void addRenderGraphAccess(const char* passName, uint32_t resource, const RenderGraphAccess& access)
+{
+  findRenderGraphPass(passName).uses.push_back({ resource, access });
+  g_renderGraphCompiled = false;
+}
+
+static bool isColorAttachment(const RenderGraphAccess& access)
+{
+  return access.stages == VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT && access.write;
+}
+
+// Backwards from the roots: a pass stays when it writes something still needed, then everything it uses is needed
+// (except what it clears).
+static uint32_t cullRenderGraphPasses()
+{
+  std::vector<bool> needed(g_renderGraphResources.size(), false);
+  for(size_t i = 0; i < g_renderGraphResources.size(); i++) needed[i] = g_renderGraphResources[i].hasFinal;
+  uint32_t culled = 0;
+  for(auto pass = g_renderGraphPasses.rbegin(); pass != g_renderGraphPasses.rend(); pass++)
+  {
+    pass->culled = true;
+    for(const RenderGraphUse& use : pass->uses) if(use.access.write && needed[use.resource]) pass->culled = false;
+    if(pass->culled)
+    {
+      culled++;
+      continue;
+    }
+    for(const RenderGraphUse& use : pass->uses) if(!use.access.clear) needed[use.resource] = true;
+  }
+  return culled;
+}
+
+struct TransientLifetime
+{
+  uint32_t firstPass;
+  uint32_t lastPass;
+  VkMemoryRequirements requirements;
+};
+
+// Biggest first, each into the first memory whose images are all dead during its lifetime. Returns the memory of each
+// transient, memories gets the requirements of each memory (and the transients in it).
+static std::vector<uint32_t> aliasTransientMemory(const std::vector<TransientLifetime>& transients, std::vector<RenderGraphMemory>& memories)
+{
+  std::vector<uint32_t> order(transients.size());
+  for(uint32_t i = 0; i < order.size(); i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return transients[a].requirements.size > transients[b].requirements.size; });
+  std::vector<uint32_t> placement(transients.size(), UINT32_MAX);
+  for(uint32_t i : order)
+  {
+    const TransientLifetime& transient = transients[i];
+    for(uint32_t m = 0; m < memories.size() && placement[i] == UINT32_MAX; m++)
+    {
+      RenderGraphMemory& memory = memories[m];
+      if((memory.requirements.memoryTypeBits & transient.requirements.memoryTypeBits) == 0) continue;
+      bool overlaps = false;
+      for(uint32_t other : memory.resources) overlaps = overlaps || (transient.firstPass <= transients[other].lastPass && transients[other].firstPass <= transient.lastPass);
+      if(overlaps) continue;
+      memory.requirements.size = std::max(memory.requirements.size, transient.requirements.size);
+      memory.requirements.alignment = std::max(memory.requirements.alignment, transient.requirements.alignment);
+      memory.requirements.memoryTypeBits &= transient.requirements.memoryTypeBits;
+      memory.resources.push_back(i);
+      placement[i] = m;
+    }
+    if(placement[i] == UINT32_MAX)
+    {
+      memories.push_back({ Allocation(), transient.requirements, { i } });
+      placement[i] = static_cast<uint32_t>(memories.size()) - 1;
+    }
+  }
+  return placement;
+}
+
+static void createTransientImages()
+{
+  for(uint32_t p = 0; p < g_renderGraphPasses.size(); p++)
+  {
+    if(g_renderGraphPasses[p].culled) continue;
+    for(const RenderGraphUse& use : g_renderGraphPasses[p].uses)
+    {
+      RenderGraphResource& resource = g_renderGraphResources[use.resource];
+      resource.firstPass = std::min(resource.firstPass, p);
+      resource.lastPass = std::max(resource.lastPass, p);
+      resource.usage |= use.access.usage;
+    }
+  }
+
+  std::vector<uint32_t> transients;
+  for(uint32_t i = 0; i < g_renderGraphResources.size(); i++)
+  {
+    RenderGraphResource& resource = g_renderGraphResources[i];
+    if(resource.imported || resource.firstPass == UINT32_MAX) continue; // Unused when all its passes were culled
+    resource.extent = { std::max(1u, static_cast<uint32_t>(g_swapChainExtent.width * resource.scale)), std::max(1u, static_cast<uint32_t>(g_swapChainExtent.height * resource.scale)) };
+    VkImageCreateInfo imageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = resource.format;
+    imageCreateInfo.extent = { resource.extent.width, resource.extent.height, 1 };
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.usage = resource.usage;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    CHECK_VULKAN_ERRORS( vkCreateImage(g_device, &imageCreateInfo, g_allocator, &resource.image) );
+    transients.push_back(i);
+  }
+
+  std::vector<VkMemoryRequirements> requirements(g_renderGraphResources.size());
+  std::vector<TransientLifetime> lifetimes;
+  for(uint32_t i : transients)
+  {
+    vkGetImageMemoryRequirements(g_device, g_renderGraphResources[i].image, &requirements[i]);
+    lifetimes.push_back({ g_renderGraphResources[i].firstPass, g_renderGraphResources[i].lastPass, requirements[i] });
+  }
+  std::vector<uint32_t> placement = aliasTransientMemory(lifetimes, g_renderGraphMemory);
+  for(uint32_t t = 0; t < transients.size(); t++) g_renderGraphResources[transients[t]].memory = placement[t];
+  for(RenderGraphMemory& memory : g_renderGraphMemory)
+  {
+    for(uint32_t& resource : memory.resources) resource = transients[resource]; // Transient numbers to resource indices
+  }
+
+  VkDeviceSize aliasedBytes = 0;
+  VkDeviceSize unaliasedBytes = 0;
+  for(RenderGraphMemory& memory : g_renderGraphMemory)
+  {
+    memory.allocation = allocateMemory(memory.requirements, MemoryUsage::GpuOnly, MEMORY_KIND_OPTIMAL);
+    aliasedBytes += memory.requirements.size;
+    for(uint32_t i : memory.resources)
+    {
+      RenderGraphResource& resource = g_renderGraphResources[i];
+      CHECK_VULKAN_ERRORS( vkBindImageMemory(g_device, resource.image, memory.allocation.memory, memory.allocation.offset) );
+      unaliasedBytes += requirements[i].size;
+
+      VkImageViewCreateInfo imageViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+      imageViewCreateInfo.image = resource.image;
+      imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      imageViewCreateInfo.format = resource.format;
+      imageViewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+      CHECK_VULKAN_ERRORS( vkCreateImageView(g_device, &imageViewCreateInfo, g_allocator, &resource.view) );
+    }
+  }
+  if(!transients.empty()) std::cout << "Render graph: " << transients.size() << " transient images in " << (aliasedBytes >> 10) << " KiB (" << (unaliasedBytes >> 10) << " KiB without aliasing)" << std::endl;
+}
+
+// Adds what the access needs to the pass's barriers and moves the resource to its new state.
+static void transitionRenderGraphResource(RenderGraphState& state, uint32_t resource, const RenderGraphAccess& access, RenderGraphBarriers& barriers)
+{
+  bool image = g_renderGraphResources[resource].isImage;
+  bool layoutChange = image && access.layout != state.layout;
+  VkPipelineStageFlags srcStages = state.writeStages;
+  bool needed;
+  if(layoutChange || access.write) // Also waits for the reads since the last write (write after read)
+  {
+    srcStages |= state.readStages;
+    needed = layoutChange || srcStages != 0;
+  } else needed = state.writeStages != 0 && ((access.stages & ~state.readStages) != 0 || (access.access & ~state.readAccess) != 0);
+
+  if(needed)
+  {
+    barriers.srcStages |= srcStages;
+    barriers.dstStages |= access.stages;
+    if(image) barriers.images.push_back({ resource, state.layout, access.layout, state.writeAccess, access.access });
+    else
+    {
+      barriers.srcAccess |= state.writeAccess;
+      barriers.dstAccess |= access.access;
+    }
+  }
+  if(access.write) state = { access.layout, access.stages, access.access, 0, 0 };
+  else
+  {
+    state.layout = access.layout;
+    state.readStages |= access.stages;
+    state.readAccess |= access.access;
+  }
+}
+
+static VkRenderPass createRenderGraphRenderPass(const RenderGraphPass& pass, const std::vector<RenderGraphState>& states)
+{
+  uint32_t passIndex = static_cast<uint32_t>(&pass - g_renderGraphPasses.data());
+  std::vector<VkAttachmentDescription> descriptions;
+  std::vector<VkAttachmentReference> references;
+  for(const RenderGraphUse& use : pass.uses)
+  {
+    if(!isColorAttachment(use.access)) continue;
+    const RenderGraphResource& resource = g_renderGraphResources[use.resource];
+    bool readLater = resource.hasFinal;
+    for(uint32_t p = passIndex + 1; p < g_renderGraphPasses.size(); p++)
+    {
+      if(g_renderGraphPasses[p].culled) continue;
+      for(const RenderGraphUse& later : g_renderGraphPasses[p].uses) readLater = readLater || (later.resource == use.resource && !later.access.clear);
+    }
+    VkAttachmentDescription description = {};
+    description.format = resource.format;
+    description.samples = VK_SAMPLE_COUNT_1_BIT;
+    bool hasContents = states[use.resource].layout != VK_IMAGE_LAYOUT_UNDEFINED; // Written earlier in the frame
+    description.loadOp = use.access.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : (hasContents ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+    description.storeOp = readLater ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    description.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; // The graph's barriers do the transitions
+    description.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    references.push_back({ static_cast<uint32_t>(descriptions.size()), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+    descriptions.push_back(description);
+  }
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = static_cast<uint32_t>(references.size());
+  subpass.pColorAttachments = references.data();
+  VkRenderPassCreateInfo renderPassCreateInfo = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+  renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(descriptions.size());
+  renderPassCreateInfo.pAttachments = descriptions.data();
+  renderPassCreateInfo.subpassCount = 1;
+  renderPassCreateInfo.pSubpasses = &subpass;
+  VkRenderPass renderPass;
+  CHECK_VULKAN_ERRORS( vkCreateRenderPass(g_device, &renderPassCreateInfo, g_allocator, &renderPass) );
+  return renderPass;
+}
+
+static void createRenderGraphFramebuffers(RenderGraphPass& pass, const std::vector<uint32_t>& attachments)
+{
+  if(attachments.size() == 1 && g_renderGraphResources[attachments[0]].imported)
+  {
+    pass.importedFramebuffer = g_renderGraphResources[attachments[0]].importedFramebuffer;
+    if(!pass.importedFramebuffer) throw std::runtime_error(std::string("Render graph: imported attachment without framebuffers in ") + pass.name);
+    return;
+  }
+  std::vector<VkImageView> views;
+  VkExtent2D extent = g_renderGraphResources[attachments[0]].extent;
+  for(uint32_t attachment : attachments)
+  {
+    if(g_renderGraphResources[attachment].imported) throw std::runtime_error(std::string("Render graph: imported and transient attachments mixed in ") + pass.name);
+    views.push_back(g_renderGraphResources[attachment].view);
+  }
+  VkFramebufferCreateInfo framebufferCreateInfo = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+  framebufferCreateInfo.renderPass = pass.renderPass;
+  framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(views.size());
+  framebufferCreateInfo.pAttachments = views.data();
+  framebufferCreateInfo.width = extent.width;
+  framebufferCreateInfo.height = extent.height;
+  framebufferCreateInfo.layers = 1;
+  pass.framebuffers.resize(1);
+  CHECK_VULKAN_ERRORS( vkCreateFramebuffer(g_device, &framebufferCreateInfo, g_allocator, &pass.framebuffers[0]) );
+}
+
+void compileRenderGraph()
+{
+  PROFILE_FUNCTION();
+  uint32_t culled = cullRenderGraphPasses();
+  createTransientImages();
+
+  // Frame start: imported resources in their initial state. A transient image waits for every access to its memory
+  // (its own from the previous frame, and the images it aliases): the first barrier covers both, contents discarded.
+  std::vector<RenderGraphState> states(g_renderGraphResources.size(), { VK_IMAGE_LAYOUT_UNDEFINED, 0, 0, 0, 0 });
+  for(uint32_t i = 0; i < g_renderGraphResources.size(); i++)
+  {
+    const RenderGraphResource& resource = g_renderGraphResources[i];
+    if(resource.imported) states[i] = { resource.initial.layout, resource.initial.stages, resource.initial.access, 0, 0 };
+  }
+  for(RenderGraphPass& pass : g_renderGraphPasses)
+  {
+    if(pass.culled) continue;
+    for(const RenderGraphUse& use : pass.uses)
+    {
+      const RenderGraphResource& resource = g_renderGraphResources[use.resource];
+      if(resource.imported) continue;
+      for(uint32_t alias : g_renderGraphMemory[resource.memory].resources)
+      {
+        states[alias].writeStages |= use.access.stages;
+        states[alias].writeAccess |= use.access.write ? use.access.access : 0;
+      }
+    }
+  }
+
+  uint32_t barrierCount = 0;
+  for(RenderGraphPass& pass : g_renderGraphPasses)
+  {
+    pass.barriers = RenderGraphBarriers();
+    if(pass.culled) continue;
+    std::vector<uint32_t> attachments;
+    for(const RenderGraphUse& use : pass.uses) if(isColorAttachment(use.access)) attachments.push_back(use.resource);
+    if(pass.type == RENDER_GRAPH_RASTER)
+    {
+      if(attachments.empty()) throw std::runtime_error(std::string("Render graph: raster pass without attachments ") + pass.name);
+      pass.renderPass = createRenderGraphRenderPass(pass, states); // Load ops from the states before the pass
+      createRenderGraphFramebuffers(pass, attachments);
+    }
+    for(const RenderGraphUse& use : pass.uses) transitionRenderGraphResource(states[use.resource], use.resource, use.access, pass.barriers);
+    if(pass.barriers.srcStages != 0 || !pass.barriers.images.empty()) barrierCount++;
+  }
+  g_renderGraphFinalBarriers = RenderGraphBarriers();
+  for(uint32_t i = 0; i < g_renderGraphResources.size(); i++)
+  {
+    if(g_renderGraphResources[i].hasFinal) transitionRenderGraphResource(states[i], i, g_renderGraphResources[i].final, g_renderGraphFinalBarriers);
+  }
+
+  std::cout << "Render graph: " << g_renderGraphPasses.size() - culled << " passes (" << culled << " culled), " << barrierCount << " barriers" << std::endl;
+  g_renderGraphCompiled = true;
+}
+
+static void recordRenderGraphBarriers(VkCommandBuffer commandBuffer, const RenderGraphBarriers& barriers, uint32_t imageIndex)
+{
+  if(barriers.srcStages == 0 && barriers.images.empty()) return;
+  std::vector<VkImageMemoryBarrier> imageBarriers;
+  for(const RenderGraphImageTransition& transition : barriers.images)
+  {
+    const RenderGraphResource& resource = g_renderGraphResources[transition.resource];
+    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    barrier.srcAccessMask = transition.srcAccess;
+    barrier.dstAccessMask = transition.dstAccess;
+    barrier.oldLayout = transition.oldLayout;
+    barrier.newLayout = transition.newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = resource.imported ? resource.importedImage(imageIndex) : resource.image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    imageBarriers.push_back(barrier);
+  }
+  VkMemoryBarrier memoryBarrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+  memoryBarrier.srcAccessMask = barriers.srcAccess;
+  memoryBarrier.dstAccessMask = barriers.dstAccess;
+  bool buffers = barriers.srcAccess != 0 || barriers.dstAccess != 0;
+  vkCmdPipelineBarrier(commandBuffer, barriers.srcStages != 0 ? barriers.srcStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), barriers.dstStages, 0, buffers ? 1 : 0, &memoryBarrier,
+    0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+static RenderGraphContext renderGraphContext(const RenderGraphPass& pass, VkCommandBuffer commandBuffer, uint32_t slot, uint32_t imageIndex, uint64_t frameNumber)
+{
+  RenderGraphContext context = { commandBuffer, slot, imageIndex, frameNumber, pass.renderPass, VK_NULL_HANDLE, g_swapChainExtent };
+  if(pass.importedFramebuffer) context.framebuffer = pass.importedFramebuffer(imageIndex);
+  else if(!pass.framebuffers.empty()) context.framebuffer = pass.framebuffers[0];
+  return context;
+}
+
+// Records the whole frame into the primary command buffer, outside of any render pass.
+void executeRenderGraph(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t imageIndex, uint64_t frameNumber)
+{
+  if(!g_renderGraphCompiled) compileRenderGraph();
+  for(RenderGraphPass& pass : g_renderGraphPasses)
+  {
+    if(!pass.culled && pass.prepare) pass.prepare(renderGraphContext(pass, commandBuffer, slot, imageIndex, frameNumber));
+  }
+  for(RenderGraphPass& pass : g_renderGraphPasses)
+  {
+    if(pass.culled) continue;
+    recordRenderGraphBarriers(commandBuffer, pass.barriers, imageIndex);
+    PROFILE_ZONE(pass.name);
+    ScopedGpuZone zone(commandBuffer, slot, pass.name);
+    pass.record(renderGraphContext(pass, commandBuffer, slot, imageIndex, frameNumber));
+  }
+  recordRenderGraphBarriers(commandBuffer, g_renderGraphFinalBarriers, imageIndex);
+}
+
+// Swap chain changed: compiled objects are retired (frames in flight may use them) and rebuilt at the next execution.
+void invalidateRenderGraph(uint64_t submittedFrames)
+{
+  if(!g_renderGraphCompiled) return;
+  RetiredRenderGraph retired;
+  retired.usedUntilFrame = submittedFrames;
+  for(RenderGraphPass& pass : g_renderGraphPasses)
+  {
+    if(pass.renderPass != VK_NULL_HANDLE) retired.renderPasses.push_back(pass.renderPass);
+    retired.framebuffers.insert(retired.framebuffers.end(), pass.framebuffers.begin(), pass.framebuffers.end());
+    pass.renderPass = VK_NULL_HANDLE;
+    pass.framebuffers.clear();
+    pass.importedFramebuffer = nullptr;
+  }
+  for(RenderGraphResource& resource : g_renderGraphResources)
+  {
+    if(resource.image != VK_NULL_HANDLE && !resource.imported)
+    {
+      retired.images.push_back(resource.image);
+      retired.views.push_back(resource.view);
+    }
+    resource.image = VK_NULL_HANDLE;
+    resource.view = VK_NULL_HANDLE;
+    resource.usage = 0;
+    resource.firstPass = UINT32_MAX;
+    resource.lastPass = 0;
+    resource.memory = UINT32_MAX;
+  }
+  for(RenderGraphMemory& memory : g_renderGraphMemory) retired.allocations.push_back(memory.allocation);
+  g_renderGraphMemory.clear();
+  g_retiredRenderGraphs.push_back(retired);
+  g_renderGraphCompiled = false;
+}
+
+// completedFrames: every frame numbered below it has finished on the GPU.
+void destroyRetiredRenderGraphs(uint64_t completedFrames)
+{
+  for(size_t i = 0; i < g_retiredRenderGraphs.size();)
+  {
+    RetiredRenderGraph& retired = g_retiredRenderGraphs[i];
+    if(retired.usedUntilFrame <= completedFrames)
+    {
+      for(VkFramebuffer framebuffer : retired.framebuffers) vkDestroyFramebuffer(g_device, framebuffer, g_allocator);
+      for(VkRenderPass renderPass : retired.renderPasses) vkDestroyRenderPass(g_device, renderPass, g_allocator);
+      for(VkImageView view : retired.views) vkDestroyImageView(g_device, view, g_allocator);
+      for(VkImage image : retired.images) vkDestroyImage(g_device, image, g_allocator);
+      for(Allocation& allocation : retired.allocations) freeMemory(allocation);
+      g_retiredRenderGraphs.erase(g_retiredRenderGraphs.begin() + i);
+    } else i++;
+  }
+}
+
+// After vkDeviceWaitIdle.
+void destroyRenderGraph()
+{
+  invalidateRenderGraph(0);
+  destroyRetiredRenderGraphs(UINT64_MAX);
+  g_renderGraphPasses.clear();
+  g_renderGraphResources.clear();
+}
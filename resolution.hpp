@@ -0,0 +1,162 @@
+#pragma once
+#include "common.hpp"
+#include "bench.hpp"
+#include "rendergraph.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Dynamic resolution (TEMPLATE_DYNAMIC_RESOLUTION=1): the main pass renders into a "scene color" render graph image sized for
+// the largest scale, but only into its top left g_renderExtent. A "resolution blit" pass after it scales that area onto the
+// backbuffer (linear filter). A new resolution is just another viewport, render area and blit source: no image, framebuffer
+// or swap chain is recreated, so it may change every few frames without a hitch.
+// The scale is a feedback loop on the measured GPU frame time (bench.hpp timestamps) against the target frame rate. The cost
+// goes with the pixel count, the scale squared, so the wanted scale is the current one times the square root of budget over
+// GPU time. Going down happens at once, on the smoothed time or the newest sample whichever is worse, so a load spike is
+// answered as soon as its first frame is measured. Going up is limited per step and waits until the frames have stayed under
+// the budget for a while. Changes inside the dead band are ignored, and after a change the samples of the frames recorded
+// before it are skipped. Without timestamps the scale stays at the largest one.
+// Golden image runs should leave it off: the output depends on the timings then.
+
+const double RESOLUTION_HEADROOM = 0.9; // Share of the frame budget aimed at: room for spikes
+const double RESOLUTION_DEAD_BAND = 0.05; // Relative scale changes smaller than this are ignored
+const double RESOLUTION_MAX_INCREASE = 0.05; // Scale added per step at most
+const uint32_t RESOLUTION_INCREASE_FRAMES = 30; // Frames under the budget before going up
+const double RESOLUTION_SMOOTHING = 0.2; // Weight of the newest GPU frame time
+
+struct ResolutionStats
+{
+  uint64_t frames = 0;
+  double scaleSum = 0.0;
+  double minScale = 0.0;
+  uint64_t decreases = 0;
+  uint64_t increases = 0;
+};
+
+bool g_dynamicResolution = false;
+uint32_t g_resolutionMinPercent = 50; // Scale bounds per axis, of g_swapChainExtent
+uint32_t g_resolutionMaxPercent = 100;
+uint32_t g_resolutionTargetFps = 60;
+double g_resolutionScale = 1.0; // Current, per axis
+double g_resolutionGpuMilliseconds = 0.0; // Smoothed, 0: no sample since the last change
+size_t g_resolutionSamplesSeen = 0; // g_frameTimes.gpu already fed to the loop
+uint32_t g_resolutionSkipSamples = 0; // Frames in flight at the last change
+uint32_t g_resolutionFramesUnderBudget = 0;
+uint32_t g_sceneColor = UINT32_MAX; // Render graph image the main pass renders to
+ResolutionStats g_resolutionStats;
+
+static bool resolutionBlitSupported(VkFormat format)
+{
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(g_physicalDevice, format, &properties);
+  VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (properties.optimalTilingFeatures & needed) == needed;
+}
+
+static void recordResolutionBlit(const RenderGraphContext& context)
+{
+  VkImageBlit blit = {};
+  blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+  blit.srcOffsets[1] = { static_cast<int32_t>(g_renderExtent.width), static_cast<int32_t>(g_renderExtent.height), 1 };
+  blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+  blit.dstOffsets[1] = { static_cast<int32_t>(g_swapChainExtent.width), static_cast<int32_t>(g_swapChainExtent.height), 1 };
+  vkCmdBlitImage(context.commandBuffer, renderGraphImage(g_sceneColor, context.imageIndex), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    g_swapChainImages[context.imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+}
+
+// In createMainPass(), after the main pass: returns the image the main pass renders to, the backbuffer itself when dynamic
+// resolution is off (or the swap chain images can't be blitted to).
+uint32_t createDynamicResolution(uint32_t backbuffer)
+{
+  if(!g_dynamicResolution) return backbuffer;
+  if(!g_blitTargetRequested) // Swap chain without TRANSFER_DST usage, already reported (swap.hpp)
+  {
+    g_dynamicResolution = false;
+    return backbuffer;
+  }
+  if(!resolutionBlitSupported(g_swapChainImageFormat))
+  {
+    std::cout << "Dynamic resolution: swap chain format " << g_swapChainImageFormat << " can't be blitted with a linear filter, disabled" << std::endl;
+    g_dynamicResolution = false;
+    return backbuffer;
+  }
+  g_resolutionMinPercent = std::max(10u, std::min(g_resolutionMinPercent, 200u));
+  g_resolutionMaxPercent = std::max(g_resolutionMinPercent, std::min(g_resolutionMaxPercent, 200u));
+  g_resolutionTargetFps = std::max(1u, g_resolutionTargetFps);
+  g_resolutionScale = g_resolutionMaxPercent / 100.0;
+  g_resolutionStats.minScale = g_resolutionScale;
+
+  // Same format as the backbuffer: the main pass's render pass stays compatible with g_renderPass and its pipelines
+  g_sceneColor = createRenderGraphImage("scene color", g_swapChainImageFormat, static_cast<float>(g_resolutionScale));
+  addRenderGraphPass("resolution blit", RENDER_GRAPH_TRANSFER, recordResolutionBlit);
+  addRenderGraphAccess("resolution blit", g_sceneColor, RG_TRANSFER_READ);
+  addRenderGraphAccess("resolution blit", backbuffer, RG_TRANSFER_WRITE);
+  std::cout << "Dynamic resolution: " << g_resolutionMinPercent << "-" << g_resolutionMaxPercent << "%, target " << g_resolutionTargetFps << " fps" << std::endl;
+  return g_sceneColor;
+}
+
+static void changeResolutionScale(double scale, uint32_t framesInFlight)
+{
+  g_resolutionScale = scale;
+  g_resolutionGpuMilliseconds = 0.0;
+  g_resolutionSkipSamples = framesInFlight; // Recorded at the old scale
+  g_resolutionFramesUnderBudget = 0;
+}
+
+// Once per frame before recording, after its slot's GPU frame time has been collected: sets g_renderExtent.
+void updateDynamicResolution(uint32_t framesInFlight)
+{
+  if(!g_dynamicResolution)
+  {
+    g_renderExtent = g_swapChainExtent;
+    return;
+  }
+  double budget = 1000.0 / g_resolutionTargetFps * RESOLUTION_HEADROOM;
+  double newest = 0.0;
+  for(; g_resolutionSamplesSeen < g_frameTimes.gpu.size(); g_resolutionSamplesSeen++)
+  {
+    if(g_resolutionSkipSamples > 0)
+    {
+      g_resolutionSkipSamples--;
+      continue;
+    }
+    newest = g_frameTimes.gpu[g_resolutionSamplesSeen];
+    g_resolutionGpuMilliseconds = (g_resolutionGpuMilliseconds == 0.0) ? newest : g_resolutionGpuMilliseconds + RESOLUTION_SMOOTHING * (newest - g_resolutionGpuMilliseconds);
+    if(newest <= budget) g_resolutionFramesUnderBudget++;
+    else g_resolutionFramesUnderBudget = 0;
+  }
+
+  if(newest > 0.0)
+  {
+    double minScale = g_resolutionMinPercent / 100.0;
+    double maxScale = g_resolutionMaxPercent / 100.0;
+    double worst = std::max(g_resolutionGpuMilliseconds, newest);
+    double down = std::max(minScale, g_resolutionScale * std::sqrt(budget / worst));
+    double up = std::min(maxScale, g_resolutionScale * std::sqrt(budget / g_resolutionGpuMilliseconds));
+    if(down < g_resolutionScale * (1.0 - RESOLUTION_DEAD_BAND) || (down < g_resolutionScale && down == minScale))
+    {
+      changeResolutionScale(down, framesInFlight);
+      g_resolutionStats.decreases++;
+    }
+    else if(g_resolutionFramesUnderBudget >= RESOLUTION_INCREASE_FRAMES && (up > g_resolutionScale * (1.0 + RESOLUTION_DEAD_BAND) || (up > g_resolutionScale && up == maxScale)))
+    {
+      changeResolutionScale(std::min(up, g_resolutionScale + RESOLUTION_MAX_INCREASE), framesInFlight);
+      g_resolutionStats.increases++;
+    }
+  }
+
+  // Never bigger than the scene color image (created at the largest scale, same rounding)
+  g_renderExtent.width = std::max(1u, static_cast<uint32_t>(g_swapChainExtent.width * static_cast<float>(g_resolutionScale)));
+  g_renderExtent.height = std::max(1u, static_cast<uint32_t>(g_swapChainExtent.height * static_cast<float>(g_resolutionScale)));
+  g_resolutionStats.frames++;
+  g_resolutionStats.scaleSum += g_resolutionScale;
+  g_resolutionStats.minScale = std::min(g_resolutionStats.minScale, g_resolutionScale);
+}
+
+void reportDynamicResolution()
+{
+  if(!g_dynamicResolution || g_resolutionStats.frames == 0) return;
+  const ResolutionStats& stats = g_resolutionStats;
+  std::cout << "Dynamic resolution: scale avg " << 100.0 * stats.scaleSum / stats.frames << "% | min " << 100.0 * stats.minScale << "% | last " << 100.0 * g_resolutionScale
+    << "% | " << stats.decreases << " decreases, " << stats.increases << " increases (target " << g_resolutionTargetFps << " fps)" << std::endl;
+}
@@ -0,0 +1,589 @@
+#pragma once
+#include "common.hpp"
+#include "bench.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+#include "recording.hpp"
+#include "pipelines.hpp"
+#include "render.hpp"
+#include "gpuprofiler.hpp"
+#include "rendergraph.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <random>
+
+// GPU-driven scene: tens of thousands of objects without a CPU draw call per object. Object data lives in storage buffers,
+// one array per attribute (SoA: positions, meshes, materials). Every frame a compute pass on the graphics queue (render graph
+// passes ahead of the main pass), tests each object's bounding sphere against the view frustum and appends the visible ones to their batch
+// (one batch per mesh and material): it counts the batch's instances in its VkDrawIndexedIndirectCommand and writes the
+// object index into the batch's range of the visible list. The render pass then draws all batches with one indirect call,
+// instanced; the vertex shader finds its object through the visible list. With drawIndirectCount (Vulkan 1.2 path) a second
+// dispatch compacts the non-empty batches and the GPU decides the draw count too. Devices without multiDrawIndirect get one
+// indirect call per batch (still no per-object CPU work).
+// TEMPLATE_SCENE_OBJECTS=N enables it, "make stress" runs it as a headless benchmark reporting the draw throughput.
+
+const uint32_t SCENE_MATERIAL_COUNT = 4;
+const uint32_t SCENE_CULL_GROUP_SIZE = 64; // local_size_x of cull.comp and compact.comp
+const float SCENE_OBJECT_SPACING = 4.0f; // Average distance between objects
+const VkDeviceSize SCENE_DRAWS_HEADER = 16; // Draw count, visible count and padding before the commands
+
+enum SceneBinding
+{
+  SCENE_BINDING_TRANSFORMS, SCENE_BINDING_MESHES, SCENE_BINDING_MATERIALS, SCENE_BINDING_BATCH_BASES, SCENE_BINDING_MESH_RADII,
+  SCENE_BINDING_MATERIAL_COLORS, SCENE_BINDING_DRAWS, SCENE_BINDING_VISIBLE, SCENE_BINDING_COMPACTED, SCENE_BINDING_COUNT
+};
+
+struct SceneVertex
+{
+  float position[3];
+  float normal[3];
+};
+
+struct SceneMesh
+{
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  int32_t vertexOffset;
+  float radius; // Bounding sphere at the origin, scaled by the object
+};
+
+struct CullConstants // cull.comp / compact.comp push constants
+{
+  float frustumPlanes[6][4]; // xyz normal pointing inside, w distance
+  uint32_t objectCount;
+  uint32_t batchCount;
+  uint32_t materialCount;
+  uint32_t padding;
+};
+
+struct SceneDrawConstants // scene.vert push constants
+{
+  float viewProjection[16]; // Column-major
+  uint32_t instanceBase; // Batch base of the per-batch fallback, 0 when firstInstance carries it
+};
+
+struct SceneFrame
+{
+  AllocatedBuffer draws; // Header + commands, reset from the template every frame
+  AllocatedBuffer visible; // Visible object indices, batch ranges
+  AllocatedBuffer compacted; // Non-empty commands (drawIndirectCount only)
+  AllocatedBuffer readback; // Visible count for the statistics
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  bool statsWritten = false; // Submitted, readback not collected yet
+};
+
+struct SceneStats
+{
+  uint64_t frames = 0;
+  uint64_t visibleInstances = 0;
+  BenchClock::time_point first;
+  BenchClock::time_point last;
+};
+
+uint32_t g_sceneObjectCount = 0; // 0: no scene
+std::vector<SceneMesh> g_sceneMeshes;
+std::vector<uint32_t> g_sceneBatchBases; // First visible list entry of each batch
+AllocatedBuffer g_sceneVertices;
+AllocatedBuffer g_sceneIndices;
+AllocatedBuffer g_sceneObjects; // All the SoA arrays and the per-mesh / per-material tables, one after another
+VkDeviceSize g_sceneObjectOffsets[SCENE_BINDING_DRAWS] = {};
+VkDeviceSize g_sceneObjectSizes[SCENE_BINDING_DRAWS] = {};
+AllocatedBuffer g_sceneDrawTemplate; // Header zeroed, commands with instanceCount 0
+std::vector<SceneFrame> g_sceneFrames;
+VkDescriptorSetLayout g_sceneSetLayout = VK_NULL_HANDLE;
+VkDescriptorPool g_sceneDescriptorPool = VK_NULL_HANDLE;
+VkPipelineLayout g_cullPipelineLayout = VK_NULL_HANDLE;
+VkPipelineLayout g_scenePipelineLayout = VK_NULL_HANDLE;
+VkPipeline g_cullPipeline = VK_NULL_HANDLE;
+VkPipeline g_compactPipeline = VK_NULL_HANDLE;
+VkPipeline g_scenePipeline = VK_NULL_HANDLE;
+uint64_t g_sceneUploadTicket = 0; // Last upload of createScene()
+bool g_sceneReady = false; // Uploads acquired: set by prepareSceneFrame(), read by the passes and the draw work
+uint64_t g_sceneFrameNumber = 0; // Animates the camera, advanced by prepareSceneFrame()
+SceneStats g_sceneStats;
+
+static uint32_t sceneBatchCount()
+{
+  return static_cast<uint32_t>(g_sceneMeshes.size()) * SCENE_MATERIAL_COUNT;
+}
+
+// Flat shaded meshes (every face has its own vertices) built from triangles of corner positions, normals from the winding.
+static void addSceneMesh(const std::vector<std::array<float, 3>>& corners, std::vector<SceneVertex>& vertices, std::vector<uint16_t>& indices)
+{
+  SceneMesh mesh = { static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(corners.size()), static_cast<int32_t>(vertices.size()), 0.0f };
+  for(size_t i = 0; i < corners.size(); i += 3)
+  {
+    const std::array<float, 3>& a = corners[i];
+    const std::array<float, 3>& b = corners[i + 1];
+    const std::array<float, 3>& c = corners[i + 2];
+    float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    float n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for(const std::array<float, 3>* corner : { &a, &b, &c })
+    {
+      indices.push_back(static_cast<uint16_t>(vertices.size() - mesh.vertexOffset));
+      vertices.push_back({ { (*corner)[0], (*corner)[1], (*corner)[2] }, { n[0] / length, n[1] / length, n[2] / length } });
+      mesh.radius = std::max(mesh.radius, std::sqrt((*corner)[0] * (*corner)[0] + (*corner)[1] * (*corner)[1] + (*corner)[2] * (*corner)[2]));
+    }
+  }
+  g_sceneMeshes.push_back(mesh);
+}
+
+static void buildSceneMeshes(std::vector<SceneVertex>& vertices, std::vector<uint16_t>& indices)
+{
+  std::vector<std::array<float, 3>> cube;
+  const float p[8][3] = { {-1,-1,-1}, {1,-1,-1}, {1,1,-1}, {-1,1,-1}, {-1,-1,1}, {1,-1,1}, {1,1,1}, {-1,1,1} };
+  const uint32_t quads[6][4] = { {0,3,2,1}, {4,5,6,7}, {0,1,5,4}, {3,7,6,2}, {0,4,7,3}, {1,2,6,5} }; // Counter-clockwise seen from outside
+  for(const auto& q : quads)
+  {
+    for(uint32_t corner : { q[0], q[1], q[2], q[0], q[2], q[3] }) cube.push_back({ p[corner][0], p[corner][1], p[corner][2] });
+  }
+  addSceneMesh(cube, vertices, indices);
+
+  std::vector<std::array<float, 3>> octahedron;
+  for(float x : { -1.0f, 1.0f }) for(float y : { -1.0f, 1.0f }) for(float z : { -1.0f, 1.0f })
+  {
+    bool flip = (x * y * z) < 0.0f; // Keep every face counter-clockwise from outside
+    octahedron.push_back({ x, 0, 0 });
+    octahedron.push_back(flip ? std::array<float, 3>{ 0, 0, z } : std::array<float, 3>{ 0, y, 0 });
+    octahedron.push_back(flip ? std::array<float, 3>{ 0, y, 0 } : std::array<float, 3>{ 0, 0, z });
+  }
+  addSceneMesh(octahedron, vertices, indices);
+
+  const float t[4][3] = { {1,1,1}, {1,-1,-1}, {-1,1,-1}, {-1,-1,1} };
+  const uint32_t faces[4][3] = { {0,1,2}, {0,3,1}, {0,2,3}, {1,3,2} };
+  std::vector<std::array<float, 3>> tetrahedron;
+  for(const auto& f : faces) for(uint32_t corner : f) tetrahedron.push_back({ t[corner][0], t[corner][1], t[corner][2] });
+  addSceneMesh(tetrahedron, vertices, indices);
+}
+
+// Vulkan clip space: y down, depth 0..1. Column-major like GLSL.
+static void sceneViewProjection(uint64_t frameNumber, float viewProjection[16])
+{
+  float aspect = static_cast<float>(g_swapChainExtent.width) / static_cast<float>(std::max(1u, g_swapChainExtent.height));
+  float f = 1.0f / std::tan(0.5f * 1.0471976f); // 60 degree vertical field of view
+  float zNear = 0.5f;
+  float zFar = 4.0f * SCENE_OBJECT_SPACING * std::cbrt(static_cast<float>(g_sceneObjectCount));
+  float yaw = static_cast<float>(frameNumber % 3600) * (6.2831853f / 3600.0f); // Camera at the center, turning around
+  float forward[3] = { std::sin(yaw), 0.0f, std::cos(yaw) };
+  float right[3] = { std::cos(yaw), 0.0f, -std::sin(yaw) };
+  float up[3] = { 0.0f, -1.0f, 0.0f }; // Clip space y points down
+
+  float projection[4] = { f / aspect, f, zFar / (zFar - zNear), -zNear * zFar / (zFar - zNear) };
+  for(uint32_t column = 0; column < 4; column++) // View is a rotation only (camera at the origin): rows right, up, forward
+  {
+    float x = column < 3 ? right[column] : 0.0f;
+    float y = column < 3 ? up[column] : 0.0f;
+    float z = column < 3 ? forward[column] : 0.0f;
+    float w = column < 3 ? 0.0f : 1.0f;
+    viewProjection[column * 4 + 0] = projection[0] * x;
+    viewProjection[column * 4 + 1] = projection[1] * y;
+    viewProjection[column * 4 + 2] = projection[2] * z + projection[3] * w;
+    viewProjection[column * 4 + 3] = z;
+  }
+}
+
+// Gribb-Hartmann: the planes are sums of the matrix rows, normalized so that the sphere test can use the radius directly.
+static void sceneFrustumPlanes(const float m[16], float planes[6][4])
+{
+  auto row = [&](uint32_t r, uint32_t c) { return m[c * 4 + r]; };
+  for(uint32_t c = 0; c < 4; c++)
+  {
+    planes[0][c] = row(3, c) + row(0, c); // Left
+    planes[1][c] = row(3, c) - row(0, c); // Right
+    planes[2][c] = row(3, c) + row(1, c); // Top (y down)
+    planes[3][c] = row(3, c) - row(1, c); // Bottom
+    planes[4][c] = row(2, c); // Near (depth 0..1)
+    planes[5][c] = row(3, c) - row(2, c); // Far
+  }
+  for(uint32_t i = 0; i < 6; i++)
+  {
+    float length = std::sqrt(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+    for(uint32_t c = 0; c < 4; c++) planes[i][c] /= length;
+  }
+}
+
+static VkPipeline buildComputePipeline(VkPipelineCache pipelineCache, const char* shaderFile)
+{
+  VkComputePipelineCreateInfo pipelineCreateInfo = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+  pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineCreateInfo.stage.module = loadShaderModule(shaderFile);
+  pipelineCreateInfo.stage.pName = "main";
+  pipelineCreateInfo.layout = g_cullPipelineLayout;
+
+  VkPipeline pipeline;
+  CHECK_VULKAN_ERRORS( vkCreateComputePipelines(g_device, pipelineCache, 1, &pipelineCreateInfo, g_allocator, &pipeline) );
+  return pipeline;
+}
+
+static VkPipeline buildScenePipeline(VkPipelineCache pipelineCache)
+{
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = loadShaderModule("shaders/scene.vert.spv");
+  stages[0].pName = "main";
+  stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = loadShaderModule("shaders/triangle.frag.spv");
+  stages[1].pName = "main";
+
+  VkVertexInputBindingDescription binding = { 0, sizeof(SceneVertex), VK_VERTEX_INPUT_RATE_VERTEX };
+  VkVertexInputAttributeDescription attributes[2] = { { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SceneVertex, position) }, { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SceneVertex, normal) } };
+  VkPipelineVertexInputStateCreateInfo vertexInput = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+  vertexInput.vertexBindingDescriptionCount = 1;
+  vertexInput.pVertexBindingDescriptions = &binding;
+  vertexInput.vertexAttributeDescriptionCount = 2;
+  vertexInput.pVertexAttributeDescriptions = attributes;
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkPipelineViewportStateCreateInfo viewportState = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+  viewportState.viewportCount = 1; // Dynamic
+  viewportState.scissorCount = 1;
+  VkPipelineRasterizationStateCreateInfo rasterization = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+  rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterization.cullMode = VK_CULL_MODE_BACK_BIT; // Convex meshes: without a depth buffer this keeps each object right
+  rasterization.frontFace = VK_FRONT_FACE_CLOCKWISE; // Counter-clockwise from outside, mirrored by the y down clip space
+  rasterization.lineWidth = 1.0f;
+  VkPipelineMultisampleStateCreateInfo multisample = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+  multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  VkPipelineColorBlendAttachmentState blendAttachment = {};
+  blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  VkPipelineColorBlendStateCreateInfo colorBlend = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+  colorBlend.attachmentCount = 1;
+  colorBlend.pAttachments = &blendAttachment;
+  VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  VkPipelineDynamicStateCreateInfo dynamicState = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
+
+  VkGraphicsPipelineCreateInfo pipelineCreateInfo = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+  pipelineCreateInfo.stageCount = 2;
+  pipelineCreateInfo.pStages = stages;
+  pipelineCreateInfo.pVertexInputState = &vertexInput;
+  pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+  pipelineCreateInfo.pViewportState = &viewportState;
+  pipelineCreateInfo.pRasterizationState = &rasterization;
+  pipelineCreateInfo.pMultisampleState = &multisample;
+  pipelineCreateInfo.pColorBlendState = &colorBlend;
+  pipelineCreateInfo.pDynamicState = &dynamicState;
+  pipelineCreateInfo.layout = g_scenePipelineLayout;
+  pipelineCreateInfo.renderPass = g_renderPass;
+  pipelineCreateInfo.subpass = 0;
+
+  VkPipeline pipeline;
+  CHECK_VULKAN_ERRORS( vkCreateGraphicsPipelines(g_device, pipelineCache, 1, &pipelineCreateInfo, g_allocator, &pipeline) );
+  return pipeline;
+}
+
+static void createSceneDescriptors(uint32_t frameSlots)
+{
+  VkDescriptorSetLayoutBinding bindings[SCENE_BINDING_COUNT] = {};
+  for(uint32_t i = 0; i < SCENE_BINDING_COUNT; i++)
+  {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+  setLayoutCreateInfo.bindingCount = SCENE_BINDING_COUNT;
+  setLayoutCreateInfo.pBindings = bindings;
+  CHECK_VULKAN_ERRORS( vkCreateDescriptorSetLayout(g_device, &setLayoutCreateInfo, g_allocator, &g_sceneSetLayout) );
+
+  VkPushConstantRange cullRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants) };
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+  pipelineLayoutCreateInfo.setLayoutCount = 1;
+  pipelineLayoutCreateInfo.pSetLayouts = &g_sceneSetLayout;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+  pipelineLayoutCreateInfo.pPushConstantRanges = &cullRange;
+  CHECK_VULKAN_ERRORS( vkCreatePipelineLayout(g_device, &pipelineLayoutCreateInfo, g_allocator, &g_cullPipelineLayout) );
+  VkPushConstantRange drawRange = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(SceneDrawConstants) };
+  pipelineLayoutCreateInfo.pPushConstantRanges = &drawRange;
+  CHECK_VULKAN_ERRORS( vkCreatePipelineLayout(g_device, &pipelineLayoutCreateInfo, g_allocator, &g_scenePipelineLayout) );
+
+  VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, SCENE_BINDING_COUNT * frameSlots };
+  VkDescriptorPoolCreateInfo poolCreateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+  poolCreateInfo.maxSets = frameSlots;
+  poolCreateInfo.poolSizeCount = 1;
+  poolCreateInfo.pPoolSizes = &poolSize;
+  CHECK_VULKAN_ERRORS( vkCreateDescriptorPool(g_device, &poolCreateInfo, g_allocator, &g_sceneDescriptorPool) );
+
+  // The buffers never change: every slot's set is written once
+  for(SceneFrame& frame : g_sceneFrames)
+  {
+    VkDescriptorSetAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    allocateInfo.descriptorPool = g_sceneDescriptorPool;
+    allocateInfo.descriptorSetCount = 1;
+    allocateInfo.pSetLayouts = &g_sceneSetLayout;
+    CHECK_VULKAN_ERRORS( vkAllocateDescriptorSets(g_device, &allocateInfo, &frame.descriptorSet) );
+
+    VkDescriptorBufferInfo bufferInfos[SCENE_BINDING_COUNT];
+    for(uint32_t i = 0; i < SCENE_BINDING_DRAWS; i++) bufferInfos[i] = { g_sceneObjects.buffer, g_sceneObjectOffsets[i], g_sceneObjectSizes[i] };
+    bufferInfos[SCENE_BINDING_DRAWS] = { frame.draws.buffer, 0, VK_WHOLE_SIZE };
+    bufferInfos[SCENE_BINDING_VISIBLE] = { frame.visible.buffer, 0, VK_WHOLE_SIZE };
+    bufferInfos[SCENE_BINDING_COMPACTED] = { frame.compacted.buffer, 0, VK_WHOLE_SIZE };
+    VkWriteDescriptorSet writes[SCENE_BINDING_COUNT];
+    for(uint32_t i = 0; i < SCENE_BINDING_COUNT; i++)
+    {
+      writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+      writes[i].dstSet = frame.descriptorSet;
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    vkUpdateDescriptorSets(g_device, SCENE_BINDING_COUNT, writes, 0, nullptr);
+  }
+}
+
+// Copies the data into a device local buffer through the upload ring (in pieces: the ring is smaller than big scenes).
+static void uploadSceneData(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+  const VkDeviceSize piece = STAGING_RING_SIZE / 4;
+  for(VkDeviceSize done = 0; done < size; done += piece)
+  {
+    g_sceneUploadTicket = uploadBuffer(buffer, offset + done, static_cast<const char*>(data) + done, std::min(piece, size - done), dstAccess, dstStage);
+  }
+}
+
+// Render graph passes before the main pass, the graph placing the barriers between them: reset the slot's commands, cull,
+// optionally compact, and copy the visible count for the statistics. Nothing is recorded until the uploads are acquired.
+// Prepare of the reset pass: before the draw work's recording jobs start, they read these too.
+static void prepareSceneFrame(const RenderGraphContext&)
+{
+  g_sceneFrameNumber++;
+  g_sceneReady = g_sceneReady || uploadComplete(g_sceneUploadTicket); // Everything createScene() uploaded has been acquired
+}
+
+static void recordSceneReset(const RenderGraphContext& context)
+{
+  if(!g_sceneReady) return;
+  VkBufferCopy reset = { 0, 0, SCENE_DRAWS_HEADER + sceneBatchCount() * sizeof(VkDrawIndexedIndirectCommand) };
+  vkCmdCopyBuffer(context.commandBuffer, g_sceneDrawTemplate.buffer, g_sceneFrames[context.slot].draws.buffer, 1, &reset);
+}
+
+static void recordSceneCull(const RenderGraphContext& context)
+{
+  if(!g_sceneReady) return;
+  CullConstants constants = {};
+  float viewProjection[16];
+  sceneViewProjection(g_sceneFrameNumber, viewProjection);
+  sceneFrustumPlanes(viewProjection, constants.frustumPlanes);
+  constants.objectCount = g_sceneObjectCount;
+  constants.batchCount = sceneBatchCount();
+  constants.materialCount = SCENE_MATERIAL_COUNT;
+  vkCmdBindDescriptorSets(context.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, g_cullPipelineLayout, 0, 1, &g_sceneFrames[context.slot].descriptorSet, 0, nullptr);
+  vkCmdPushConstants(context.commandBuffer, g_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+  vkCmdBindPipeline(context.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, g_cullPipeline);
+  vkCmdDispatch(context.commandBuffer, (g_sceneObjectCount + SCENE_CULL_GROUP_SIZE - 1) / SCENE_CULL_GROUP_SIZE, 1, 1);
+}
+
+static void recordSceneCompact(const RenderGraphContext& context) // Descriptors and push constants still bound by the cull
+{
+  if(!g_sceneReady) return;
+  vkCmdBindPipeline(context.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, g_compactPipeline);
+  vkCmdDispatch(context.commandBuffer, (sceneBatchCount() + SCENE_CULL_GROUP_SIZE - 1) / SCENE_CULL_GROUP_SIZE, 1, 1);
+}
+
+static void recordSceneStats(const RenderGraphContext& context)
+{
+  if(!g_sceneReady) return;
+  SceneFrame& frame = g_sceneFrames[context.slot];
+  VkBufferCopy visibleCount = { sizeof(uint32_t), 0, sizeof(uint32_t) }; // Header: draw count, visible count
+  vkCmdCopyBuffer(context.commandBuffer, frame.draws.buffer, frame.readback.buffer, 1, &visibleCount);
+  frame.statsWritten = true;
+}
+
+// Draw work: one item, every object of the scene.
+static void recordSceneDraws(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+  if(!g_sceneReady) return;
+  SceneFrame& frame = g_sceneFrames[slot];
+  uint32_t batchCount = sceneBatchCount();
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_scenePipeline);
+  recordViewportAndScissor(commandBuffer);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, g_scenePipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+  VkDeviceSize vertexOffset = 0;
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, &g_sceneVertices.buffer, &vertexOffset);
+  vkCmdBindIndexBuffer(commandBuffer, g_sceneIndices.buffer, 0, VK_INDEX_TYPE_UINT16);
+
+  SceneDrawConstants constants = {};
+  sceneViewProjection(g_sceneFrameNumber, constants.viewProjection);
+  const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+  if(g_multiDrawIndirect)
+  {
+    vkCmdPushConstants(commandBuffer, g_scenePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+    if(g_drawIndirectCount) vkCmdDrawIndexedIndirectCount(commandBuffer, frame.compacted.buffer, 0, frame.draws.buffer, 0, batchCount, stride);
+    else vkCmdDrawIndexedIndirect(commandBuffer, frame.draws.buffer, SCENE_DRAWS_HEADER, batchCount, stride);
+    return;
+  }
+  for(uint32_t batch = 0; batch < batchCount; batch++) // firstInstance must be 0: the batch base comes in the push constants
+  {
+    constants.instanceBase = g_sceneBatchBases[batch];
+    vkCmdPushConstants(commandBuffer, g_scenePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+    vkCmdDrawIndexedIndirect(commandBuffer, frame.draws.buffer, SCENE_DRAWS_HEADER + batch * stride, 1, stride);
+  }
+}
+
+// Random objects in a cube around the camera, uploaded before the first frame. After createMainPass(), before compilePipelines().
+void createScene(uint32_t objectCount, uint32_t frameSlots)
+{
+  g_sceneObjectCount = objectCount;
+  std::vector<SceneVertex> vertices;
+  std::vector<uint16_t> indices;
+  buildSceneMeshes(vertices, indices);
+  uint32_t batchCount = sceneBatchCount();
+
+  std::mt19937 random(1234); // Same scene every run: comparable benchmarks
+  float halfSize = 0.5f * SCENE_OBJECT_SPACING * std::cbrt(static_cast<float>(objectCount));
+  std::uniform_real_distribution<float> position(-halfSize, halfSize);
+  std::uniform_real_distribution<float> scale(0.3f, 1.0f);
+  std::vector<float> transforms(objectCount * 4);
+  std::vector<uint32_t> objectMeshes(objectCount);
+  std::vector<uint32_t> objectMaterials(objectCount);
+  std::vector<uint32_t> batchSizes(batchCount, 0);
+  for(uint32_t i = 0; i < objectCount; i++)
+  {
+    transforms[i * 4 + 0] = position(random);
+    transforms[i * 4 + 1] = position(random);
+    transforms[i * 4 + 2] = position(random);
+    transforms[i * 4 + 3] = scale(random);
+    objectMeshes[i] = random() % g_sceneMeshes.size();
+    objectMaterials[i] = random() % SCENE_MATERIAL_COUNT;
+    batchSizes[objectMeshes[i] * SCENE_MATERIAL_COUNT + objectMaterials[i]]++;
+  }
+
+  // Every batch owns a range of the visible list as big as its object count: the cull never overflows into another batch
+  std::vector<char> drawTemplate(SCENE_DRAWS_HEADER + batchCount * sizeof(VkDrawIndexedIndirectCommand), 0);
+  VkDrawIndexedIndirectCommand* commands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(drawTemplate.data() + SCENE_DRAWS_HEADER);
+  g_sceneBatchBases.assign(batchCount, 0);
+  for(uint32_t batch = 0, base = 0; batch < batchCount; base += batchSizes[batch], batch++)
+  {
+    const SceneMesh& mesh = g_sceneMeshes[batch / SCENE_MATERIAL_COUNT];
+    g_sceneBatchBases[batch] = base;
+    commands[batch] = { mesh.indexCount, 0, mesh.firstIndex, mesh.vertexOffset, g_multiDrawIndirect ? base : 0 };
+  }
+  std::vector<float> meshRadii;
+  for(const SceneMesh& mesh : g_sceneMeshes) meshRadii.push_back(mesh.radius);
+  const float materialColors[SCENE_MATERIAL_COUNT][4] = { {0.9f, 0.3f, 0.2f, 1}, {0.2f, 0.8f, 0.3f, 1}, {0.2f, 0.4f, 0.9f, 1}, {0.9f, 0.8f, 0.2f, 1} };
+
+  // The SoA arrays and tables, one after another in one buffer (offsets aligned for the storage buffer descriptors)
+  const void* arrays[SCENE_BINDING_DRAWS] = { transforms.data(), objectMeshes.data(), objectMaterials.data(), g_sceneBatchBases.data(), meshRadii.data(), materialColors };
+  g_sceneObjectSizes[SCENE_BINDING_TRANSFORMS] = transforms.size() * sizeof(float);
+  g_sceneObjectSizes[SCENE_BINDING_MESHES] = objectMeshes.size() * sizeof(uint32_t);
+  g_sceneObjectSizes[SCENE_BINDING_MATERIALS] = objectMaterials.size() * sizeof(uint32_t);
+  g_sceneObjectSizes[SCENE_BINDING_BATCH_BASES] = g_sceneBatchBases.size() * sizeof(uint32_t);
+  g_sceneObjectSizes[SCENE_BINDING_MESH_RADII] = meshRadii.size() * sizeof(float);
+  g_sceneObjectSizes[SCENE_BINDING_MATERIAL_COLORS] = sizeof(materialColors);
+  VkDeviceSize alignment = std::max<VkDeviceSize>(16, g_properties.limits.minStorageBufferOffsetAlignment);
+  VkDeviceSize objectBytes = 0;
+  for(uint32_t i = 0; i < SCENE_BINDING_DRAWS; i++)
+  {
+    g_sceneObjectOffsets[i] = objectBytes;
+    objectBytes = (objectBytes + g_sceneObjectSizes[i] + alignment - 1) & ~(alignment - 1);
+  }
+
+  VkBufferUsageFlags dst = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  g_sceneVertices = createBuffer(vertices.size() * sizeof(SceneVertex), dst | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MemoryUsage::GpuOnly);
+  g_sceneIndices = createBuffer(indices.size() * sizeof(uint16_t), dst | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, MemoryUsage::GpuOnly);
+  g_sceneObjects = createBuffer(objectBytes, dst | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemoryUsage::GpuOnly);
+  g_sceneDrawTemplate = createBuffer(drawTemplate.size(), dst | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::GpuOnly);
+  uploadSceneData(g_sceneVertices.buffer, 0, vertices.data(), vertices.size() * sizeof(SceneVertex), VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+  uploadSceneData(g_sceneIndices.buffer, 0, indices.data(), indices.size() * sizeof(uint16_t), VK_ACCESS_INDEX_READ_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+  for(uint32_t i = 0; i < SCENE_BINDING_DRAWS; i++)
+  {
+    uploadSceneData(g_sceneObjects.buffer, g_sceneObjectOffsets[i], arrays[i], g_sceneObjectSizes[i], VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+  }
+  uploadSceneData(g_sceneDrawTemplate.buffer, 0, drawTemplate.data(), drawTemplate.size(), VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+  waitForUploads(); // Loading: the first frame acquires everything
+
+  g_sceneFrames.resize(frameSlots);
+  for(SceneFrame& frame : g_sceneFrames)
+  {
+    frame.draws = createBuffer(drawTemplate.size(), dst | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::GpuOnly);
+    frame.visible = createBuffer(std::max(1u, objectCount) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemoryUsage::GpuOnly);
+    frame.compacted = createBuffer(batchCount * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, MemoryUsage::GpuOnly);
+    frame.readback = createBuffer(sizeof(uint32_t), dst, MemoryUsage::GpuToCpu);
+  }
+  createSceneDescriptors(frameSlots);
+
+  addPipeline("scene cull", { "shaders/cull.comp.spv" }, [](VkPipelineCache pipelineCache) { return buildComputePipeline(pipelineCache, "shaders/cull.comp.spv"); }, &g_cullPipeline);
+  if(g_drawIndirectCount) addPipeline("scene compact", { "shaders/compact.comp.spv" }, [](VkPipelineCache pipelineCache) { return buildComputePipeline(pipelineCache, "shaders/compact.comp.spv"); }, &g_compactPipeline);
+  addPipeline("scene", { "shaders/scene.vert.spv", "shaders/triangle.frag.spv" }, buildScenePipeline, &g_scenePipeline);
+
+  uint32_t draws = importRenderGraphBuffer("scene draws"); // The current slot's buffers
+  uint32_t visible = importRenderGraphBuffer("scene visible");
+  uint32_t compacted = importRenderGraphBuffer("scene compacted");
+  uint32_t readback = importRenderGraphBuffer("scene readback", RG_HOST_READ);
+  addRenderGraphPass("scene reset", RENDER_GRAPH_TRANSFER, recordSceneReset, "main pass");
+  setRenderGraphPassPrepare("scene reset", prepareSceneFrame);
+  addRenderGraphAccess("scene reset", draws, RG_TRANSFER_WRITE);
+  addRenderGraphPass("scene cull", RENDER_GRAPH_COMPUTE, recordSceneCull, "main pass");
+  addRenderGraphAccess("scene cull", draws, RG_COMPUTE_WRITE);
+  addRenderGraphAccess("scene cull", visible, RG_COMPUTE_WRITE);
+  if(g_drawIndirectCount)
+  {
+    addRenderGraphPass("scene compact", RENDER_GRAPH_COMPUTE, recordSceneCompact, "main pass");
+    addRenderGraphAccess("scene compact", draws, RG_COMPUTE_WRITE); // atomicAdd on drawCount
+    addRenderGraphAccess("scene compact", compacted, RG_COMPUTE_WRITE);
+    addRenderGraphAccess("main pass", compacted, RG_INDIRECT_READ);
+  }
+  addRenderGraphPass("scene stats", RENDER_GRAPH_TRANSFER, recordSceneStats, "main pass");
+  addRenderGraphAccess("scene stats", draws, RG_TRANSFER_READ);
+  addRenderGraphAccess("scene stats", readback, RG_TRANSFER_WRITE);
+  addRenderGraphAccess("main pass", draws, RG_INDIRECT_READ);
+  addRenderGraphAccess("main pass", visible, RG_VERTEX_READ);
+  addDrawWork(recordSceneDraws);
+  std::cout << "Scene: " << objectCount << " objects in " << batchCount << " batches, " << (g_drawIndirectCount ? "indirect count" : g_multiDrawIndirect ? "multi-draw indirect" : "indirect per batch") << std::endl;
+}
+
+// Call only after the slot's frame fence has signaled.
+void collectSceneStats(uint32_t slot)
+{
+  if(g_sceneFrames.empty() || !g_sceneFrames[slot].statsWritten) return;
+  SceneFrame& frame = g_sceneFrames[slot];
+  frame.statsWritten = false;
+  BenchClock::time_point now = BenchClock::now();
+  if(g_sceneStats.frames == 0) g_sceneStats.first = now; // Throughput over the frames after the first one completed
+  else g_sceneStats.visibleInstances += *static_cast<const uint32_t*>(frame.readback.allocation.mapped);
+  g_sceneStats.last = now;
+  g_sceneStats.frames++;
+}
+
+void reportSceneStats()
+{
+  if(g_sceneStats.frames < 2) return;
+  double seconds = std::chrono::duration<double>(g_sceneStats.last - g_sceneStats.first).count();
+  uint64_t frames = g_sceneStats.frames - 1;
+  std::cout << "Scene: " << g_sceneObjectCount << " objects culled per frame, " << g_sceneStats.visibleInstances / frames << " visible instances drawn per frame on average" << std::endl;
+  std::cout << "Scene throughput: " << g_sceneObjectCount * frames / seconds / 1.0e6 << " M objects/s culled, " << g_sceneStats.visibleInstances / seconds / 1.0e6 << " M instances/s drawn (" << frames / seconds << " frames/s)" << std::endl;
+}
+
+// After vkDeviceWaitIdle. The pipelines are destroyed with the others (destroyPipelines()).
+void destroyScene()
+{
+  if(g_sceneObjectCount == 0) return;
+  for(SceneFrame& frame : g_sceneFrames)
+  {
+    destroyBuffer(frame.readback);
+    destroyBuffer(frame.compacted);
+    destroyBuffer(frame.visible);
+    destroyBuffer(frame.draws);
+  }
+  g_sceneFrames.clear();
+  vkDestroyDescriptorPool(g_device, g_sceneDescriptorPool, g_allocator);
+  vkDestroyPipelineLayout(g_device, g_scenePipelineLayout, g_allocator);
+  vkDestroyPipelineLayout(g_device, g_cullPipelineLayout, g_allocator);
+  vkDestroyDescriptorSetLayout(g_device, g_sceneSetLayout, g_allocator);
+  destroyBuffer(g_sceneDrawTemplate);
+  destroyBuffer(g_sceneObjects);
+  destroyBuffer(g_sceneIndices);
+  destroyBuffer(g_sceneVertices);
+  g_sceneObjectCount = 0;
+}
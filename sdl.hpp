@@ -1,12 +1,14 @@
 #pragma once
 #include "common.hpp"
+#include "input.hpp"
+#include "profiler.hpp"
 
 SDL_Window* g_window;
 
 int createWindow(std::string window_name, uint32_t width, uint32_t height)
 {
-//  const uint32_t window_setting_flags = SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_VULKAN;
-  const uint32_t window_setting_flags = SDL_WINDOW_SHOWN | SDL_WINDOW_VULKAN;
+  PROFILE_FUNCTION();
+  const uint32_t window_setting_flags = SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_VULKAN;
   const uint32_t centered = SDL_WINDOWPOS_CENTERED;
 
   SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
@@ -28,48 +30,57 @@ int createWindow(std::string window_name, uint32_t width, uint32_t height)
   return EXIT_SUCCESS;
 }
 
-static void handlePossibleResizeEvent(const SDL_Event &event)
+static void handleWindowEvent(const SDL_WindowEvent& windowEvent, uint64_t arrival)
 {
-  if(event.window.event == SDL_WINDOWEVENT_RESIZED)
+  if(windowEvent.event == SDL_WINDOWEVENT_RESIZED || windowEvent.event == SDL_WINDOWEVENT_SIZE_CHANGED) // SIZE_CHANGED covers fullscreen toggles too
   {
-    uint32_t new_width = event.window.data1;
-    uint32_t new_height = event.window.data2;
-    if( (new_width > 0) && (new_height > 0) && ( (new_width != g_width) || (new_height != g_height) ) )
-    {
-      g_width = new_width;
-      g_height = new_height;
-      // recreateSwapChain();
-    }
+    pushInputEvent({ INPUT_RESIZE, arrival, 0, static_cast<uint32_t>(windowEvent.data1), static_cast<uint32_t>(windowEvent.data2) });
   }
+  else if(windowEvent.event == SDL_WINDOWEVENT_MINIMIZED) pushInputEvent({ INPUT_MINIMIZE, arrival, 0, 0, 0 });
+  else if(windowEvent.event == SDL_WINDOWEVENT_RESTORED || windowEvent.event == SDL_WINDOWEVENT_MAXIMIZED) pushInputEvent({ INPUT_RESTORE, arrival, 0, 0, 0 });
 }
 
-static void handleKeyDown(const SDL_KeyboardEvent &key_event)
+static void toggleFullscreen()
 {
-  if(key_event.keysym.sym == SDLK_ESCAPE) g_quitFlag = true;
+  bool fullscreen = (SDL_GetWindowFlags(g_window) & SDL_WINDOW_FULLSCREEN_DESKTOP) == SDL_WINDOW_FULLSCREEN_DESKTOP;
+  if(SDL_SetWindowFullscreen(g_window, fullscreen ? 0 : SDL_WINDOW_FULLSCREEN_DESKTOP) != 0) std::cerr << "SDL Error: " << SDL_GetError() << std::endl;
 }
 
-void pollEvents()
+static void handleEvent(const SDL_Event& event)
 {
-  SDL_Event event;
-  while(SDL_PollEvent(&event))
+  uint64_t arrival = SDL_GetPerformanceCounter(); // Pumped as soon as it arrives: this is its arrival time
+  switch(event.type)
   {
-    switch(event.type)
-    {
-      case SDL_EventType::SDL_QUIT:
-        g_quitFlag = true;
-        break;
-      case SDL_EventType::SDL_WINDOWEVENT:
-//        handlePossibleResizeEvent(event);
-        break;
-      case SDL_EventType::SDL_KEYDOWN:
-        handleKeyDown(event.key);
-        break;
-      default:
-        break;
-    }
+    case SDL_EventType::SDL_QUIT:
+      g_quitFlag = true;
+      break;
+    case SDL_EventType::SDL_WINDOWEVENT:
+      handleWindowEvent(event.window, arrival);
+      break;
+    case SDL_EventType::SDL_KEYDOWN:
+      if(event.key.keysym.sym == SDLK_ESCAPE) g_quitFlag = true;
+      if(event.key.keysym.sym == SDLK_F11) toggleFullscreen(); // Window calls stay on the thread which created it
+      pushInputEvent({ INPUT_KEY_DOWN, arrival, event.key.keysym.sym, 0, 0 });
+      break;
+    case SDL_EventType::SDL_MOUSEBUTTONDOWN:
+      pushInputEvent({ INPUT_MOUSE_BUTTON_DOWN, arrival, 0, 0, 0 });
+      break;
+    default:
+      break;
   }
 }
 
+// Main thread, in a loop while the render thread draws: sleeps until events arrive and hands them over right away.
+void pumpEvents()
+{
+  SDL_Event event;
+  if(!SDL_WaitEventTimeout(&event, 10)) return; // Wakes up now and then to notice g_quitFlag set by the render thread
+  do
+  {
+    handleEvent(event);
+  } while(SDL_PollEvent(&event));
+}
+
 int destroyWindow()
 {
   SDL_DestroyWindow(g_window);
@@ -0,0 +1,170 @@
+#pragma once
+#include "common.hpp"
+
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Shader modules: .spv files (built by "make shaders") are memory-mapped instead of read into a copy, and modules are
+// deduplicated by content hash, so the same SPIR-V used by many pipelines (or under many names) is created only once.
+// Hot reload (TEMPLATE_HOT_RELOAD=1) watches the loaded files and rebuilds only the pipelines using a changed one.
+
+const uint32_t SPIRV_MAGIC = 0x07230203;
+
+struct MappedFile
+{
+  const uint32_t* data = nullptr; // SPIR-V words (mappings are page aligned)
+  size_t size = 0; // Bytes
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+};
+
+struct ShaderFile
+{
+  uint64_t hash = 0; // Content currently loaded
+  std::filesystem::file_time_type writeTime;
+};
+
+bool g_hotReload = false; // TEMPLATE_HOT_RELOAD=1
+std::unordered_map<uint64_t, VkShaderModule> g_shaderModules; // Content hash -> module
+std::unordered_map<std::string, ShaderFile> g_shaderFiles; // Path -> what was loaded from it
+std::mutex g_shaderMutex; // Pipelines (and their modules) are built on the worker threads
+
+static bool mapFile(const std::string& path, MappedFile& mapped)
+{
+#ifdef _WIN32
+  mapped.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if(mapped.file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER size;
+  GetFileSizeEx(mapped.file, &size);
+  mapped.size = static_cast<size_t>(size.QuadPart);
+  if(mapped.size == 0) return true; // Nothing to map
+  mapped.mapping = CreateFileMappingA(mapped.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if(mapped.mapping != nullptr) mapped.data = static_cast<const uint32_t*>(MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0));
+  return mapped.data != nullptr;
+#else
+  int file = open(path.c_str(), O_RDONLY);
+  if(file < 0) return false;
+  struct stat status;
+  fstat(file, &status);
+  mapped.size = static_cast<size_t>(status.st_size);
+  if(mapped.size > 0)
+  {
+    void* data = mmap(nullptr, mapped.size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(data != MAP_FAILED) mapped.data = static_cast<const uint32_t*>(data);
+  }
+  close(file); // The mapping stays valid
+  return mapped.size == 0 || mapped.data != nullptr;
+#endif
+}
+
+static void unmapFile(MappedFile& mapped)
+{
+#ifdef _WIN32
+  if(mapped.data != nullptr) UnmapViewOfFile(mapped.data);
+  if(mapped.mapping != nullptr) CloseHandle(mapped.mapping);
+  if(mapped.file != INVALID_HANDLE_VALUE) CloseHandle(mapped.file);
+#else
+  if(mapped.data != nullptr) munmap(const_cast<uint32_t*>(mapped.data), mapped.size);
+#endif
+  mapped = MappedFile();
+}
+
+// FNV-1a, 64 bit: plenty for telling shader binaries apart, no dependencies.
+static uint64_t hashBytes(const void* data, size_t size)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  uint64_t hash = 14695981039346656037ull;
+  for(size_t i = 0; i < size; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Returns the (shared) module for the file's current content. Modules live until destroyShaderModules(), or until
+// hot reload replaces the content they were made of.
+VkShaderModule loadShaderModule(const std::string& path)
+{
+  MappedFile mapped;
+  if(!mapFile(path, mapped)) throw std::runtime_error("Failed to open shader " + path + " (run \"make shaders\")");
+  if(mapped.size < 4 || mapped.size % 4 != 0 || mapped.data[0] != SPIRV_MAGIC) // Also catches files glslc is still writing
+  {
+    unmapFile(mapped);
+    std::lock_guard<std::mutex> lock(g_shaderMutex);
+    std::error_code error;
+    if(g_shaderFiles.count(path)) g_shaderFiles[path].writeTime = std::filesystem::last_write_time(path, error); // Hot reload: retry on the next write only
+    throw std::runtime_error("Invalid SPIR-V file " + path);
+  }
+  uint64_t hash = hashBytes(mapped.data, mapped.size);
+
+  std::lock_guard<std::mutex> lock(g_shaderMutex);
+  ShaderFile& shaderFile = g_shaderFiles[path];
+  shaderFile.hash = hash;
+  shaderFile.writeTime = std::filesystem::last_write_time(path);
+
+  VkShaderModule& shaderModule = g_shaderModules[hash];
+  if(shaderModule == VK_NULL_HANDLE)
+  {
+    VkShaderModuleCreateInfo shaderModuleCreateInfo = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+    shaderModuleCreateInfo.codeSize = mapped.size;
+    shaderModuleCreateInfo.pCode = mapped.data; // Read directly from the mapping, no copy
+    CHECK_VULKAN_ERRORS( vkCreateShaderModule(g_device, &shaderModuleCreateInfo, g_allocator, &shaderModule) );
+  }
+  unmapFile(mapped);
+  return shaderModule;
+}
+
+// Files whose modification time changed since they were loaded. Unreadable files (still being written) are skipped this time.
+std::vector<std::string> findChangedShaderFiles()
+{
+  std::vector<std::string> changed;
+  std::lock_guard<std::mutex> lock(g_shaderMutex);
+  for(const auto& [path, shaderFile] : g_shaderFiles)
+  {
+    std::error_code error;
+    std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(path, error);
+    if(!error && writeTime != shaderFile.writeTime) changed.push_back(path);
+  }
+  return changed;
+}
+
+// Modules no loaded file refers to anymore (old content of reloaded files). Only after the pipelines using them are rebuilt:
+// a pipeline doesn't need its modules after creation, so nothing in flight depends on them.
+void destroyUnusedShaderModules()
+{
+  std::lock_guard<std::mutex> lock(g_shaderMutex);
+  for(auto it = g_shaderModules.begin(); it != g_shaderModules.end();)
+  {
+    bool used = false;
+    for(const auto& file : g_shaderFiles) used |= (file.second.hash == it->first);
+    if(used)
+    {
+      it++;
+      continue;
+    }
+    vkDestroyShaderModule(g_device, it->second, g_allocator);
+    it = g_shaderModules.erase(it);
+  }
+}
+
+void destroyShaderModules()
+{
+  for(auto& shaderModule : g_shaderModules) vkDestroyShaderModule(g_device, shaderModule.second, g_allocator);
+  g_shaderModules.clear();
+  g_shaderFiles.clear();
+}
@@ -0,0 +1,4 @@
+// Shared by the shaders of the template: glslc -MD tracks this as a dependency of every shader including it.
+
+const vec2 TRIANGLE_POSITIONS[3] = vec2[](vec2(0.0, -0.5), vec2(0.5, 0.5), vec2(-0.5, 0.5));
+const vec3 TRIANGLE_COLORS[3] = vec3[](vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), vec3(0.0, 0.0, 1.0));
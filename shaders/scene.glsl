@@ -0,0 +1,27 @@
+// GPU-driven scene (scene.hpp): object data as one array per attribute, the same set for the cull and the draw.
+// Only the cull shaders write: they define SCENE_CULL before including this.
+
+#ifdef SCENE_CULL
+#define SCENE_OUTPUT
+#else
+#define SCENE_OUTPUT readonly
+#endif
+
+struct DrawCommand // VkDrawIndexedIndirectCommand
+{
+  uint indexCount;
+  uint instanceCount;
+  uint firstIndex;
+  int vertexOffset;
+  uint firstInstance;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer ObjectTransforms { vec4 objectTransforms[]; }; // xyz position, w scale
+layout(std430, set = 0, binding = 1) readonly buffer ObjectMeshes { uint objectMeshes[]; };
+layout(std430, set = 0, binding = 2) readonly buffer ObjectMaterials { uint objectMaterials[]; };
+layout(std430, set = 0, binding = 3) readonly buffer BatchBases { uint batchBases[]; }; // First visible list entry of each batch
+layout(std430, set = 0, binding = 4) readonly buffer MeshRadii { float meshRadii[]; };
+layout(std430, set = 0, binding = 5) readonly buffer MaterialColors { vec4 materialColors[]; };
+layout(std430, set = 0, binding = 6) SCENE_OUTPUT buffer Draws { uint drawCount; uint visibleCount; uint drawPadding[2]; DrawCommand draws[]; };
+layout(std430, set = 0, binding = 7) SCENE_OUTPUT buffer VisibleObjects { uint visibleObjects[]; };
+layout(std430, set = 0, binding = 8) SCENE_OUTPUT buffer CompactedDraws { DrawCommand compactedDraws[]; };
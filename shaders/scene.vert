@@ -0,0 +1,24 @@
+#version 450
+#include "scene.glsl"
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+
+layout(location = 0) out vec3 fragColor;
+
+layout(push_constant) uniform SceneDrawConstants
+{
+  mat4 viewProjection;
+  uint instanceBase; // Per-batch fallback only, gl_InstanceIndex includes firstInstance otherwise
+};
+
+const vec3 LIGHT_DIRECTION = vec3(0.48, -0.64, 0.6); // Normalized
+
+void main()
+{
+  uint object = visibleObjects[instanceBase + gl_InstanceIndex];
+  vec4 transform = objectTransforms[object];
+  gl_Position = viewProjection * vec4(transform.xyz + inPosition * transform.w, 1.0);
+  float light = 0.3 + 0.7 * max(dot(inNormal, LIGHT_DIRECTION), 0.0);
+  fragColor = materialColors[objectMaterials[object]].rgb * light;
+}
@@ -0,0 +1,10 @@
+#version 450
+#include "common.glsl"
+
+layout(location = 0) out vec3 fragColor;
+
+void main()
+{
+  gl_Position = vec4(TRIANGLE_POSITIONS[gl_VertexIndex], 0.0, 1.0); // No vertex buffer, positions come from the index
+  fragColor = TRIANGLE_COLORS[gl_VertexIndex];
+}
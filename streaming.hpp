@@ -0,0 +1,487 @@
+#pragma once
+#include "common.hpp"
+#include "bench.hpp"
+#include "memory.hpp"
+#include "upload.hpp"
+#include "bindless.hpp"
+#include "profiler.hpp"
+#include "shaders.hpp"
+
+#include <condition_variable>
+#include <fstream>
+#include <queue>
+#include <thread>
+
+// Texture streaming. Textures come in a GPU-ready container (.gtex): a header, a table of mip levels (offset, size,
+// extent) and the payloads, pre-mipped and already in the GPU format (BC blocks, or RGBA8 on devices without BC), so
+// loading is only moving bytes. Files are memory-mapped (like the shaders, shaders.hpp) by background I/O threads: the header and table are read in
+// place, and only the mips a request needs are touched (prefetched, then copied straight from the mapping into the
+// staging ring: the only CPU copy). The transfer queue does the rest (upload.hpp), the render thread only registers
+// finished textures in the descriptor heap (updateStreaming(), once per frame).
+// Requests are served highest priority first. A memory budget caps the resident texture memory, as does what's left of the
+// device local heap's budget (memory.hpp): a texture which doesn't fit loses its most detailed mips until it does (or isn't
+// loaded). The memory goes back to the budget when a texture fails to load or is released (releaseStreamedTexture(), once
+// the frames which may sample it have finished). Time to first pixel (request to the first texture usable) and the streaming
+// bandwidth are reported at exit.
+// TEMPLATE_STREAM_TEXTURES=N streams N generated test textures (written to streaming/ once), "make streaming" measures it.
+
+const uint32_t TEXTURE_FILE_MAGIC = 0x58455447; // "GTEX"
+const uint32_t TEXTURE_FILE_VERSION = 1;
+const uint32_t TEXTURE_FILE_MAX_MIPS = 16;
+const uint32_t STREAMING_TEST_TEXTURE_SIZE = 2048;
+
+struct TextureFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t format; // VkFormat
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipCount; // Mip table entries right after the header, most detailed first
+};
+
+struct TextureFileMip
+{
+  uint64_t offset; // From the start of the file, 16 byte aligned
+  uint64_t size;
+  uint32_t width;
+  uint32_t height;
+};
+
+struct TextureRequest
+{
+  uint32_t handle;
+  int32_t priority; // Higher first
+  uint32_t mostDetailedMip; // Mips above it (bigger) are not needed
+};
+
+struct StreamedTexture
+{
+  std::string path;
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  Allocation allocation;
+  VkDeviceSize residentBytes = 0; // Taken from g_streamingResident
+  uint32_t firstMip = 0; // Most detailed mip of the file loaded
+  uint64_t ticket = 0; // Upload of its last mip
+  uint32_t index = RESOURCE_NONE; // Descriptor heap index once usable
+  bool loaded = false; // Recorded for upload, waiting for the transfer
+  bool failed = false;
+  BenchClock::time_point requested;
+};
+
+// Released texture: destroyed once the frames which may still sample it have finished.
+struct RetiredStreamedTexture
+{
+  VkImage image;
+  VkImageView view;
+  Allocation allocation;
+  VkDeviceSize residentBytes;
+  uint64_t usedUntilFrame; // Frames numbered below this may still use it
+};
+
+struct StreamingStats
+{
+  uint64_t bytes = 0; // Payload read and uploaded
+  uint32_t textures = 0; // Usable
+  uint32_t reducedTextures = 0; // Lost mips to the budget
+  uint32_t failedTextures = 0;
+  double latencySum = 0.0; // Request to usable, ms
+  BenchClock::time_point start; // First request
+  BenchClock::time_point firstPixel;
+  BenchClock::time_point last;
+};
+
+std::vector<std::thread> g_streamingThreads;
+std::atomic<uint32_t> g_streamingThreadsRunning{0}; // Not returned yet: may be waiting for the frame thread to retire uploads
+std::vector<std::unique_ptr<StreamedTexture>> g_streamedTextures; // [handle]
+std::priority_queue<TextureRequest, std::vector<TextureRequest>, bool(*)(const TextureRequest&, const TextureRequest&)> g_textureRequests(
+  [](const TextureRequest& a, const TextureRequest& b) { return a.priority != b.priority ? a.priority < b.priority : a.handle > b.handle; }); // Same priority: in request order
+std::vector<uint32_t> g_loadedTextures; // Waiting for their upload to complete
+std::vector<RetiredStreamedTexture> g_retiredStreamedTextures;
+std::mutex g_streamingMutex;
+std::condition_variable g_streamingCondition;
+bool g_stopStreaming = false;
+VkDeviceSize g_streamingBudget = 0;
+std::atomic<VkDeviceSize> g_streamingResident{0}; // Texture memory allocated, budget included
+VkSampler g_streamingSampler = VK_NULL_HANDLE;
+StreamingStats g_streamingStats;
+
+// Bytes per block, block side (4 for BC, 1 for plain formats). 0: not a format the container supports.
+static uint32_t textureBlockBytes(VkFormat format, uint32_t& blockSide)
+{
+  blockSide = 4;
+  switch(format)
+  {
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK: case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: case VK_FORMAT_BC4_UNORM_BLOCK:
+    return g_textureCompressionBC ? 8 : 0;
+  case VK_FORMAT_BC3_UNORM_BLOCK: case VK_FORMAT_BC3_SRGB_BLOCK: case VK_FORMAT_BC5_UNORM_BLOCK: case VK_FORMAT_BC7_UNORM_BLOCK: case VK_FORMAT_BC7_SRGB_BLOCK:
+    return g_textureCompressionBC ? 16 : 0;
+  case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB:
+    blockSide = 1;
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+static uint64_t textureMipSize(VkFormat format, uint32_t width, uint32_t height)
+{
+  uint32_t blockSide;
+  uint32_t blockBytes = textureBlockBytes(format, blockSide);
+  return static_cast<uint64_t>((width + blockSide - 1) / blockSide) * ((height + blockSide - 1) / blockSide) * blockBytes;
+}
+
+// The pages are read ahead in one go instead of faulting in one by one during the copy.
+static void prefetchMapped(const MappedFile& file, uint64_t offset, uint64_t size)
+{
+#ifndef _WIN32
+  uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  uint64_t start = offset & ~(page - 1);
+  madvise(reinterpret_cast<char*>(const_cast<uint32_t*>(file.data)) + start, offset + size - start, MADV_WILLNEED);
+#endif
+}
+
+// mips: payloads, most detailed first.
+void writeTextureFile(const std::string& path, VkFormat format, uint32_t width, uint32_t height, const std::vector<std::vector<char>>& mips)
+{
+  TextureFileHeader header = { TEXTURE_FILE_MAGIC, TEXTURE_FILE_VERSION, static_cast<uint32_t>(format), width, height, static_cast<uint32_t>(mips.size()) };
+  std::vector<TextureFileMip> table(mips.size());
+  uint64_t offset = sizeof(header) + sizeof(TextureFileMip) * mips.size();
+  for(size_t i = 0; i < mips.size(); i++)
+  {
+    offset = (offset + 15) & ~15ull;
+    table[i] = { offset, mips[i].size(), std::max(1u, width >> i), std::max(1u, height >> i) };
+    offset += mips[i].size();
+  }
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if(!file.is_open()) throw std::runtime_error("Failed to write " + path);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(table.data()), sizeof(TextureFileMip) * table.size());
+  for(size_t i = 0; i < mips.size(); i++)
+  {
+    std::vector<char> padding(table[i].offset - static_cast<uint64_t>(file.tellp()), 0);
+    file.write(padding.data(), padding.size());
+    file.write(mips[i].data(), mips[i].size());
+  }
+}
+
+// Test textures: a checkerboard with a color per texture and mip level, BC1 (solid blocks) or RGBA8 without BC support.
+// Written only when missing, returns the paths.
+std::vector<std::string> generateStreamingTextures(uint32_t count, uint32_t size)
+{
+  VkFormat format = g_textureCompressionBC ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_R8G8B8A8_UNORM;
+  std::string prefix = std::string("streaming/") + (g_textureCompressionBC ? "bc1_" : "rgba8_") + std::to_string(size) + "_";
+  std::filesystem::create_directories("streaming");
+  std::vector<std::string> paths;
+  for(uint32_t t = 0; t < count; t++)
+  {
+    paths.push_back(prefix + std::to_string(t) + ".gtex");
+    if(std::ifstream(paths.back()).good()) continue;
+    std::vector<std::vector<char>> mips;
+    for(uint32_t mip = 0; (size >> mip) > 0; mip++)
+    {
+      uint32_t side = size >> mip;
+      uint8_t red = static_cast<uint8_t>(t * 37), green = static_cast<uint8_t>(mip * 40), blue = static_cast<uint8_t>(255 - t * 11);
+      std::vector<char> payload(textureMipSize(format, side, side));
+      if(format == VK_FORMAT_R8G8B8A8_UNORM)
+      {
+        for(uint32_t i = 0; i < side * side; i++)
+        {
+          bool dark = (((i % side) / 16) + ((i / side) / 16)) % 2 != 0;
+          uint8_t texel[4] = { static_cast<uint8_t>(dark ? red / 2 : red), static_cast<uint8_t>(dark ? green / 2 : green), static_cast<uint8_t>(dark ? blue / 2 : blue), 255 };
+          memcpy(payload.data() + i * 4, texel, 4);
+        }
+      } else // BC1 block: both endpoints the same 565 color, all indices 0
+      {
+        uint32_t blocks = (side + 3) / 4;
+        for(uint32_t i = 0; i < blocks * blocks; i++)
+        {
+          bool dark = (((i % blocks) / 4) + ((i / blocks) / 4)) % 2 != 0;
+          uint16_t color = static_cast<uint16_t>((((dark ? red / 2 : red) >> 3) << 11) | (((dark ? green / 2 : green) >> 2) << 5) | ((dark ? blue / 2 : blue) >> 3));
+          uint8_t block[8] = { static_cast<uint8_t>(color), static_cast<uint8_t>(color >> 8), static_cast<uint8_t>(color), static_cast<uint8_t>(color >> 8), 0, 0, 0, 0 };
+          memcpy(payload.data() + i * 8, block, 8);
+        }
+      }
+      mips.push_back(std::move(payload));
+    }
+    writeTextureFile(paths.back(), format, size, size, mips);
+  }
+  return paths;
+}
+
+// Image of the mips from firstMip on, memory taken from the budget. Drops detail until it fits, false if nothing does.
+static bool createStreamedImage(StreamedTexture& texture, const TextureFileHeader& header, uint32_t& firstMip)
+{
+  for(; firstMip < header.mipCount; firstMip++)
+  {
+    VkImageCreateInfo imageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = static_cast<VkFormat>(header.format);
+    imageCreateInfo.extent = { std::max(1u, header.width >> firstMip), std::max(1u, header.height >> firstMip), 1 };
+    imageCreateInfo.mipLevels = header.mipCount - firstMip;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    CHECK_VULKAN_ERRORS( vkCreateImage(g_device, &imageCreateInfo, g_allocator, &texture.image) );
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(g_device, texture.image, &requirements);
+
+    VkDeviceSize resident = g_streamingResident.load();
+    bool heapFits = requirements.size <= deviceLocalBudgetLeft(); // Whatever else uses the heap (memory.hpp)
+    while(heapFits && resident + requirements.size <= g_streamingBudget && !g_streamingResident.compare_exchange_weak(resident, resident + requirements.size)) {}
+    if(heapFits && resident + requirements.size <= g_streamingBudget)
+    {
+      texture.allocation = allocateMemory(requirements, MemoryUsage::GpuOnly, MEMORY_KIND_OPTIMAL);
+      CHECK_VULKAN_ERRORS( vkBindImageMemory(g_device, texture.image, texture.allocation.memory, texture.allocation.offset) );
+      VkImageViewCreateInfo imageViewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+      imageViewCreateInfo.image = texture.image;
+      imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      imageViewCreateInfo.format = imageCreateInfo.format;
+      imageViewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, imageCreateInfo.mipLevels, 0, 1 };
+      CHECK_VULKAN_ERRORS( vkCreateImageView(g_device, &imageViewCreateInfo, g_allocator, &texture.view) );
+      texture.residentBytes = requirements.size;
+      return true;
+    }
+    vkDestroyImage(g_device, texture.image, g_allocator);
+    texture.image = VK_NULL_HANDLE;
+  }
+  return false;
+}
+
+// Not used by the GPU (anymore): destroys the image and gives its memory back to the budget.
+static void destroyStreamedImage(VkImage image, VkImageView view, Allocation& allocation, VkDeviceSize residentBytes)
+{
+  if(view != VK_NULL_HANDLE) vkDestroyImageView(g_device, view, g_allocator);
+  if(image != VK_NULL_HANDLE) vkDestroyImage(g_device, image, g_allocator);
+  freeMemory(allocation);
+  g_streamingResident -= residentBytes;
+}
+
+// I/O thread: maps the file, creates the image and records the uploads of the needed mips, smallest first.
+static void loadStreamedTexture(StreamedTexture& texture, const TextureRequest& request)
+{
+  PROFILE_ZONE("stream texture");
+  MappedFile file;
+  if(!mapFile(texture.path, file)) throw std::runtime_error("can't open the file");
+  const char* bytes = reinterpret_cast<const char*>(file.data);
+  try
+  {
+    TextureFileHeader header;
+    if(file.size < sizeof(header)) throw std::runtime_error("not a texture file");
+    memcpy(&header, bytes, sizeof(header));
+    if(header.magic != TEXTURE_FILE_MAGIC || header.version != TEXTURE_FILE_VERSION || header.mipCount == 0 || header.mipCount > TEXTURE_FILE_MAX_MIPS) throw std::runtime_error("not a texture file");
+    uint32_t blockSide;
+    if(textureBlockBytes(static_cast<VkFormat>(header.format), blockSide) == 0) throw std::runtime_error("format not supported by the device");
+    std::vector<TextureFileMip> mips(header.mipCount);
+    if(file.size < sizeof(header) + sizeof(TextureFileMip) * mips.size()) throw std::runtime_error("truncated");
+    memcpy(mips.data(), bytes + sizeof(header), sizeof(TextureFileMip) * mips.size());
+    // Everything is checked before the image exists: once a copy is recorded, the load can't fail anymore
+    for(uint32_t level = 0; level < header.mipCount; level++)
+    {
+      const TextureFileMip& mip = mips[level];
+      if(mip.width != std::max(1u, header.width >> level) || mip.height != std::max(1u, header.height >> level)) throw std::runtime_error("wrong mip extent"); // The copy would leave the image
+      if(mip.offset + mip.size > file.size || mip.size != textureMipSize(static_cast<VkFormat>(header.format), mip.width, mip.height)) throw std::runtime_error("truncated");
+      if(mip.size > STAGING_RING_SIZE) throw std::runtime_error("mip bigger than the staging ring buffer");
+    }
+
+    uint32_t firstMip = std::min(request.mostDetailedMip, header.mipCount - 1);
+    uint32_t neededMip = firstMip;
+    if(!createStreamedImage(texture, header, firstMip)) throw std::runtime_error("over the memory budget");
+    texture.firstMip = firstMip;
+    uint64_t uploaded = 0;
+    for(uint32_t mip = header.mipCount; mip-- > firstMip;) // Small ones first: they're done before the big one is read
+    {
+      prefetchMapped(file, mips[mip].offset, mips[mip].size);
+      StagingRegion region = reserveStaging(mips[mip].size);
+      memcpy(region.mapped, bytes + mips[mip].offset, mips[mip].size); // Mapped file straight into the staging ring
+      VkBufferImageCopy copy = {};
+      copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - firstMip, 0, 1 };
+      copy.imageExtent = { mips[mip].width, mips[mip].height, 1 };
+      texture.ticket = copyStagingToImage(region, texture.image, { VK_IMAGE_ASPECT_COLOR_BIT, mip - firstMip, 1, 0, 1 }, { copy },
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+      uploaded += mips[mip].size;
+    }
+    std::lock_guard<std::mutex> lock(g_streamingMutex);
+    g_streamingStats.bytes += uploaded;
+    if(firstMip > neededMip) g_streamingStats.reducedTextures++;
+  } catch(...)
+  {
+    unmapFile(file);
+    destroyStreamedImage(texture.image, texture.view, texture.allocation, texture.residentBytes); // Nothing recorded yet
+    texture.image = VK_NULL_HANDLE;
+    texture.view = VK_NULL_HANDLE;
+    texture.residentBytes = 0;
+    throw;
+  }
+  unmapFile(file);
+}
+
+static void streamingLoop()
+{
+  t_uploadRecordOnly = true; // Submissions are the frame thread's (upload.hpp)
+  while(true)
+  {
+    TextureRequest request;
+    StreamedTexture* texture;
+    {
+      std::unique_lock<std::mutex> lock(g_streamingMutex);
+      g_streamingCondition.wait(lock, []{ return g_stopStreaming || !g_textureRequests.empty(); });
+      if(g_stopStreaming) break;
+      request = g_textureRequests.top();
+      g_textureRequests.pop();
+      texture = g_streamedTextures[request.handle].get(); // Stable: the vector holds pointers
+    }
+    try // Exceptions must not leave a streaming thread
+    {
+      loadStreamedTexture(*texture, request);
+    } catch(const std::runtime_error& error)
+    {
+      std::cerr << "Streaming " << texture->path << ": " << error.what() << std::endl;
+      texture->failed = true;
+    }
+    std::lock_guard<std::mutex> lock(g_streamingMutex);
+    texture->loaded = true;
+    g_loadedTextures.push_back(request.handle);
+  }
+  g_streamingThreadsRunning--;
+}
+
+// budget: bytes of texture memory streamed textures may use in total.
+void startStreaming(uint32_t threadCount, VkDeviceSize budget)
+{
+  g_streamingBudget = budget;
+  g_stopStreaming = false;
+  VkSamplerCreateInfo samplerCreateInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+  samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+  samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+  samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerCreateInfo.maxLod = static_cast<float>(TEXTURE_FILE_MAX_MIPS); // Every mip
+  CHECK_VULKAN_ERRORS( vkCreateSampler(g_device, &samplerCreateInfo, g_allocator, &g_streamingSampler) );
+  g_streamingThreadsRunning = std::max(1u, threadCount);
+  for(uint32_t i = 0; i < std::max(1u, threadCount); i++) g_streamingThreads.emplace_back(streamingLoop);
+  std::cout << "Streaming: " << g_streamingThreads.size() << " I/O threads, " << (budget >> 20) << " MiB budget" << std::endl;
+}
+
+// Returns a handle for streamedTextureIndex(). mostDetailedMip: 0 for full resolution, higher for smaller on screen.
+uint32_t requestTexture(const std::string& path, int32_t priority, uint32_t mostDetailedMip = 0)
+{
+  std::lock_guard<std::mutex> lock(g_streamingMutex);
+  uint32_t handle = static_cast<uint32_t>(g_streamedTextures.size());
+  g_streamedTextures.push_back(std::make_unique<StreamedTexture>());
+  g_streamedTextures.back()->path = path;
+  g_streamedTextures.back()->requested = BenchClock::now();
+  if(handle == 0) g_streamingStats.start = g_streamedTextures.back()->requested;
+  g_textureRequests.push({ handle, priority, mostDetailedMip });
+  g_streamingCondition.notify_one();
+  return handle;
+}
+
+// Descriptor heap index, RESOURCE_NONE while the texture isn't usable (yet).
+uint32_t streamedTextureIndex(uint32_t handle)
+{
+  std::lock_guard<std::mutex> lock(g_streamingMutex);
+  return g_streamedTextures[handle]->index;
+}
+
+// Render thread, every frame after recordUploadAcquires(): textures whose uploads have been acquired become usable.
+void updateStreaming()
+{
+  if(g_streamingThreads.empty()) return;
+  std::lock_guard<std::mutex> lock(g_streamingMutex);
+  for(size_t i = 0; i < g_loadedTextures.size();)
+  {
+    StreamedTexture& texture = *g_streamedTextures[g_loadedTextures[i]];
+    if(!texture.failed && !uploadComplete(texture.ticket))
+    {
+      i++;
+      continue;
+    }
+    BenchClock::time_point now = BenchClock::now();
+    if(texture.failed) g_streamingStats.failedTextures++;
+    else
+    {
+      texture.index = registerTexture(texture.view, g_streamingSampler);
+      if(g_streamingStats.textures == 0) g_streamingStats.firstPixel = now;
+      g_streamingStats.textures++;
+      g_streamingStats.latencySum += millisecondsBetween(texture.requested, now);
+      g_streamingStats.last = now;
+    }
+    g_loadedTextures[i] = g_loadedTextures.back();
+    g_loadedTextures.pop_back();
+  }
+}
+
+// Render thread: the texture's memory goes back to the budget once the frames submitted so far have finished. It has to be usable
+// or failed: false while it's still loading. The handle stays valid, streamedTextureIndex() returns RESOURCE_NONE from now on.
+bool releaseStreamedTexture(uint32_t handle, uint64_t submittedFrames)
+{
+  std::lock_guard<std::mutex> lock(g_streamingMutex);
+  StreamedTexture& texture = *g_streamedTextures[handle];
+  if(texture.index == RESOURCE_NONE && !texture.failed) return false;
+  if(texture.index != RESOURCE_NONE) releaseResource(RESOURCE_TEXTURE, texture.index, submittedFrames);
+  if(texture.image != VK_NULL_HANDLE) g_retiredStreamedTextures.push_back({ texture.image, texture.view, texture.allocation, texture.residentBytes, submittedFrames });
+  texture.image = VK_NULL_HANDLE;
+  texture.view = VK_NULL_HANDLE;
+  texture.allocation = Allocation();
+  texture.residentBytes = 0;
+  texture.index = RESOURCE_NONE;
+  return true;
+}
+
+// completedFrames: every frame numbered below it has finished on the GPU.
+void destroyRetiredStreamedTextures(uint64_t completedFrames)
+{
+  for(size_t i = 0; i < g_retiredStreamedTextures.size();)
+  {
+    RetiredStreamedTexture& retired = g_retiredStreamedTextures[i];
+    if(retired.usedUntilFrame <= completedFrames)
+    {
+      destroyStreamedImage(retired.image, retired.view, retired.allocation, retired.residentBytes);
+      g_retiredStreamedTextures[i] = g_retiredStreamedTextures.back();
+      g_retiredStreamedTextures.pop_back();
+    } else i++;
+  }
+}
+
+void reportStreamingStats()
+{
+  const StreamingStats& stats = g_streamingStats;
+  if(stats.textures == 0) return;
+  double seconds = std::max(1e-9, millisecondsBetween(stats.start, stats.last) / 1000.0);
+  std::cout << "Streaming: " << stats.textures << "/" << g_streamedTextures.size() << " textures usable (" << stats.reducedTextures << " reduced by the budget, " << stats.failedTextures << " failed), "
+    << (g_streamingResident.load() >> 20) << "/" << (g_streamingBudget >> 20) << " MiB resident" << std::endl;
+  std::cout << "Streaming: first pixel after " << millisecondsBetween(stats.start, stats.firstPixel) << " ms, average latency " << stats.latencySum / stats.textures << " ms, "
+    << (stats.bytes >> 20) << " MiB in " << seconds * 1000.0 << " ms (" << stats.bytes / seconds / (1 << 20) << " MiB/s)" << std::endl;
+}
+
+// After vkDeviceWaitIdle. Requests not started are dropped.
+void stopStreaming()
+{
+  {
+    std::lock_guard<std::mutex> lock(g_streamingMutex);
+    g_stopStreaming = true;
+  }
+  g_streamingCondition.notify_all();
+  while(g_streamingThreadsRunning > 0) // No frames anymore: this thread submits what a texture in progress is waiting for
+  {
+    waitForUploads();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for(std::thread& thread : g_streamingThreads) thread.join();
+  g_streamingThreads.clear();
+  waitForUploads(); // What the threads recorded last
+  destroyRetiredStreamedTextures(UINT64_MAX);
+  for(std::unique_ptr<StreamedTexture>& texture : g_streamedTextures) destroyStreamedImage(texture->image, texture->view, texture->allocation, texture->residentBytes);
+  g_streamedTextures.clear();
+  while(!g_textureRequests.empty()) g_textureRequests.pop();
+  g_loadedTextures.clear();
+  if(g_streamingSampler != VK_NULL_HANDLE) vkDestroySampler(g_device, g_streamingSampler, g_allocator);
+  g_streamingSampler = VK_NULL_HANDLE;
+}
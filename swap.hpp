@@ -1,5 +1,7 @@
 #pragma once
 #include "common.hpp"
+#include "present.hpp"
+#include "profiler.hpp"
 
 // Swap chains require these properties:
 // Basic surface properties: minmax number of images / swap chain, minmax width and height of images..
@@ -20,22 +22,10 @@ static SwapChainSupportDetails getSwapChainSupportDetails(VkPhysicalDevice devic
   // Get the surface capabilities:
   vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, g_surface, &details.capabilities);
 
-  // Get supported surface formats:
-  uint32_t formatCount;
-  vkGetPhysicalDeviceSurfaceFormatsKHR(device, g_surface, &formatCount, nullptr); // Get how many supported
-  if(formatCount != 0) // If found some formats (more than nothing)
-  {
-    details.formats.resize(formatCount); // resize the vector
-    vkGetPhysicalDeviceSurfaceFormatsKHR(device, g_surface, &formatCount, details.formats.data()); // Save the gotten formats
-  }
-
-  // Get supported present modes:
-  uint32_t presentModeCount;
-  vkGetPhysicalDeviceSurfacePresentModesKHR(device, g_surface, &presentModeCount, nullptr); // Get how many supported
-  if(presentModeCount != 0) // If found some present modes (more than nothing)
-  {
-    details.presentModes.resize(presentModeCount); // resize the vector vkGetPhysicalDeviceSurfacePresentModesKHR(device, g_surface, &presentModeCount, details.presentModes.data()); // Save the gotten present modes
-  }
+  // Supported surface formats and present modes don't change with the window size, they were queried once at device selection:
+  const DeviceInfo& info = getDeviceInfo(device);
+  details.formats = info.surfaceFormats;
+  details.presentModes = info.presentModes;
   return details;
 }
 
@@ -44,9 +34,9 @@ bool swapChainIsAdequate(VkPhysicalDevice device)
   bool swapChainSuitability = false;
   if(g_deviceExtensionsSupported)
   {
-    SwapChainSupportDetails swapChainSupport = getSwapChainSupportDetails(device);
+    const DeviceInfo& info = getDeviceInfo(device); // No capabilities query needed here
     // Suitable when the list of suitable formats and present modes are not empty.
-    swapChainSuitability = (!swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty());
+    swapChainSuitability = (!info.surfaceFormats.empty() && !info.presentModes.empty());
   }
   return swapChainSuitability;
 }
@@ -60,17 +50,14 @@ static VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFor
   }
   return availableFormats[0]; // If not available, return whatever we have (first).
 }
-// Choose buffer type in syncing with the screen (refresh)!
+// Choose buffer type in syncing with the screen (refresh)! The order of preference comes from the present policy:
+// IMMEDIATE : Image --directly-> screen : May cause tearing!
+// FIFO : (push@refresh, pop2screen): full wait 4 sync ~= VSync! Should be always supported, thus a good backup. Works also good in mobile (more rest!)!
+// FIFO_RELAXED : Similar + If queue late, but was empty ->pop: Tear!
+// MAILBOX : Circular: replace old=new: "Triple buffering", no rest!
 static VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
 {
-  for(const auto& presentMode : availablePresentModes)
-  {
-//  if(presentMode == VK_PRESENT_MODE_IMMEDIATE_KHR) return presentMode; // Image --directly-> screen : May cause tearing!
-    if(presentMode == VK_PRESENT_MODE_FIFO_KHR) return presentMode; // FIFO (push@refresh, pop2screen): full wait 4 sync ~= VSync!
-//  if(presentMode == VK_PRESENT_MODE_FIFO_RELAXED_KHR) return presentMode; // Similar + If queue late, but was empty ->pop: Tear!
-//  if(presentMode == VK_PRESENT_MODE_MAILBOX_KHR) return presentMode; // Circular: replace old=new: "Triple buffering", no rest!
-  }
-  return VK_PRESENT_MODE_FIFO_KHR; // Should be always supported, thus a good backup. Works also good in mobile (more rest!)!
+  return choosePolicyPresentMode(g_presentPolicy, availablePresentModes);
 }
 // Choose settings to turn Window resolution to "Vulkan swap chain images in pixel space" resolution.
 static VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities)
@@ -87,16 +74,15 @@ static VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabi
 
 void createSwapChain()
 {
+  PROFILE_FUNCTION();
   // Choose settings accoring to the saved SwapChainSupportDetails
   SwapChainSupportDetails swapChainSupport = getSwapChainSupportDetails(g_physicalDevice);
   VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
   VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
   VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-  // Images inside swap chain should include one extra to reduce waiting (latency) when rendering.
-  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-  // ImageCount should not exceed max image amount (maxImageCount = 0 means a max image amount is not set!)
-  if(swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) imageCount = swapChainSupport.capabilities.maxImageCount;
+  // Images inside swap chain: one extra reduces waiting when rendering, but every queued image adds a frame of latency.
+  uint32_t imageCount = choosePolicyImageCount(g_presentPolicy, presentMode, swapChainSupport.capabilities);
 
   VkSwapchainCreateInfoKHR createInfo = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
   createInfo.surface = g_surface;
@@ -105,7 +91,25 @@ void createSwapChain()
   createInfo.imageColorSpace = surfaceFormat.colorSpace; // From the settings above
   createInfo.imageExtent = extent; // From the settings above
   createInfo.imageArrayLayers = 1; // CHANGE THIS IF WANT TO HAVE MULTIPLE LAYERS FOR EXAMPLE STEREOSCOPIC 3D VR SCREEN!
-  createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // No post processing (attach directly): Check other options (VK_IMAGE_USAGE_TRANSFER_DST_BIT can use memory operation to transfer rendered image to swap chain image etc..)!!
+  createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // Attach directly, cleared by the render pass. The only usage always supported
+  if(g_blitTargetRequested) // Dynamic resolution blits the scaled frame onto the images (resolution.hpp)
+  {
+    if(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    else
+    {
+      std::cout << "Dynamic resolution: swap chain images can't be blitted to (no TRANSFER_DST usage), dynamic resolution disabled" << std::endl;
+      g_blitTargetRequested = false;
+    }
+  }
+  if(g_captureRequested) // Frame capture copies the images out (capture.hpp)
+  {
+    if(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    else
+    {
+      std::cout << "Capture: swap chain images can't be copied from (no TRANSFER_SRC usage), capture disabled" << std::endl;
+      g_captureRequested = false;
+    }
+  }
 
   // Next handle swap chain images used in multiple different queue families:
   QueueFamilyIndices indices = findQueueFamilies(g_physicalDevice);
@@ -126,14 +130,48 @@ void createSwapChain()
   createInfo.presentMode = presentMode; // From the settings above
   createInfo.clipped = VK_TRUE; // Enable clipping! 
 
-  createInfo.oldSwapchain = VK_NULL_HANDLE; // As we only have one swap chain for now, ignore (needed when recreating swapchain!)
+  createInfo.oldSwapchain = g_swapchain; // When recreating: the driver can reuse the old one's resources, no need to stall on it
   // Create the swap chain:
-  CHECK_VULKAN_ERRORS( vkCreateSwapchainKHR(g_device, &createInfo, nullptr, &g_swapchain) );
+  CHECK_VULKAN_ERRORS( vkCreateSwapchainKHR(g_device, &createInfo, g_allocator, &g_swapchain) );
   // Get and save information: (Images' memory is automatically handled from creating and destroying the swap chain itself!)
   vkGetSwapchainImagesKHR(g_device, g_swapchain, &imageCount, nullptr); // Check how actual images inside
   g_swapChainImages.resize(imageCount); // Update the size
   vkGetSwapchainImagesKHR(g_device, g_swapchain, &imageCount, g_swapChainImages.data()); // Get the images, save to global vector
   g_swapChainImageFormat = surfaceFormat.format; // Save to global values
   g_swapChainExtent = extent; // Save to gloval values
+  std::cout << "Swap chain: " << extent.width << "x" << extent.height << ", " << imageCount << " images, " << presentModeName(presentMode) << " (" << presentPolicyName(g_presentPolicy) << ")" << std::endl;
 }
 
+// The old swap chain may still be used by frames in flight after a recreation: keep it until they have finished.
+struct RetiredSwapChain
+{
+  VkSwapchainKHR swapchain;
+  uint64_t usedUntilFrame; // Frames numbered below this may still use it
+};
+std::vector<RetiredSwapChain> g_retiredSwapChains;
+
+// Returns false (keeping the current swap chain) while the surface has no area, e.g. minimized window.
+bool recreateSwapChain(uint64_t submittedFrames)
+{
+  VkSurfaceCapabilitiesKHR capabilities;
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(g_physicalDevice, g_surface, &capabilities);
+  if(capabilities.currentExtent.width == 0 || capabilities.currentExtent.height == 0) return false;
+
+  VkSwapchainKHR oldSwapchain = g_swapchain;
+  createSwapChain(); // Passes the current g_swapchain as oldSwapchain, which retires it
+  if(oldSwapchain != VK_NULL_HANDLE) g_retiredSwapChains.push_back({ oldSwapchain, submittedFrames });
+  return true;
+}
+
+// completedFrames: every frame numbered below it has finished on the GPU.
+void destroyRetiredSwapChains(uint64_t completedFrames)
+{
+  for(size_t i = 0; i < g_retiredSwapChains.size();)
+  {
+    if(g_retiredSwapChains[i].usedUntilFrame <= completedFrames)
+    {
+      vkDestroySwapchainKHR(g_device, g_retiredSwapChains[i].swapchain, g_allocator);
+      g_retiredSwapChains.erase(g_retiredSwapChains.begin() + i);
+    } else i++;
+  }
+}
@@ -0,0 +1,171 @@
+#pragma once
+#include "common.hpp"
+
+#include <atomic>
+#include <mutex>
+
+// Queue timelines (Vulkan 1.2 path with timelineSemaphore): every queue the template submits to (graphics, compute, transfer)
+// has one timeline semaphore whose value only grows. Each submission signals the next value of its queue, other submissions
+// wait on that value instead of a binary semaphore, and the host waits on or polls values instead of fences. Work retired after
+// a submission is reclaimed once the queue's timeline has reached the submission's value: nothing has to be reset, and one
+// semaphore per queue replaces the per-slot frame fences, the per-slot compute semaphores and the per-batch upload fences.
+// Only frame submissions signal the graphics timeline, so frame N signals N + 1: the graphics value is the number of completed
+// frames, which keys all the frame-based reclamation (retired swap chains, framebuffers, pipelines, render graphs...).
+// Without timeline semaphores (1.0 path, or not supported) the modules keep their fences and binary semaphores.
+// The swap chain acquire and present always use binary semaphores: timeline ones aren't allowed there.
+// Queue access must be externally synchronized, and the graphics, compute, transfer and present handles may all be the same
+// VkQueue: every submission and present takes that queue's lock (queueMutex()). submitToTimeline() does it for the timelines.
+
+enum QueueTimelineId { TIMELINE_GRAPHICS, TIMELINE_COMPUTE, TIMELINE_TRANSFER, TIMELINE_COUNT };
+
+struct QueueTimeline
+{
+  VkQueue queue = VK_NULL_HANDLE;
+  VkSemaphore semaphore = VK_NULL_HANDLE; // Timeline semaphores only
+  uint64_t submitted = 0; // Value signaled by the last submission. Written under the queue's lock
+  std::atomic<uint64_t> completed{0}; // Highest value seen reached on the host
+};
+
+// Waits and signals of one vkQueueSubmit, binary and timeline semaphores mixed.
+struct SubmitSync
+{
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<uint64_t> waitValues; // Ignored for binary semaphores
+  std::vector<VkPipelineStageFlags> waitStages;
+  std::vector<VkSemaphore> signalSemaphores;
+  std::vector<uint64_t> signalValues;
+};
+
+QueueTimeline g_timelines[TIMELINE_COUNT];
+const uint32_t QUEUE_LOCK_COUNT = TIMELINE_COUNT + 1; // And the present queue
+VkQueue g_lockedQueues[QUEUE_LOCK_COUNT] = {};
+std::mutex g_queueMutexes[QUEUE_LOCK_COUNT];
+
+// The same mutex for every role a VkQueue has: the first entry with the handle.
+std::mutex& queueMutex(VkQueue queue)
+{
+  for(uint32_t i = 0; i < QUEUE_LOCK_COUNT; i++) if(g_lockedQueues[i] == queue) return g_queueMutexes[i];
+  throw std::runtime_error("Sync: no lock for the queue!");
+}
+
+// After createLogicalDevice(): the queue handles are set there.
+void createTimelines()
+{
+  g_timelines[TIMELINE_GRAPHICS].queue = g_graphicsQueue;
+  g_timelines[TIMELINE_COMPUTE].queue = g_computeQueue;
+  g_timelines[TIMELINE_TRANSFER].queue = g_transferQueue;
+  for(uint32_t i = 0; i < TIMELINE_COUNT; i++) g_lockedQueues[i] = g_timelines[i].queue;
+  g_lockedQueues[TIMELINE_COUNT] = g_presentQueue;
+  std::cout << "Sync: " << (g_timelineSemaphores ? "queue timelines" : "fences and binary semaphores") << std::endl;
+  if(!g_timelineSemaphores) return;
+
+  VkSemaphoreTypeCreateInfo typeCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+  typeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeCreateInfo.initialValue = 0;
+  VkSemaphoreCreateInfo semaphoreCreateInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+  semaphoreCreateInfo.pNext = &typeCreateInfo;
+  for(QueueTimeline& timeline : g_timelines)
+  {
+    CHECK_VULKAN_ERRORS( vkCreateSemaphore(g_device, &semaphoreCreateInfo, g_allocator, &timeline.semaphore) );
+    timeline.submitted = 0;
+    timeline.completed = 0;
+  }
+}
+
+// After vkDeviceWaitIdle.
+void destroyTimelines()
+{
+  for(QueueTimeline& timeline : g_timelines)
+  {
+    vkDestroySemaphore(g_device, timeline.semaphore, g_allocator);
+    timeline.semaphore = VK_NULL_HANDLE;
+  }
+}
+
+void addSubmitWait(SubmitSync& sync, VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value = 0)
+{
+  sync.waitSemaphores.push_back(semaphore);
+  sync.waitValues.push_back(value);
+  sync.waitStages.push_back(stages);
+}
+
+// Waits for a value of another queue's timeline at the given stages.
+void addTimelineWait(SubmitSync& sync, QueueTimelineId id, uint64_t value, VkPipelineStageFlags stages)
+{
+  addSubmitWait(sync, g_timelines[id].semaphore, stages, value);
+}
+
+void addSubmitSignal(SubmitSync& sync, VkSemaphore semaphore, uint64_t value = 0)
+{
+  sync.signalSemaphores.push_back(semaphore);
+  sync.signalValues.push_back(value);
+}
+
+// Submits to the timeline's queue. With timeline semaphores the submission also signals the next value of the timeline,
+// which is returned (0 without). The fence is for the fallback path, VK_NULL_HANDLE otherwise. Any thread.
+uint64_t submitToTimeline(QueueTimelineId id, VkCommandBuffer commandBuffer, SubmitSync& sync, VkFence fence = VK_NULL_HANDLE)
+{
+  QueueTimeline& timeline = g_timelines[id];
+  std::lock_guard<std::mutex> lock(queueMutex(timeline.queue)); // Values signaled in submission order
+  uint64_t value = 0;
+  if(g_timelineSemaphores)
+  {
+    value = timeline.submitted + 1;
+    addSubmitSignal(sync, timeline.semaphore, value);
+  }
+
+  VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+  submitInfo.waitSemaphoreCount = static_cast<uint32_t>(sync.waitSemaphores.size());
+  submitInfo.pWaitSemaphores = sync.waitSemaphores.data();
+  submitInfo.pWaitDstStageMask = sync.waitStages.data();
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = static_cast<uint32_t>(sync.signalSemaphores.size());
+  submitInfo.pSignalSemaphores = sync.signalSemaphores.data();
+
+  VkTimelineSemaphoreSubmitInfo timelineSubmitInfo = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+  if(g_timelineSemaphores) // Binary semaphores need no values, but with this in the chain the counts must match
+  {
+    timelineSubmitInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+    timelineSubmitInfo.pWaitSemaphoreValues = sync.waitValues.data();
+    timelineSubmitInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+    timelineSubmitInfo.pSignalSemaphoreValues = sync.signalValues.data();
+    submitInfo.pNext = &timelineSubmitInfo;
+  }
+  CHECK_VULKAN_ERRORS( vkQueueSubmit(timeline.queue, 1, &submitInfo, fence) );
+  timeline.submitted = std::max(timeline.submitted, value);
+  return value;
+}
+
+static void noteTimelineCompleted(QueueTimelineId id, uint64_t value)
+{
+  std::atomic<uint64_t>& completed = g_timelines[id].completed;
+  uint64_t current = completed.load();
+  while(value > current && !completed.compare_exchange_weak(current, value)) {}
+}
+
+// Polls the GPU: the highest value reached so far.
+uint64_t timelineCompleted(QueueTimelineId id)
+{
+  uint64_t value = 0;
+  CHECK_VULKAN_ERRORS( vkGetSemaphoreCounterValue(g_device, g_timelines[id].semaphore, &value) );
+  noteTimelineCompleted(id, value);
+  return g_timelines[id].completed;
+}
+
+bool timelineReached(QueueTimelineId id, uint64_t value)
+{
+  return value <= g_timelines[id].completed || value <= timelineCompleted(id);
+}
+
+// Blocks until the timeline has reached the value: exactly the submission it depends on, not a whole slot or queue.
+void waitTimeline(QueueTimelineId id, uint64_t value)
+{
+  if(value <= g_timelines[id].completed) return;
+  VkSemaphoreWaitInfo waitInfo = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &g_timelines[id].semaphore;
+  waitInfo.pValues = &value;
+  CHECK_VULKAN_ERRORS( vkWaitSemaphores(g_device, &waitInfo, UINT64_MAX) );
+  noteTimelineCompleted(id, value);
+}
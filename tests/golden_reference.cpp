@@ -0,0 +1,73 @@
+#include "init.hpp" // Device queries the capture module's dependencies call
+#include "capture.hpp"
+
+// Reference golden frames (make golden-reference): the headless frame rasterized on the CPU, written with the capture
+// module's own PNG encoder, so the baseline of "make golden" can be audited and regenerated without a GPU. It mirrors
+// exactly what the template renders by default: the clear color of createMainPass() (frame.hpp) and the triangle of
+// shaders/common.glsl, its colors interpolated linearly (w is 1), sampled at pixel centers. No pixel center of the default
+// size lies on an edge, so no fill rule is involved. A GPU's rounding may differ by one, within the default tolerance.
+// Frames rendered on a reference GPU (make golden-seed) replace these.
+
+const double REFERENCE_POSITIONS[3][2] = { { 0.0, -0.5 }, { 0.5, 0.5 }, { -0.5, 0.5 } }; // TRIANGLE_POSITIONS
+const double REFERENCE_COLORS[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } }; // TRIANGLE_COLORS
+
+static double edgeFunction(const double* a, const double* b, double x, double y)
+{
+  return (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+}
+
+static uint8_t unorm8(double value)
+{
+  return static_cast<uint8_t>(std::max(0.0, std::min(255.0, std::floor(value * 255.0 + 0.5))));
+}
+
+static std::vector<uint8_t> renderReferenceFrame(uint64_t frameNumber, uint32_t width, uint32_t height)
+{
+  double vertices[3][2];
+  for(uint32_t v = 0; v < 3; v++)
+  {
+    vertices[v][0] = (REFERENCE_POSITIONS[v][0] + 1.0) / 2.0 * width; // Viewport transform, y down like Vulkan's NDC
+    vertices[v][1] = (REFERENCE_POSITIONS[v][1] + 1.0) / 2.0 * height;
+  }
+  double area = edgeFunction(vertices[0], vertices[1], vertices[2][0], vertices[2][1]);
+  double phase = (frameNumber % 256) / 255.0;
+  uint8_t clear[4] = { unorm8(phase), unorm8(0.2), unorm8(1.0 - phase), 255 };
+
+  std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+  for(uint32_t y = 0; y < height; y++)
+  {
+    for(uint32_t x = 0; x < width; x++)
+    {
+      double px = x + 0.5, py = y + 0.5;
+      double weights[3] = { edgeFunction(vertices[1], vertices[2], px, py) / area, edgeFunction(vertices[2], vertices[0], px, py) / area, edgeFunction(vertices[0], vertices[1], px, py) / area };
+      uint8_t* pixel = pixels.data() + (static_cast<size_t>(y) * width + x) * 4;
+      if(weights[0] < 0.0 || weights[1] < 0.0 || weights[2] < 0.0)
+      {
+        memcpy(pixel, clear, 4);
+        continue;
+      }
+      for(uint32_t channel = 0; channel < 3; channel++) pixel[channel] = unorm8(weights[0] * REFERENCE_COLORS[0][channel] + weights[1] * REFERENCE_COLORS[1][channel] + weights[2] * REFERENCE_COLORS[2][channel]);
+      pixel[3] = 255;
+    }
+  }
+  return pixels;
+}
+
+int main()
+{
+  uint32_t frames = getEnvironmentValue("TEMPLATE_BENCH_FRAMES", 1000); // Same variables as the golden run
+  uint32_t every = std::max(1u, getEnvironmentValue("TEMPLATE_CAPTURE_EVERY", 1));
+  uint32_t width = std::max(1u, getEnvironmentValue("TEMPLATE_HEADLESS_WIDTH", 1280));
+  uint32_t height = std::max(1u, getEnvironmentValue("TEMPLATE_HEADLESS_HEIGHT", 720));
+  std::filesystem::create_directories("golden");
+  uint32_t written = 0;
+  for(uint64_t frameNumber = 0; frameNumber < frames; frameNumber += every)
+  {
+    std::vector<uint8_t> pixels = renderReferenceFrame(frameNumber, width, height);
+    std::vector<uint8_t> png = encodePng(pixels.data(), width, height);
+    writeCaptureFile(captureFileName("golden", frameNumber, ".png"), png.data(), png.size());
+    written++;
+  }
+  std::cout << "Golden reference: " << written << " frames of " << width << "x" << height << " written to golden/" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,23 @@
+#include "init.hpp" // Device queries the render graph's dependencies call
+#include "rendergraph.hpp"
+
+// Transient memory aliasing of the render graph (make rendergraph-test): transients whose lifetimes don't overlap must
+// share their memory, the ones that do overlap must not. Runs the placement only, no device needed.
+
+int main()
+{
+  VkMemoryRequirements requirements = { 1 << 20, 256, ~0u };
+  // Pass lifetimes: the first two don't overlap, the third overlaps both
+  std::vector<TransientLifetime> transients = { { 0, 1, requirements }, { 2, 3, requirements }, { 1, 2, requirements } };
+  std::vector<RenderGraphMemory> memories;
+  std::vector<uint32_t> placement = aliasTransientMemory(transients, memories);
+
+  VkDeviceSize aliasedBytes = 0;
+  VkDeviceSize unaliasedBytes = transients.size() * requirements.size;
+  for(const RenderGraphMemory& memory : memories) aliasedBytes += memory.requirements.size;
+  std::cout << "Render graph aliasing: " << transients.size() << " transients in " << (aliasedBytes >> 10) << " KiB (" << (unaliasedBytes >> 10) << " KiB without aliasing)" << std::endl;
+
+  bool passed = placement[0] == placement[1] && placement[2] != placement[0] && aliasedBytes < unaliasedBytes;
+  std::cout << "Render graph aliasing: " << (passed ? "passed" : "FAILED") << std::endl;
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,213 @@
+#pragma once
+#include "common.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Work-stealing job system for CPU work which splits into independent pieces (frame stages, command recording, pipeline
+// compilation...). Every thread has its own deque: it pushes and pops its jobs at the back (newest first, their data still
+// in its cache), idle threads steal from the front of the others (oldest first: usually the biggest remaining work).
+// A JobCounter counts the unfinished jobs of a group. Waiting for it runs jobs instead of blocking, so the render thread and
+// jobs waiting for their own children help out. runJobAfter() holds a job back until another group has finished: a
+// dependency without any thread blocked on it.
+// Thread index 0 is the thread driving the frames (the render thread, or the main thread before it starts and when
+// headless), workers are 1..g_workerThreads.size(): per-thread resources are indexed with it.
+
+struct JobCounter;
+
+struct Job
+{
+  std::function<void()> work;
+  JobCounter* counter; // May be nullptr
+};
+
+struct JobCounter
+{
+  std::atomic<uint32_t> pending{0};
+  std::mutex mutex; // Decrements and continuations
+  std::vector<Job> continuations; // Queued when pending reaches 0
+};
+
+struct JobQueue
+{
+  std::mutex mutex;
+  std::deque<Job> jobs;
+  std::atomic<uint64_t> executed{0}; // Statistics, written by the owning thread only
+  std::atomic<uint64_t> stolen{0};
+};
+
+std::vector<std::thread> g_workerThreads;
+std::vector<std::unique_ptr<JobQueue>> g_jobQueues; // [thread]
+std::atomic<uint32_t> g_queuedJobs{0}; // In all the deques, wakes the sleeping workers
+std::mutex g_jobSleepMutex;
+std::condition_variable g_jobSleepCondition;
+std::atomic<bool> g_stopWorkers{false};
+thread_local uint32_t t_threadIndex = 0;
+
+static void finishJob(Job& job);
+
+static void pushJob(Job job)
+{
+  if(g_jobQueues.empty()) // No workers started (yet): run it right away
+  {
+    finishJob(job);
+    return;
+  }
+  JobQueue& queue = *g_jobQueues[t_threadIndex];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(std::move(job));
+  }
+  g_queuedJobs++;
+  { std::lock_guard<std::mutex> lock(g_jobSleepMutex); } // A worker between its check and its wait must not miss this
+  g_jobSleepCondition.notify_one();
+}
+
+// Own deque from the back, then the others' from the front, starting with the next thread.
+static bool popJob(Job& job)
+{
+  uint32_t threads = static_cast<uint32_t>(g_jobQueues.size());
+  for(uint32_t i = 0; i < threads; i++)
+  {
+    JobQueue& queue = *g_jobQueues[(t_threadIndex + i) % threads];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.jobs.empty()) continue;
+    if(i == 0)
+    {
+      job = std::move(queue.jobs.back());
+      queue.jobs.pop_back();
+    } else
+    {
+      job = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+      g_jobQueues[t_threadIndex]->stolen++;
+    }
+    g_queuedJobs--;
+    return true;
+  }
+  return false;
+}
+
+static void finishJob(Job& job)
+{
+  job.work();
+  if(!g_jobQueues.empty()) g_jobQueues[t_threadIndex]->executed++;
+  if(job.counter == nullptr) return;
+  std::vector<Job> ready;
+  {
+    std::lock_guard<std::mutex> lock(job.counter->mutex);
+    if(--job.counter->pending == 0) ready.swap(job.counter->continuations);
+  }
+  for(Job& continuation : ready) pushJob(std::move(continuation)); // Not touching the counter anymore: its waiter may destroy it
+}
+
+static void workerLoop(uint32_t threadIndex)
+{
+  t_threadIndex = threadIndex;
+  while(true)
+  {
+    Job job;
+    if(popJob(job))
+    {
+      finishJob(job);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(g_jobSleepMutex);
+    g_jobSleepCondition.wait(lock, []{ return g_stopWorkers || g_queuedJobs > 0; });
+    if(g_stopWorkers) return;
+  }
+}
+
+// Queues work on the calling thread's deque. counter (optional) counts it until it has finished.
+void runJob(std::function<void()> work, JobCounter* counter = nullptr)
+{
+  if(counter != nullptr) counter->pending++;
+  pushJob({ std::move(work), counter });
+}
+
+// Queues work once every job counted by dependency has finished (right away if none is pending).
+void runJobAfter(JobCounter& dependency, std::function<void()> work, JobCounter* counter = nullptr)
+{
+  if(counter != nullptr) counter->pending++;
+  {
+    std::lock_guard<std::mutex> lock(dependency.mutex);
+    if(dependency.pending > 0)
+    {
+      dependency.continuations.push_back({ std::move(work), counter });
+      return;
+    }
+  }
+  pushJob({ std::move(work), counter });
+}
+
+// Runs queued jobs (any of them, not only the counted ones) until the counter's jobs have all finished.
+void waitForJobs(JobCounter& counter)
+{
+  while(counter.pending > 0)
+  {
+    Job job;
+    if(popJob(job)) finishJob(job);
+    else std::this_thread::yield(); // The remaining jobs are running on other threads
+  }
+  std::lock_guard<std::mutex> lock(counter.mutex); // The last finishJob() has let go of the counter
+}
+
+// threadCount includes the thread driving the frames (index 0). 0: one per hardware thread.
+void startWorkerThreads(uint32_t threadCount)
+{
+  if(threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+  g_stopWorkers = false;
+  for(uint32_t i = 0; i < threadCount; i++) g_jobQueues.push_back(std::make_unique<JobQueue>());
+  for(uint32_t i = 1; i < threadCount; i++) g_workerThreads.emplace_back(workerLoop, i);
+  std::cout << "Worker threads: " << g_workerThreads.size() << " (+ render thread)" << std::endl;
+}
+
+// Every job must have been waited for.
+void stopWorkerThreads()
+{
+  {
+    std::lock_guard<std::mutex> lock(g_jobSleepMutex);
+    g_stopWorkers = true;
+  }
+  g_jobSleepCondition.notify_all();
+  for(std::thread& thread : g_workerThreads) thread.join();
+  g_workerThreads.clear();
+  g_jobQueues.clear();
+}
+
+uint32_t threadCount()
+{
+  return static_cast<uint32_t>(g_workerThreads.size()) + 1;
+}
+
+// Load balance of the run: jobs executed per thread and how many of them were stolen.
+void reportJobStats()
+{
+  if(g_jobQueues.empty()) return;
+  uint64_t executed = 0;
+  uint64_t stolen = 0;
+  std::cout << "Jobs per thread:";
+  for(std::unique_ptr<JobQueue>& queue : g_jobQueues)
+  {
+    std::cout << " " << queue->executed.load();
+    executed += queue->executed;
+    stolen += queue->stolen;
+  }
+  std::cout << " (" << executed << " jobs, " << stolen << " stolen, " << threadCount() << " threads)" << std::endl;
+}
+
+// Runs job(0..count-1) as one job per item, spread over the workers and the calling thread, returns when all are done.
+// job gets (item, thread index). Items should be worth a job: chunks of draws, pipelines...
+void parallelFor(uint32_t count, std::function<void(uint32_t, uint32_t)> job)
+{
+  if(count == 0) return;
+  JobCounter counter;
+  for(uint32_t item = 1; item < count; item++) runJob([&job, item]{ job(item, t_threadIndex); }, &counter);
+  job(0, t_threadIndex); // The caller works too instead of just waiting
+  waitForJobs(counter);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "common.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+
+// Chrome trace (chrome://tracing, ui.perfetto.dev) export. Every event is placed on the same clock (microseconds since
+// g_traceEpoch, steady_clock), so CPU zones and GPU passes line up on one timeline. TEMPLATE_TRACE=1 writes TRACE_FILE at exit.
+
+typedef std::chrono::steady_clock TraceClock;
+
+const char* TRACE_FILE = "trace.json";
+const uint32_t TRACE_TRACK_GPU = 1000; // Track ids below are CPU threads
+
+struct TraceEvent
+{
+  const char* name; // Static strings only: events are stored and written much later
+  uint32_t track;
+  double startMicroseconds;
+  double durationMicroseconds;
+};
+
+bool g_traceEnabled = false; // TEMPLATE_TRACE=1
+TraceClock::time_point g_traceEpoch = TraceClock::now();
+std::vector<TraceEvent> g_traceEvents;
+std::vector<std::pair<uint32_t, std::string>> g_traceTrackNames;
+std::mutex g_traceMutex;
+
+static double traceMicroseconds(TraceClock::time_point time)
+{
+  return std::chrono::duration<double, std::micro>(time - g_traceEpoch).count();
+}
+
+void addTraceEvent(const TraceEvent& event)
+{
+  std::lock_guard<std::mutex> lock(g_traceMutex);
+  g_traceEvents.push_back(event);
+}
+
+void nameTraceTrack(uint32_t track, const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(g_traceMutex);
+  g_traceTrackNames.push_back({ track, name });
+}
+
+static void writeJsonString(std::ofstream& file, const char* text)
+{
+  file << '"';
+  for(const char* c = text; *c != '\0'; c++)
+  {
+    if(*c == '"' || *c == '\\') file << '\\';
+    file << *c;
+  }
+  file << '"';
+}
+
+void writeTrace()
+{
+  if(!g_traceEnabled) return;
+  std::lock_guard<std::mutex> lock(g_traceMutex);
+  std::ofstream file(TRACE_FILE, std::ios::trunc);
+  if(!file.is_open())
+  {
+    std::cerr << "Failed to write " << TRACE_FILE << std::endl;
+    return;
+  }
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+  for(const auto& [track, name] : g_traceTrackNames)
+  {
+    file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << track << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+    writeJsonString(file, name.c_str());
+    file << "}}";
+    first = false;
+  }
+  file.precision(3);
+  file << std::fixed;
+  for(const TraceEvent& event : g_traceEvents)
+  {
+    file << (first ? "" : ",\n") << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << event.track << ",\"ts\":" << event.startMicroseconds << ",\"dur\":" << event.durationMicroseconds << ",\"name\":";
+    writeJsonString(file, event.name);
+    file << "}";
+    first = false;
+  }
+  file << "\n]}\n";
+  std::cout << "Trace: " << g_traceEvents.size() << " events written to " << TRACE_FILE << std::endl;
+}
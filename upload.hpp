@@ -0,0 +1,364 @@
+#pragma once
+#include "common.hpp"
+#include "memory.hpp"
+#include "sync.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+
+// Asynchronous uploads: data is written into a persistently mapped staging ring buffer and copied by the transfer queue
+// (transfer-only family when the device has one), so uploads run in parallel with rendering instead of stalling the graphics queue.
+// Flow of a batch: recording -> submitted (fence) -> fence polled at frame start -> ownership acquire barriers recorded into the
+// frame's graphics command buffer -> resources usable from that frame on. The graphics queue never waits for the transfer queue:
+// the fence was already observed signaled on the host before the acquiring frame was submitted.
+// With queue timelines (sync.hpp) a batch has no fence: it signals the next value of the transfer timeline, and its staging
+// memory and command buffer are reclaimed once the timeline has reached that value.
+// Streaming I/O threads only reserve staging memory and record copies (t_uploadRecordOnly): every submission to the transfer
+// queue, and every wait on one, happens on the thread driving the frames (or init and shutdown, before and after it), so the
+// transfer queue, which may be the graphics queue itself, is only ever used by that thread. A recording thread which finds the
+// ring or the batches full sleeps on g_uploadCondition until the frame thread has retired a batch. The GPU is never waited on
+// with g_uploadMutex held. Reservations bigger than a quarter of the ring are taken one at a time: two of them unrecorded
+// could otherwise fill the ring and keep each other waiting longer than needed.
+
+const VkDeviceSize STAGING_RING_SIZE = 32ull << 20;
+const uint32_t UPLOAD_BATCH_COUNT = 8;
+
+struct StagingRegion
+{
+  void* mapped = nullptr; // Write the data here before recording the copy
+  VkDeviceSize offset = 0; // Offset in g_stagingBuffer
+  VkDeviceSize size = 0;
+  uint64_t position = 0; // Virtual ring position
+};
+
+struct UploadBatch
+{
+  VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  VkFence fence = VK_NULL_HANDLE; // Without queue timelines
+  uint64_t timelineValue = 0; // Transfer timeline value signaled by its submission
+  uint64_t id = 0; // Upload ticket of everything recorded into it
+  std::vector<uint64_t> stagingPositions; // Its staging regions: free again once the batch has completed
+  std::vector<VkBufferMemoryBarrier> bufferAcquires; // Recorded on the graphics queue when the batch has completed
+  std::vector<VkImageMemoryBarrier> imageAcquires;
+  VkPipelineStageFlags dstStages = 0;
+};
+
+VkCommandPool g_transferCommandPool = VK_NULL_HANDLE;
+AllocatedBuffer g_stagingBuffer;
+uint64_t g_stagingHead = 0; // Next free ring position
+uint64_t g_stagingTail = 0; // Oldest ring position still in use
+std::multiset<uint64_t> g_stagingInUse; // Start positions of regions reserved and not yet completed. Recording order may differ from reservation order
+std::vector<UploadBatch> g_uploadBatches;
+std::vector<uint32_t> g_freeUploadBatches;
+std::deque<uint32_t> g_submittedUploadBatches; // Submission order: completed in this order too
+int32_t g_recordingUploadBatch = -1;
+uint64_t g_nextUploadId = 1;
+uint64_t g_acquiredUploadId = 0; // Uploads up to this ticket are usable on the graphics queue
+std::vector<VkBufferMemoryBarrier> g_pendingBufferAcquires; // Completed, waiting for the next frame's command buffer
+std::vector<VkImageMemoryBarrier> g_pendingImageAcquires;
+VkPipelineStageFlags g_pendingAcquireStages = 0;
+uint64_t g_pendingAcquireId = 0;
+uint32_t g_uploadSrcFamily = VK_QUEUE_FAMILY_IGNORED; // Release/acquire families, both IGNORED when there's no separate transfer family
+uint32_t g_uploadDstFamily = VK_QUEUE_FAMILY_IGNORED;
+std::mutex g_uploadMutex; // Uploads may come from streaming threads
+std::condition_variable g_uploadCondition; // Batch retired or large reservation recorded
+uint64_t g_largeStagingPosition = UINT64_MAX; // The large reservation not yet recorded, UINT64_MAX: none
+thread_local bool t_uploadRecordOnly = false; // Streaming threads: never submit or wait on the GPU
+
+void createUploadContext()
+{
+  QueueFamilyIndices indices = findQueueFamilies(g_physicalDevice);
+  uint32_t transferFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+  if(transferFamily != indices.graphicsFamily.value()) // Exclusive resources must change owner: release on transfer, acquire on graphics
+  {
+    g_uploadSrcFamily = transferFamily;
+    g_uploadDstFamily = indices.graphicsFamily.value();
+  }
+
+  VkCommandPoolCreateInfo commandPoolCreateInfo = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+  commandPoolCreateInfo.queueFamilyIndex = transferFamily;
+  commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  CHECK_VULKAN_ERRORS( vkCreateCommandPool(g_device, &commandPoolCreateInfo, g_allocator, &g_transferCommandPool) );
+
+  VkCommandBufferAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+  allocateInfo.commandPool = g_transferCommandPool;
+  allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocateInfo.commandBufferCount = 1;
+  VkFenceCreateInfo fenceCreateInfo = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+
+  g_uploadBatches.resize(UPLOAD_BATCH_COUNT);
+  for(uint32_t i = 0; i < UPLOAD_BATCH_COUNT; i++)
+  {
+    CHECK_VULKAN_ERRORS( vkAllocateCommandBuffers(g_device, &allocateInfo, &g_uploadBatches[i].commandBuffer) );
+    if(!g_timelineSemaphores) CHECK_VULKAN_ERRORS( vkCreateFence(g_device, &fenceCreateInfo, g_allocator, &g_uploadBatches[i].fence) );
+    g_freeUploadBatches.push_back(i);
+  }
+
+  g_stagingBuffer = createBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CpuToGpu);
+  std::cout << "Uploads: " << (indices.transferFamily.has_value() ? "dedicated transfer queue" : "graphics queue") << ", " << (STAGING_RING_SIZE >> 20) << " MiB staging ring" << std::endl;
+}
+
+void destroyUploadContext()
+{
+  for(UploadBatch& batch : g_uploadBatches) vkDestroyFence(g_device, batch.fence, g_allocator);
+  g_uploadBatches.clear();
+  g_freeUploadBatches.clear();
+  g_submittedUploadBatches.clear();
+  g_recordingUploadBatch = -1;
+  vkDestroyCommandPool(g_device, g_transferCommandPool, g_allocator); // Frees the command buffers too
+  g_transferCommandPool = VK_NULL_HANDLE;
+  destroyBuffer(g_stagingBuffer);
+}
+
+static void releaseStaging(const std::vector<uint64_t>& positions)
+{
+  for(uint64_t position : positions) g_stagingInUse.erase(g_stagingInUse.find(position));
+  g_stagingTail = g_stagingInUse.empty() ? g_stagingHead : *g_stagingInUse.begin();
+}
+
+// Completed batches hand their acquire barriers over to the next frame and become free. Doesn't wait. Frame thread only.
+static void retireUploadBatches()
+{
+  bool retired = false;
+  while(!g_submittedUploadBatches.empty())
+  {
+    UploadBatch& batch = g_uploadBatches[g_submittedUploadBatches.front()];
+    if(g_timelineSemaphores)
+    {
+      if(!timelineReached(TIMELINE_TRANSFER, batch.timelineValue)) break; // In order: the later ones can't be done either
+    }
+    else if(vkGetFenceStatus(g_device, batch.fence) != VK_SUCCESS) break;
+    retired = true;
+
+    g_pendingBufferAcquires.insert(g_pendingBufferAcquires.end(), batch.bufferAcquires.begin(), batch.bufferAcquires.end());
+    g_pendingImageAcquires.insert(g_pendingImageAcquires.end(), batch.imageAcquires.begin(), batch.imageAcquires.end());
+    g_pendingAcquireStages |= batch.dstStages;
+    g_pendingAcquireId = std::max(g_pendingAcquireId, batch.id);
+    releaseStaging(batch.stagingPositions);
+
+    if(!g_timelineSemaphores) CHECK_VULKAN_ERRORS( vkResetFences(g_device, 1, &batch.fence) );
+    g_freeUploadBatches.push_back(g_submittedUploadBatches.front());
+    g_submittedUploadBatches.pop_front();
+  }
+  if(retired) g_uploadCondition.notify_all();
+}
+
+static void submitRecordingBatch()
+{
+  if(g_recordingUploadBatch < 0) return;
+  UploadBatch& batch = g_uploadBatches[g_recordingUploadBatch];
+  CHECK_VULKAN_ERRORS( vkEndCommandBuffer(batch.commandBuffer) );
+
+  SubmitSync sync;
+  batch.timelineValue = submitToTimeline(TIMELINE_TRANSFER, batch.commandBuffer, sync, batch.fence);
+
+  g_submittedUploadBatches.push_back(g_recordingUploadBatch);
+  g_recordingUploadBatch = -1;
+}
+
+// Staging memory or batches are all in use: waits until some are free again. lock holds g_uploadMutex, released while waiting.
+static void waitForUploadProgress(std::unique_lock<std::mutex>& lock)
+{
+  if(t_uploadRecordOnly) // The frame thread submits and retires, at the latest next frame
+  {
+    g_uploadCondition.wait(lock);
+    return;
+  }
+  submitRecordingBatch();
+  if(g_submittedUploadBatches.empty()) // Only reservations of streaming threads, recorded in a moment
+  {
+    g_uploadCondition.wait_for(lock, std::chrono::milliseconds(1));
+    return;
+  }
+  const UploadBatch& batch = g_uploadBatches[g_submittedUploadBatches.front()];
+  uint64_t value = batch.timelineValue;
+  VkFence fence = batch.fence; // Reset only by this thread, in retireUploadBatches()
+  lock.unlock(); // Streaming threads keep recording meanwhile
+  if(g_timelineSemaphores) waitTimeline(TIMELINE_TRANSFER, value);
+  else CHECK_VULKAN_ERRORS( vkWaitForFences(g_device, 1, &fence, VK_TRUE, UINT64_MAX) );
+  lock.lock();
+  retireUploadBatches();
+}
+
+static UploadBatch& recordingBatch(std::unique_lock<std::mutex>& lock)
+{
+  while(g_recordingUploadBatch < 0 && g_freeUploadBatches.empty()) waitForUploadProgress(lock); // All batches in flight
+  if(g_recordingUploadBatch >= 0) return g_uploadBatches[g_recordingUploadBatch];
+
+  g_recordingUploadBatch = g_freeUploadBatches.back();
+  g_freeUploadBatches.pop_back();
+  UploadBatch& batch = g_uploadBatches[g_recordingUploadBatch];
+  batch.id = g_nextUploadId++;
+  batch.bufferAcquires.clear();
+  batch.imageAcquires.clear();
+  batch.stagingPositions.clear();
+  batch.dstStages = 0;
+
+  CHECK_VULKAN_ERRORS( vkResetCommandBuffer(batch.commandBuffer, 0) );
+  VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  CHECK_VULKAN_ERRORS( vkBeginCommandBuffer(batch.commandBuffer, &beginInfo) );
+  return batch;
+}
+
+// Reserve staging memory to write upload data into directly (e.g. read a file straight into it, no extra copy).
+StagingRegion reserveStaging(VkDeviceSize size, VkDeviceSize alignment = 16)
+{
+  std::unique_lock<std::mutex> lock(g_uploadMutex);
+  if(size > STAGING_RING_SIZE) throw std::runtime_error("Upload bigger than the staging ring buffer!");
+  alignment = std::max(alignment, g_properties.limits.optimalBufferCopyOffsetAlignment);
+  bool large = size > STAGING_RING_SIZE / 4;
+
+  while(true)
+  {
+    if(large && g_largeStagingPosition != UINT64_MAX)
+    {
+      waitForUploadProgress(lock);
+      continue;
+    }
+    uint64_t position = (g_stagingHead + alignment - 1) & ~(alignment - 1);
+    if((position % STAGING_RING_SIZE) + size > STAGING_RING_SIZE) position = (position / STAGING_RING_SIZE + 1) * STAGING_RING_SIZE; // No wrapping inside a region
+    if(position + size - g_stagingTail <= STAGING_RING_SIZE)
+    {
+      g_stagingHead = position + size;
+      g_stagingInUse.insert(position);
+      if(large) g_largeStagingPosition = position;
+
+      StagingRegion region;
+      region.offset = position % STAGING_RING_SIZE;
+      region.mapped = static_cast<char*>(g_stagingBuffer.allocation.mapped) + region.offset;
+      region.size = size;
+      region.position = position;
+      return region;
+    }
+    waitForUploadProgress(lock); // Ring full: until the oldest batch has freed its staging memory
+  }
+}
+
+static void finishRegion(UploadBatch& batch, const StagingRegion& region, VkPipelineStageFlags dstStage)
+{
+  batch.stagingPositions.push_back(region.position);
+  batch.dstStages |= dstStage;
+  if(region.position == g_largeStagingPosition)
+  {
+    g_largeStagingPosition = UINT64_MAX;
+    g_uploadCondition.notify_all();
+  }
+}
+
+// Returns the upload ticket for uploadComplete() / waitForUpload().
+uint64_t copyStagingToBuffer(const StagingRegion& region, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+  std::unique_lock<std::mutex> lock(g_uploadMutex);
+  UploadBatch& batch = recordingBatch(lock);
+
+  VkBufferCopy copy = { region.offset, dstOffset, region.size };
+  vkCmdCopyBuffer(batch.commandBuffer, g_stagingBuffer.buffer, dstBuffer, 1, &copy);
+
+  VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0; // Release: destination access is defined by the acquire
+  barrier.srcQueueFamilyIndex = g_uploadSrcFamily;
+  barrier.dstQueueFamilyIndex = g_uploadDstFamily;
+  barrier.buffer = dstBuffer;
+  barrier.offset = dstOffset;
+  barrier.size = region.size;
+  if(g_uploadSrcFamily != VK_QUEUE_FAMILY_IGNORED) vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+  barrier.srcAccessMask = (g_uploadSrcFamily != VK_QUEUE_FAMILY_IGNORED) ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT; // Same queue: plain memory dependency
+  barrier.dstAccessMask = dstAccess;
+  batch.bufferAcquires.push_back(barrier);
+  finishRegion(batch, region, dstStage);
+  return batch.id;
+}
+
+// copies: bufferOffset relative to the region. Every mip level is copied whole (always valid on transfer-only queues,
+// whatever their minImageTransferGranularity). The image ends up in finalLayout.
+uint64_t copyStagingToImage(const StagingRegion& region, VkImage image, const VkImageSubresourceRange& range, std::vector<VkBufferImageCopy> copies, VkImageLayout finalLayout, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+  std::unique_lock<std::mutex> lock(g_uploadMutex);
+  UploadBatch& batch = recordingBatch(lock);
+
+  VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Whole subresources are overwritten
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = range;
+  vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  for(VkBufferImageCopy& copy : copies) copy.bufferOffset += region.offset;
+  vkCmdCopyBufferToImage(batch.commandBuffer, g_stagingBuffer.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copies.size()), copies.data());
+
+  // Release (or on a shared queue: the whole transition) to the final layout. The acquire repeats the same layout transition.
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = finalLayout;
+  barrier.srcQueueFamilyIndex = g_uploadSrcFamily;
+  barrier.dstQueueFamilyIndex = g_uploadDstFamily;
+  vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  if(g_uploadSrcFamily != VK_QUEUE_FAMILY_IGNORED)
+  {
+    barrier.srcAccessMask = 0;
+  } else // Same queue: layout already transitioned, only a memory dependency is left for the frame
+  {
+    barrier.oldLayout = finalLayout;
+  }
+  barrier.dstAccessMask = dstAccess;
+  batch.imageAcquires.push_back(barrier);
+  finishRegion(batch, region, dstStage);
+  return batch.id;
+}
+
+uint64_t uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size, VkAccessFlags dstAccess, VkPipelineStageFlags dstStage)
+{
+  StagingRegion region = reserveStaging(size);
+  memcpy(region.mapped, data, size); // Coherent memory, no flush needed
+  return copyStagingToBuffer(region, dstBuffer, dstOffset, dstAccess, dstStage);
+}
+
+// Start the transfer of everything recorded so far. Called every frame, doesn't wait for anything. Frame thread only.
+void flushUploads()
+{
+  std::lock_guard<std::mutex> lock(g_uploadMutex);
+  submitRecordingBatch();
+}
+
+// At the beginning of a frame's graphics command buffer: acquire everything whose transfer has completed.
+void recordUploadAcquires(VkCommandBuffer commandBuffer)
+{
+  std::lock_guard<std::mutex> lock(g_uploadMutex);
+  retireUploadBatches();
+  if(g_pendingBufferAcquires.empty() && g_pendingImageAcquires.empty()) return;
+
+  VkPipelineStageFlags srcStage = (g_uploadSrcFamily != VK_QUEUE_FAMILY_IGNORED) ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
+  vkCmdPipelineBarrier(commandBuffer, srcStage, g_pendingAcquireStages, 0, 0, nullptr,
+    static_cast<uint32_t>(g_pendingBufferAcquires.size()), g_pendingBufferAcquires.data(), static_cast<uint32_t>(g_pendingImageAcquires.size()), g_pendingImageAcquires.data());
+
+  g_acquiredUploadId = std::max(g_acquiredUploadId, g_pendingAcquireId);
+  g_pendingBufferAcquires.clear();
+  g_pendingImageAcquires.clear();
+  g_pendingAcquireStages = 0;
+}
+
+// True when the upload can be used by graphics commands recorded from now on.
+bool uploadComplete(uint64_t ticket)
+{
+  std::lock_guard<std::mutex> lock(g_uploadMutex);
+  return ticket <= g_acquiredUploadId;
+}
+
+// Blocks until the transfer is done (loading screens, init, shutdown). The acquire still happens in the next frame. Not from
+// streaming threads.
+void waitForUploads()
+{
+  std::unique_lock<std::mutex> lock(g_uploadMutex);
+  submitRecordingBatch();
+  while(!g_submittedUploadBatches.empty()) waitForUploadProgress(lock);
+}
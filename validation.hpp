@@ -0,0 +1,178 @@
+#pragma once
+#include "common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+// Validation message sink: the debug callback runs inside the driver call which triggered it (on any thread), so it only
+// counts the message and copies it into a lock-free ring; a background thread formats and writes them to std::cerr.
+// Messages are deduplicated by messageIdNumber: the first VALIDATION_REPEATS of an ID are written in full, after that only
+// when its count reaches a power of two (with the count), so a warning repeated every draw costs a few atomics per call.
+// Per-ID counts are reported when the sink stops. Messages arriving with the ring full are dropped and counted.
+
+const uint32_t VALIDATION_RING_SIZE = 256; // Power of two
+const uint32_t VALIDATION_ID_TABLE_SIZE = 1024; // Power of two, distinct message IDs tracked
+const uint64_t VALIDATION_REPEATS = 3; // Written in full this many times per ID
+
+struct ValidationMessage
+{
+  std::atomic<uint32_t> sequence; // Ring position + 1 once written, + VALIDATION_RING_SIZE once read
+  int32_t id;
+  VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+  uint64_t count; // Occurrences of the ID so far
+  char text[1024]; // Truncated
+};
+
+struct ValidationRing
+{
+  ValidationMessage messages[VALIDATION_RING_SIZE];
+  alignas(64) std::atomic<uint32_t> tail{0}; // Next to write, claimed by the callbacks
+  alignas(64) uint32_t head = 0; // Next to read, the sink thread only
+  ValidationRing()
+  {
+    for(uint32_t i = 0; i < VALIDATION_RING_SIZE; i++) messages[i].sequence = i;
+  }
+};
+
+struct ValidationIdEntry
+{
+  std::atomic<uint64_t> key{0}; // messageIdNumber | VALIDATION_ID_USED, 0: free
+  std::atomic<uint64_t> count{0};
+  char name[64] = {}; // pMessageIdName, written once by the thread claiming the entry, read when the sink stops
+};
+
+const uint64_t VALIDATION_ID_USED = 1ull << 32;
+
+ValidationRing g_validationRing;
+ValidationIdEntry g_validationIds[VALIDATION_ID_TABLE_SIZE];
+std::atomic<uint64_t> g_validationDropped{0}; // Ring or ID table full
+std::thread g_validationThread;
+std::mutex g_validationMutex; // Sleeping only: the callbacks never take it
+std::condition_variable g_validationCondition;
+std::atomic<bool> g_stopValidation{false};
+
+// Open addressing, entries are never removed: a claimed key stays.
+static ValidationIdEntry* findValidationId(int32_t id, const char* name)
+{
+  uint64_t key = static_cast<uint32_t>(id) | VALIDATION_ID_USED;
+  uint32_t index = static_cast<uint32_t>(key * 0x9E3779B97F4A7C15ull >> 40) & (VALIDATION_ID_TABLE_SIZE - 1);
+  for(uint32_t probe = 0; probe < VALIDATION_ID_TABLE_SIZE; probe++)
+  {
+    ValidationIdEntry& entry = g_validationIds[(index + probe) & (VALIDATION_ID_TABLE_SIZE - 1)];
+    uint64_t current = entry.key.load(std::memory_order_acquire);
+    if(current == 0)
+    {
+      if(entry.key.compare_exchange_strong(current, key, std::memory_order_acq_rel))
+      {
+        if(name != nullptr) strncpy(entry.name, name, sizeof(entry.name) - 1);
+        return &entry;
+      }
+    }
+    if(current == key) return &entry;
+  }
+  return nullptr;
+}
+
+static bool pushValidationMessage(int32_t id, VkDebugUtilsMessageSeverityFlagBitsEXT severity, uint64_t count, const char* text)
+{
+  uint32_t position = g_validationRing.tail.load(std::memory_order_relaxed);
+  ValidationMessage* message;
+  while(true)
+  {
+    message = &g_validationRing.messages[position & (VALIDATION_RING_SIZE - 1)];
+    int32_t difference = static_cast<int32_t>(message->sequence.load(std::memory_order_acquire) - position);
+    if(difference == 0)
+    {
+      if(g_validationRing.tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+    }
+    else if(difference < 0) return false; // Full: the sink hasn't read this slot yet
+    else position = g_validationRing.tail.load(std::memory_order_relaxed);
+  }
+  message->id = id;
+  message->severity = severity;
+  message->count = count;
+  strncpy(message->text, text != nullptr ? text : "", sizeof(message->text) - 1);
+  message->text[sizeof(message->text) - 1] = '\0';
+  message->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+// The debug callback's work: never blocks, never allocates.
+static void submitValidationMessage(VkDebugUtilsMessageSeverityFlagBitsEXT severity, const VkDebugUtilsMessengerCallbackDataEXT* data)
+{
+  ValidationIdEntry* entry = findValidationId(data->messageIdNumber, data->pMessageIdName);
+  if(entry == nullptr)
+  {
+    g_validationDropped++;
+    return;
+  }
+  uint64_t count = ++entry->count;
+  if(count > VALIDATION_REPEATS && (count & (count - 1)) != 0) return; // Rate limited: counted only
+  if(!pushValidationMessage(data->messageIdNumber, severity, count, data->pMessage)) g_validationDropped++;
+  else if(severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) g_validationCondition.notify_one(); // Errors shown right away, the rest within the poll interval
+}
+
+static bool popValidationMessage(ValidationMessage& out)
+{
+  ValidationMessage& message = g_validationRing.messages[g_validationRing.head & (VALIDATION_RING_SIZE - 1)];
+  if(message.sequence.load(std::memory_order_acquire) != g_validationRing.head + 1) return false;
+  out.id = message.id;
+  out.severity = message.severity;
+  out.count = message.count;
+  memcpy(out.text, message.text, sizeof(out.text));
+  message.sequence.store(g_validationRing.head + VALIDATION_RING_SIZE, std::memory_order_release);
+  g_validationRing.head++;
+  return true;
+}
+
+static void writeValidationMessages()
+{
+  ValidationMessage message;
+  while(popValidationMessage(message))
+  {
+    if(message.count > VALIDATION_REPEATS) std::cerr << "(repeated " << message.count << " times) ";
+    std::cerr << message.text << std::endl;
+  }
+}
+
+static void validationSinkLoop()
+{
+  while(!g_stopValidation)
+  {
+    writeValidationMessages();
+    std::unique_lock<std::mutex> lock(g_validationMutex);
+    g_validationCondition.wait_for(lock, std::chrono::milliseconds(50)); // Callbacks notify without the lock, the timeout catches a missed wake-up
+  }
+  writeValidationMessages();
+}
+
+// Before the instance is created: its creation is validated too.
+void startValidationSink()
+{
+  g_stopValidation = false;
+  g_validationThread = std::thread(validationSinkLoop);
+}
+
+// After the instance is destroyed. Writes what's left and the message counts per ID.
+void stopValidationSink()
+{
+  if(!g_validationThread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(g_validationMutex);
+    g_stopValidation = true;
+  }
+  g_validationCondition.notify_one();
+  g_validationThread.join();
+
+  std::vector<ValidationIdEntry*> entries;
+  for(ValidationIdEntry& entry : g_validationIds) if(entry.key != 0) entries.push_back(&entry);
+  std::sort(entries.begin(), entries.end(), [](ValidationIdEntry* a, ValidationIdEntry* b) { return a->count > b->count; });
+  for(ValidationIdEntry* entry : entries)
+  {
+    std::cout << "Validation message " << entry->name << " (0x" << std::hex << static_cast<uint32_t>(entry->key) << std::dec << "): " << entry->count << " times" << std::endl;
+  }
+  if(g_validationDropped > 0) std::cout << "Validation messages dropped: " << g_validationDropped << std::endl;
+}